@@ -1,5 +1,6 @@
 #pragma once
 #include "../std.hpp"
+#include "../util/threadpool.hpp"
 #include "http_server.hpp"
 #include "http_router.hpp"
 #include "http_proxy_server.hpp"
@@ -46,31 +47,55 @@ namespace cortono::http
                 is_https_ = true;
                 return *this;
             }
+            // 空闲连接的超时时间：收到第一个字节之前、keep-alive等待下一个请求、请求进行中，0表示不检查
+            self_t& idle_timeout(std::chrono::milliseconds pre_first_byte,
+                                 std::chrono::milliseconds keep_alive,
+                                 std::chrono::milliseconds mid_request) {
+                idle_timeouts_ = { pre_first_byte, keep_alive, mid_request };
+                return *this;
+            }
+            // 执行offload规则的线程数
+            self_t& offload_threads(std::size_t n) {
+                offload_threads_ = n;
+                return *this;
+            }
+            // 同时在线程池中排队和执行的请求数上限，超过后直接返回503
+            self_t& offload_limit(std::size_t n) {
+                offload_limit_ = n;
+                return *this;
+            }
             void run() {
                 if(is_proxy_server_) {
 #ifdef CORTONO_USE_SSL
                     if(is_https_) {
                         https_proxy_server_ = std::make_unique<https_proxy_server_t>(*this, bindaddr_, port_, concurrency_);
+                        configure(*https_proxy_server_);
                         https_proxy_server_->run();
                     }
                     else
 #endif
                     {
                         http_proxy_server_ = std::make_unique<http_proxy_server_t>(*this, bindaddr_, port_, concurrency_);
+                        configure(*http_proxy_server_);
                         http_proxy_server_->run();
                     }
                 }
                 else {
                     router_.volidate();
+                    if(router_.has_offload()) {
+                        offload_pool_ = std::make_unique<util::threadpool>(offload_threads_);
+                    }
 #ifdef CORTONO_USE_SSL
                     if(is_https_) {
                         https_server_ = std::make_unique<https_server_t>(*this, bindaddr_, port_, concurrency_);
+                        configure(*https_server_);
                         https_server_->run();
                     }
                     else
 #endif
                     {
                         http_server_ = std::make_unique<http_server_t>(*this, bindaddr_, port_, concurrency_);
+                        configure(*http_server_);
                         http_server_->run();
                     }
                 }
@@ -78,6 +103,33 @@ namespace cortono::http
             void handle(const Request& req, Response& res) {
                 router_.handle(req, res);
             }
+            std::pair<DynamicRule*, routing_params> route(const Request& req) {
+                return router_.route(req);
+            }
+            util::threadpool& offload_pool() {
+                return *offload_pool_;
+            }
+            // 占用一个offload名额，已满时返回false
+            bool acquire_offload() {
+                if(offloading_.fetch_add(1, std::memory_order_relaxed) >= offload_limit_) {
+                    offloading_.fetch_sub(1, std::memory_order_relaxed);
+                    return false;
+                }
+                return true;
+            }
+            void release_offload() {
+                offloading_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        private:
+            template <typename Server>
+            void configure(Server& server) {
+                using Phase = net::IdleList::Phase;
+                for(auto phase : { Phase::PreFirstByte, Phase::KeepAlive, Phase::MidRequest }) {
+                    if(auto timeout = idle_timeouts_[static_cast<std::size_t>(phase)]; timeout.count() > 0) {
+                        server.service().set_idle_timeout(phase, timeout);
+                    }
+                }
+            }
         private:
             Router router_;
             bool is_proxy_server_{ false };
@@ -85,6 +137,11 @@ namespace cortono::http
             unsigned short port_{ 9999 };
             std::string bindaddr_ { "0.0.0.0" };
             std::size_t concurrency_{ 1 };
+            std::array<std::chrono::milliseconds, net::IdleList::PHASE_NUMS> idle_timeouts_{};
+            std::size_t offload_threads_{ std::thread::hardware_concurrency() };
+            std::size_t offload_limit_{ 1024 };
+            std::atomic<std::size_t> offloading_{ 0 };
+            std::unique_ptr<util::threadpool> offload_pool_;
             std::unique_ptr<http_server_t> http_server_;
             std::unique_ptr<http_proxy_server_t> http_proxy_server_;
 #ifdef CORTONO_USE_SSL
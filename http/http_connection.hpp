@@ -8,10 +8,18 @@
 namespace cortono::http
 {
     // Connection仅仅用来定义不同的连接类型，作为handle_read的参数
+    /*
+     * 1.一次可读事件中依次处理接收缓冲区中所有完整的请求(流水线)
+     * 2.offload规则的处理函数在线程池中执行，完成后通过safe_call把响应交回连接所属的loop
+     * 3.响应按照请求的顺序发送，前面有offload的请求没有完成时，后续的响应在pending_中等待
+     *   等待的响应达到MAX_PIPELINE时暂停解析，剩余的请求留在接收缓冲区中
+     */
     template <typename Handler, typename Connection>
-    class WebConnection
+    class WebConnection : public std::enable_shared_from_this<WebConnection<Handler, Connection>>
     {
         public:
+            static constexpr std::size_t MAX_PIPELINE = 64;
+
             WebConnection(Handler& handler)
                 : handler_(handler)
             {
@@ -20,67 +28,178 @@ namespace cortono::http
             // 不同之处完全隐藏在TcpConnection和SslConnection的同名接口下
             void handle_read(typename Connection::Pointer& conn_ptr) {
                 log_debug(conn_ptr->recv_buffer()->to_string());
-                int len = parser_.feed(conn_ptr->recv_buffer()->data(), conn_ptr->recv_buffer()->size());
-                conn_ptr->recv_buffer()->retrieve_read_bytes(len);
-                if(parser_.done()) {
+                while(!closing_ && pending_.size() < MAX_PIPELINE && !conn_ptr->recv_buffer()->empty()) {
+                    int len = parser_.feed(conn_ptr->recv_buffer()->data(), conn_ptr->recv_buffer()->size());
+                    conn_ptr->recv_buffer()->retrieve_read_bytes(len);
+                    if(!parser_.done()) {
+                        // 请求还没有接收完整
+                        return;
+                    }
                     log_trace;
-                    req_ = std::move(parser_.to_request());
-                    bool add_keep_alive = false;
-                    bool is_invalid_request = false;
-                    if(parser_.check_version(1, 0)) {
-                        if(req_.has_header("connection")) {
-                            if(utils::iequal(req_.get_header_value("connection"), "Keep-Alive")) {
-                                add_keep_alive = true;
-                            }
+                    handle_request(conn_ptr, parser_.to_request());
+                    parser_.clear();
+                }
+                if(!closing_ && pending_.empty() && conn_ptr->recv_buffer()->empty()) {
+                    // 请求处理完成并且没有流水线中的后续请求，等待下一个请求
+                    conn_ptr->set_idle_phase(net::IdleList::Phase::KeepAlive);
+                }
+            }
+        private:
+            struct PendingResponse
+            {
+                bool ready;
+                bool keep_alive;
+                Response res;
+            };
+
+            void handle_request(typename Connection::Pointer& conn_ptr, Request&& req) {
+                Response res;
+                bool add_keep_alive = false;
+                bool is_invalid_request = false;
+                if(parser_.check_version(1, 0)) {
+                    if(req.has_header("connection")) {
+                        if(utils::iequal(req.get_header_value("connection"), "Keep-Alive")) {
+                            add_keep_alive = true;
                         }
                     }
-                    else if(parser_.check_version(1, 1)) {
-                        add_keep_alive = true;
-                        if(req_.has_header("connection")) {
-                            if(utils::iequal(req_.get_header_value("connection"), "Close")) {
-                                add_keep_alive = false;
-                            }
-                        }
-                        if(!req_.has_header("host")) {
-                            is_invalid_request = true;
-                            res_ = Response(400);
-                            log_info("no host, return Response(400)");
+                }
+                else if(parser_.check_version(1, 1)) {
+                    add_keep_alive = true;
+                    if(req.has_header("connection")) {
+                        if(utils::iequal(req.get_header_value("connection"), "Close")) {
+                            add_keep_alive = false;
                         }
-                        else {
-                            auto domain = req_.get_header_value("host");
-                            auto pos = domain.find_first_of(':');
-                            if(pos != decltype(domain)::npos) {
-                                domain = domain.substr(0, pos);
-                            }
-                            res_.set_domain(std::move(domain));
+                    }
+                    if(!req.has_header("host")) {
+                        is_invalid_request = true;
+                        res = Response(400);
+                        log_info("no host, return Response(400)");
+                    }
+                    else {
+                        auto domain = req.get_header_value("host");
+                        auto pos = domain.find_first_of(':');
+                        if(pos != decltype(domain)::npos) {
+                            domain = domain.substr(0, pos);
                         }
+                        res.set_domain(std::move(domain));
                     }
-                    if(!is_invalid_request) {
-                        log_info("handle request");
-                        handler_.handle(req_, res_);
+                }
+                // 服务正在退出，响应完成后关闭连接
+                if(conn_ptr->loop()->draining()) {
+                    add_keep_alive = false;
+                }
+                if(!is_invalid_request) {
+                    log_debug("handle request");
+                    auto [rule, params] = handler_.route(req);
+                    if(rule != nullptr && rule->is_offload()) {
+                        if(handler_.acquire_offload()) {
+                            offload(conn_ptr, rule, std::move(req), std::move(res), std::move(params), add_keep_alive);
+                            return;
+                        }
+                        log_info("offload queue is full, return Response(503)");
+                        res = Response(503);
                     }
-                    if(add_keep_alive) {
-                        res_.set_header("Connection", "Keep-Alive");
+                    else if(rule != nullptr) {
+                        rule->handle(req, res, params);
+                        res.not_modified_since(req.get_header_value("if-none-match"));
                     }
-                    else {
-                        res_.set_header("Connection", "Close");
+                }
+                respond(conn_ptr, std::move(res), add_keep_alive);
+            }
+
+            void offload(typename Connection::Pointer& conn_ptr, DynamicRule* rule,
+                         Request&& req, Response&& res, routing_params&& params, bool keep_alive) {
+                auto seq = head_seq_ + pending_.size();
+                pending_.push_back({ false, keep_alive, Response() });
+                handler_.offload_pool().post([self = this->shared_from_this(), weak_conn = std::weak_ptr(conn_ptr), rule, seq,
+                                              req = std::move(req), res = std::move(res), params = std::move(params)]() mutable {
+                    try {
+                        rule->handle(req, res, params);
+                        res.not_modified_since(req.get_header_value("if-none-match"));
                     }
-                    log_trace;
-                    auto [sendfile, context] = std::move(complete_request());
-                    conn_ptr->send(context);
-                    if(sendfile) {
-                        log_info("start send file");
-                        conn_ptr->sendfile(res_.filename);
+                    catch(const std::exception& e) {
+                        log_error("offload handler error:", e.what());
+                        res = Response(500);
                     }
-                    if(!add_keep_alive) {
-                        log_info("no keep-alive, close connection");
-                        conn_ptr->close();
+                    self->handler_.release_offload();
+                    // 连接已经关闭时丢弃响应
+                    if(auto conn_ptr = weak_conn.lock(); conn_ptr) {
+                        // safe_call的任务需要可以复制，Response只能移动
+                        auto result = std::make_shared<Response>(std::move(res));
+                        auto loop = conn_ptr->loop();
+                        loop->safe_call([self = std::move(self), conn_ptr = std::move(conn_ptr), seq, result]() mutable {
+                            self->complete(conn_ptr, seq, std::move(*result));
+                        });
                     }
-                    parser_.clear();
+                });
+            }
+
+            // 在连接所属的loop线程中调用
+            void complete(typename Connection::Pointer& conn_ptr, std::size_t seq, Response&& res) {
+                if(closing_ || conn_ptr->is_closed()) {
+                    return;
+                }
+                auto& pending = pending_[seq - head_seq_];
+                pending.res = std::move(res);
+                pending.ready = true;
+                // 一次发出多个流水线响应时合并成尽量少的报文段
+                bool batch = pending_.size() > 1 && pending_[1].ready && pending_.front().ready;
+                if(batch) {
+                    conn_ptr->cork();
+                }
+                while(!closing_ && !pending_.empty() && pending_.front().ready) {
+                    auto front = std::move(pending_.front());
+                    pending_.pop_front();
+                    ++head_seq_;
+                    send_response(conn_ptr, std::move(front.res), front.keep_alive);
+                }
+                if(batch) {
+                    conn_ptr->uncork();
+                }
+                // 继续处理因为流水线已满而留在接收缓冲区中的请求
+                handle_read(conn_ptr);
+            }
+
+            void respond(typename Connection::Pointer& conn_ptr, Response&& res, bool keep_alive) {
+                if(pending_.empty()) {
+                    send_response(conn_ptr, std::move(res), keep_alive);
+                }
+                else {
+                    pending_.push_back({ true, keep_alive, std::move(res) });
+                }
+            }
+
+            void send_response(typename Connection::Pointer& conn_ptr, Response&& res, bool keep_alive) {
+                res_ = std::move(res);
+                if(keep_alive) {
+                    res_.set_header("Connection", "Keep-Alive");
+                }
+                else {
+                    res_.set_header("Connection", "Close");
+                }
+                log_trace;
+                // 响应头和响应体作为两个片段一次写出，响应体不再拷贝到响应头后面
+                auto header = complete_request();
+                if(res_.is_send_file()) {
+                    // 响应头和文件的第一块合并在同一个报文段中，sendfile发出第一块之后自动uncork
+                    conn_ptr->cork();
+                    conn_ptr->send(header);
+                    log_debug("start send file");
+                    conn_ptr->sendfile(std::move(res_.file));
+                }
+                else {
+                    conn_ptr->send({ net::Slice(std::move(header)), net::Slice(std::move(res_.body)) });
+                }
+                if(!keep_alive) {
+                    log_info("no keep-alive, close connection");
+                    closing_ = true;
+                    pending_.clear();
+                    conn_ptr->close();
                 }
             }
         private:
-            std::pair<bool, std::string> complete_request() {
+            // 只生成响应头，响应体由调用者作为单独的片段发送
+            std::string complete_request() {
                 static const std::unordered_map<int, std::string> status_codes = {
                     {200, "HTTP/1.1 200 OK\r\n"},
                     {201, "HTTP/1.1 201 Created\r\n"},
@@ -108,36 +227,31 @@ namespace cortono::http
                 static const std::string crlf = "\r\n";
                 static const std::string seperator = ": ";
 
-                std::stringstream buffer;
-                buffer << status_codes.find(res_.code)->second;
+                std::string buffer;
+                buffer.reserve(256);
+                buffer.append(status_codes.find(res_.code)->second);
                 if(res_.code >= 400 && res_.body.empty()) {
                     res_.body = status_codes.find(res_.code)->second.substr(9);
                 }
                 for(auto&& [key, value] : res_.headers) {
-                    buffer << std::move(key) << seperator << std::move(value) << crlf;
-                }
-                if(!res_.headers.count("connection-length")) {
-                    if(!res_.sendfile) {
-                        buffer << "Content-Length" << seperator << res_.body.size() << crlf;
-                    }
-                    else {
-                        buffer << "Content-Length" << seperator << res_.filesize << crlf;
-                    }
+                    buffer.append(key).append(seperator).append(value).append(crlf);
                 }
-                buffer << crlf;
-                log_debug(buffer.str());
-                if(res_.is_send_file()) {
-                    return { true, buffer.str() };
-                }
-                else {
-                    buffer << res_.body;
-                    return { false, buffer.str() };
+                // 304没有响应体，不带Content-Length
+                if(!res_.headers.count("connection-length") && res_.code != 304) {
+                    buffer.append("Content-Length").append(seperator);
+                    buffer.append(std::to_string(res_.sendfile ? res_.filesize : res_.body.size())).append(crlf);
                 }
+                buffer.append(crlf);
+                log_debug(buffer);
+                return buffer;
             }
         private:
             Handler& handler_;
             HttpParser parser_;
-            Request req_;
             Response res_;
+            // 按请求顺序等待发送的响应，head_seq_是pending_.front()的序号
+            std::deque<PendingResponse> pending_;
+            std::size_t head_seq_{ 0 };
+            bool closing_{ false };
     };
 }
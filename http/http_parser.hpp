@@ -93,14 +93,18 @@ namespace cortono::http
                 }
                 return feed_len;
             }
+            // 请求体的长度由content-length决定，没有时为0，后面的数据属于流水线中的下一个请求
             int try_parse_body(const char* buffer, int len) {
-                body_.append(buffer, len);
-                if(!header_kv_pairs_.count("content-length") ||
-                   (body_.length() == std::strtoul(header_kv_pairs_["content-length"].data(), nullptr, 10))) {
+                std::size_t content_length = header_kv_pairs_.count("content-length")
+                    ? std::strtoul(header_kv_pairs_["content-length"].data(), nullptr, 10)
+                    : 0;
+                auto n = std::min(content_length - std::min(content_length, body_.length()), static_cast<std::size_t>(len));
+                body_.append(buffer, n);
+                if(body_.length() == content_length) {
                     state_ = ParseState::PARSE_DONE;
                     parse_multipart_form_data();
                 }
-                return len;
+                return static_cast<int>(n);
             }
             std::string_view parse_multipart_form_data_boundary() const {
                 auto it = header_kv_pairs_.find("content-type");
@@ -2,13 +2,158 @@
 
 #include "http_parser.hpp"
 #include "http_response.hpp"
+#include "../net/connection_pool.hpp"
+#include "../net/tunnel.hpp"
 
 #include <iostream>
 
 namespace cortono::http
 {
+    /*
+     * 跟踪上游连接上的一个响应，判断代理转发完请求之后上游连接能否放回连接池
+     * 1.只有HTTP/1.1并且没有Connection: close的响应才可能复用
+     * 2.响应体长度由Content-Length或者chunked编码确定，204和304没有响应体
+     *   读到关闭为止的响应体、1xx响应、响应之后多余的数据都不复用
+     */
+    class ResponseTracker
+    {
+        public:
+            void feed(std::string_view data) {
+                while(!data.empty() && state_ != State::Invalid) {
+                    switch(state_) {
+                        case State::Header:
+                            data = feed_header(data);
+                            break;
+                        case State::Body:
+                        case State::ChunkData: {
+                            auto n = std::min(remaining_, data.size());
+                            remaining_ -= n;
+                            data.remove_prefix(n);
+                            if(remaining_ == 0) {
+                                state_ = state_ == State::Body ? State::Done : State::ChunkSize;
+                            }
+                            break;
+                        }
+                        case State::ChunkSize:
+                        case State::Trailer:
+                            data = feed_line(data);
+                            break;
+                        default:
+                            state_ = State::Invalid;
+                            break;
+                    }
+                }
+            }
+            void invalidate() {
+                state_ = State::Invalid;
+            }
+            bool reusable() const {
+                return state_ == State::Done;
+            }
+
+        private:
+            enum class State { Header, Body, ChunkSize, ChunkData, Trailer, Done, Invalid };
+            static constexpr std::size_t MAX_HEADER_SIZE = 64 * 1024;
+
+            std::string_view feed_header(std::string_view data) {
+                auto old_size = header_.size();
+                header_.append(data.data(), data.size());
+                auto pos = header_.find("\r\n\r\n", old_size >= 3 ? old_size - 3 : 0);
+                if(pos == std::string::npos) {
+                    if(header_.size() > MAX_HEADER_SIZE) {
+                        state_ = State::Invalid;
+                    }
+                    return {};
+                }
+                data.remove_prefix(pos + 4 - old_size);
+                parse_header(std::string_view(header_).substr(0, pos));
+                std::string().swap(header_);
+                return data;
+            }
+            void parse_header(std::string_view header) {
+                auto lines = utils::split(header, "\r\n");
+                if(lines[0].size() < 12 || lines[0].substr(0, 9) != "HTTP/1.1 ") {
+                    state_ = State::Invalid;
+                    return;
+                }
+                int status = std::atoi(std::string(lines[0].substr(9, 3)).data());
+                bool chunked = false, has_length = false;
+                for(std::size_t i = 1; i < lines.size(); ++i) {
+                    auto colon = lines[i].find(':');
+                    if(colon == std::string_view::npos) {
+                        continue;
+                    }
+                    auto name = util::to_lower(lines[i].substr(0, colon));
+                    auto value = util::to_lower(lines[i].substr(colon + 1));
+                    if(name == "content-length") {
+                        has_length = true;
+                        remaining_ = std::strtoull(value.data(), nullptr, 10);
+                    }
+                    else if(name == "transfer-encoding") {
+                        chunked = value.find("chunked") != std::string::npos;
+                    }
+                    else if(name == "connection" && value.find("close") != std::string::npos) {
+                        state_ = State::Invalid;
+                        return;
+                    }
+                }
+                if(status < 200) {
+                    state_ = State::Invalid;
+                }
+                else if(status == 204 || status == 304) {
+                    state_ = State::Done;
+                }
+                else if(chunked) {
+                    state_ = State::ChunkSize;
+                }
+                else if(has_length) {
+                    state_ = remaining_ == 0 ? State::Done : State::Body;
+                }
+                else {
+                    state_ = State::Invalid;
+                }
+            }
+            // chunk大小行和trailer都按行处理
+            std::string_view feed_line(std::string_view data) {
+                auto pos = data.find('\n');
+                line_.append(data.data(), std::min(pos, data.size()));
+                if(pos == std::string_view::npos) {
+                    if(line_.size() > MAX_HEADER_SIZE) {
+                        state_ = State::Invalid;
+                    }
+                    return {};
+                }
+                data.remove_prefix(pos + 1);
+                if(!line_.empty() && line_.back() == '\r') {
+                    line_.pop_back();
+                }
+                if(state_ == State::ChunkSize) {
+                    remaining_ = std::strtoull(line_.data(), nullptr, 16);
+                    if(remaining_ == 0) {
+                        state_ = State::Trailer;
+                    }
+                    else {
+                        // 每个chunk之后还有CRLF
+                        state_ = State::ChunkData;
+                        remaining_ += 2;
+                    }
+                }
+                else if(line_.empty()) {
+                    state_ = State::Done;
+                }
+                line_.clear();
+                return data;
+            }
+
+        private:
+            State state_{ State::Header };
+            std::size_t remaining_{ 0 };
+            std::string header_;
+            std::string line_;
+    };
+
     template <typename Handler, typename Client, typename Connection>
-    class WebProxyConnection
+    class WebProxyConnection : public std::enable_shared_from_this<WebProxyConnection<Handler, Client, Connection>>
     {
         public:
             WebProxyConnection(Handler& handler)
@@ -16,6 +161,10 @@ namespace cortono::http
             {  }
 
             void handle_read(typename Connection::Pointer& conn_ptr) {
+                // 正在解析目标地址，数据留在接收缓冲区中，连接建立后一起转发
+                if(connecting_) {
+                    return;
+                }
                 log_debug(conn_ptr->recv_buffer()->to_string());
                 int len = parser_.feed(conn_ptr->recv_buffer()->data() + parse_len_,
                                        conn_ptr->recv_buffer()->size() - parse_len_);
@@ -57,54 +206,28 @@ namespace cortono::http
                         return;
                     }
                     log_debug(ip, port);
-                    std::weak_ptr client_weak_conn{ conn_ptr };
-                    auto read_cb = [client_weak_conn](auto proxy_conn_ptr) {
-                        if(auto strong_conn = client_weak_conn.lock(); strong_conn) {
-                            strong_conn->send(proxy_conn_ptr->recv_all());
-                        }
-                        else {
-                            proxy_conn_ptr->close();
-                        }
-                    };
-                    auto close_cb = [keep_alive, client_weak_conn](auto) {
-                        if(auto strong_conn = client_weak_conn.lock(); strong_conn) {
-                            if(!keep_alive) {
-                                log_info("close client connection");
-                                strong_conn->close();
+                    keep_alive_ = keep_alive;
+                    // 异步解析目标地址，解析和连接期间conn_ptr可能已经关闭
+                    connecting_ = true;
+                    std::weak_ptr weak_conn{ conn_ptr };
+                    auto done = [self = this->shared_from_this(), weak_conn](typename Client::ClientConnType::Pointer proxy_conn) {
+                        self->connecting_ = false;
+                        auto conn_ptr = weak_conn.lock();
+                        if(!conn_ptr) {
+                            if(proxy_conn) {
+                                self->release(proxy_conn, false);
                             }
+                            return;
                         }
+                        self->handle_connect(conn_ptr, std::move(proxy_conn));
                     };
-                    auto proxy_conn = Client::connect(conn_ptr->loop(), ip, port, read_cb, nullptr, close_cb);
-                    if(proxy_conn) {
-                        conn_ptr->on_close([proxy_conn](auto) {
-                            proxy_conn->close();
-                        });
-                        // 如果首次是CONNECT请求，需要在连接到目标服务器之后返回”连接成功“信息
-                        if(req_.method == HttpMethod::CONNECT) {
-                            conn_ptr->clear_recv_buffer();
-                            conn_ptr->send("HTTP/1.1 200 Connection Established\r\n\r\n");
-                        }
-                        // 如果首次是GET请求，直接转发
-                        else if(req_.method == HttpMethod::GET) {
-                            proxy_conn->send(conn_ptr->recv_all());
-                        }
-                        // TODO: 支持其它请求类型
-                        else {
-                            conn_ptr->send("HTTP/1.1 500 Internal Server Error");
-                            conn_ptr->close();
-                        }
-                        // 处理完首次请求后重置可读回调，直接转发来往数据
-                        // **********注意*************
-                        // 当前WebProxyConnection对象唯一的一个智能指针保存在conn_ptr的on_read里面
-                        // 一旦conn_ptr的可读回调被更改，WebProxyConnection对象也就会被析构
-                        // 所以末尾的两行注释如果在conn_ptr->on_read(...)之后执行就会出错
-                        conn_ptr->on_read([proxy_conn = std::move(proxy_conn)](auto conn_ptr) {
-                            proxy_conn->send(conn_ptr->recv_all());
-                        });
+                    // CONNECT之后是不透明的隧道，上游连接不能复用，其它请求从连接池中取
+                    if(req_.method == HttpMethod::CONNECT) {
+                        Client::async_connect(conn_ptr->loop(), ip, port, std::move(done));
                     }
                     else {
-                        conn_ptr->send("HTTP/1.1 500 Internal Server Error");
-                        conn_ptr->close();
+                        pooled_ = true;
+                        net::ConnectionPool<Client>::of(conn_ptr->loop()).acquire(ip, port, std::move(done));
                     }
                     /* *********Boom********* */
                     /* parse_len_ = 0; */
@@ -112,10 +235,113 @@ namespace cortono::http
                 }
             }
         private:
+            using ProxyPointer = typename Client::ClientConnType::Pointer;
+
+            // 放回连接池或者关闭上游连接，可能被调用多次
+            void release(const ProxyPointer& proxy_conn, bool reusable) {
+                if(pooled_) {
+                    net::ConnectionPool<Client>::of(proxy_conn->loop()).release(proxy_conn, reusable);
+                }
+                else {
+                    proxy_conn->close();
+                }
+            }
+
+            void handle_connect(typename Connection::Pointer& conn_ptr, ProxyPointer proxy_conn) {
+                if(!proxy_conn) {
+                    conn_ptr->send("HTTP/1.1 500 Internal Server Error");
+                    conn_ptr->close();
+                    return;
+                }
+                if(req_.method == HttpMethod::CONNECT) {
+                    handle_tunnel(conn_ptr, std::move(proxy_conn));
+                    return;
+                }
+                // 上游连接只转发了一个完整的请求，并且收到了完整的响应时才放回连接池
+                auto tracker = std::make_shared<ResponseTracker>();
+                if(!pooled_ || static_cast<std::size_t>(conn_ptr->recv_buffer()->size()) != parse_len_ || req_.method != HttpMethod::GET) {
+                    tracker->invalidate();
+                }
+                std::weak_ptr client_weak_conn{ conn_ptr };
+                proxy_conn->on_read([client_weak_conn, tracker](auto proxy_conn_ptr) {
+                    auto data = proxy_conn_ptr->recv_all();
+                    tracker->feed(data);
+                    if(auto strong_conn = client_weak_conn.lock(); strong_conn) {
+                        strong_conn->send(data);
+                    }
+                    else {
+                        proxy_conn_ptr->close();
+                    }
+                });
+                auto close_cb = [self = this->shared_from_this(), client_weak_conn](auto proxy_conn_ptr) {
+                    auto strong_conn = client_weak_conn.lock();
+                    self->release(proxy_conn_ptr, false);
+                    if(strong_conn && !self->keep_alive_) {
+                        log_info("close client connection");
+                        strong_conn->close();
+                    }
+                };
+                proxy_conn->on_close(close_cb);
+                proxy_conn->on_error(close_cb);
+                conn_ptr->on_close([self = this->shared_from_this(), proxy_conn, tracker](auto) {
+                    self->release(proxy_conn, tracker->reusable());
+                });
+                // 一端的发送队列超过高水位时暂停读取另一端，两端带宽不对称时内存不会持续增长
+                conn_ptr->set_water_marks(HIGH_WATER_MARK, LOW_WATER_MARK);
+                proxy_conn->set_water_marks(HIGH_WATER_MARK, LOW_WATER_MARK);
+                conn_ptr->pause_reading_of(proxy_conn);
+                proxy_conn->pause_reading_of(conn_ptr);
+                // 如果首次是GET请求，直接转发
+                if(req_.method == HttpMethod::GET) {
+                    proxy_conn->send(conn_ptr->recv_all());
+                }
+                // TODO: 支持其它请求类型
+                else {
+                    conn_ptr->send("HTTP/1.1 500 Internal Server Error");
+                    conn_ptr->close();
+                }
+                // 处理完首次请求后重置可读回调，直接转发来往数据
+                // 之后的请求和响应不再跟踪，上游连接不能复用
+                // **********注意*************
+                // conn_ptr的on_read被替换后，WebProxyConnection对象只由上面的回调持有
+                conn_ptr->on_read([proxy_conn = std::move(proxy_conn), tracker](auto conn_ptr) {
+                    tracker->invalidate();
+                    proxy_conn->send(conn_ptr->recv_all());
+                });
+            }
+            // CONNECT之后是不透明的隧道，两个TCP连接之间用splice转发，数据不经过用户空间
+            // 返回“连接成功”信息之后，请求头后面已经收到的数据(如TLS ClientHello)一起转发
+            void handle_tunnel(typename Connection::Pointer& conn_ptr, ProxyPointer proxy_conn) {
+                conn_ptr->recv_buffer()->retrieve_read_bytes(parse_len_);
+                conn_ptr->send("HTTP/1.1 200 Connection Established\r\n\r\n");
+                if(net::join_tunnel(conn_ptr, proxy_conn)) {
+                    return;
+                }
+                // 退回到复制转发时由这里处理关闭，任意一端关闭时关闭另一端
+                std::weak_ptr client_weak_conn{ conn_ptr };
+                auto close_cb = [client_weak_conn](auto) {
+                    if(auto strong_conn = client_weak_conn.lock(); strong_conn) {
+                        strong_conn->close();
+                    }
+                };
+                proxy_conn->on_close(close_cb);
+                proxy_conn->on_error(close_cb);
+                conn_ptr->on_close([proxy_conn](auto) {
+                    proxy_conn->close();
+                });
+            }
+
+        private:
+            static constexpr std::size_t HIGH_WATER_MARK = 1024 * 1024;
+            static constexpr std::size_t LOW_WATER_MARK = 256 * 1024;
+
             Handler& handler_;
             HttpParser parser_;
             Request req_;
             Response res_;
             std::size_t parse_len_{ 0 };
+            bool connecting_{ false };
+            bool keep_alive_{ true };
+            bool pooled_{ false };
     };
 }
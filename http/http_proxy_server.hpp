@@ -30,6 +30,13 @@ namespace cortono::http
                 /* }); */
                 loop_.loop();
             }
+            Service& service() {
+                return service_;
+            }
+            // 上游连接池的命中率、排队时间和建连时间，可以在任意线程读取
+            static auto upstream_stats() {
+                return net::ConnectionPool<Client>::stats();
+            }
         private:
             void init_callback() {
                 service_.on_conn([&](auto conn_ptr) {
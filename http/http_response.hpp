@@ -2,6 +2,7 @@
 
 #include "../std.hpp"
 #include "../cortono.hpp"
+#include "../util/file_cache.hpp"
 #include "http_codec.hpp"
 #include "http_session_manager.hpp"
 
@@ -13,6 +14,8 @@ namespace cortono::http
         bool sendfile{ false };
         std::size_t filesize{ 0 };
         std::string filename;
+        // 从file_cache中打开的文件，发送期间由连接持有
+        util::file_cache::handle file;
         std::string body;
         std::unordered_map<std::string, std::string> headers;
 
@@ -23,8 +26,14 @@ namespace cortono::http
 
         Response(Response&& res)
             : code(res.code),
+              sendfile(res.sendfile),
+              filesize(res.filesize),
+              filename(std::move(res.filename)),
+              file(std::move(res.file)),
               body(std::move(res.body)),
-              headers(std::move(res.headers))
+              headers(std::move(res.headers)),
+              domain_(std::move(res.domain_)),
+              session_(std::move(res.session_))
         {  }
 
         Response& operator=(Response&& res) {
@@ -33,8 +42,11 @@ namespace cortono::http
                 sendfile = std::move(res.sendfile);
                 filesize = std::move(res.filesize);
                 filename = std::move(res.filename);
+                file = std::move(res.file);
                 body = std::move(res.body);
                 headers = std::move(res.headers);
+                domain_ = std::move(res.domain_);
+                session_ = std::move(res.session_);
             }
             return *this;
         }
@@ -45,26 +57,43 @@ namespace cortono::http
         void set_domain(std::string&& domain) {
             domain_ = std::move(domain);
         }
-        void send_file(const std::string& file) {
-            using namespace std::experimental;
-            auto filename_decoded = html_codec::decode(file);
-            log_debug(filename_decoded);
-            if(filesystem::exists(filename_decoded)) {
+        // 通过file_cache打开文件，热点文件不再重复open/stat，同时设置ETag
+        void send_file(const std::string& path) {
+            filename = html_codec::decode(path);
+            log_debug(filename);
+            auto& cache = util::file_cache::instance();
+            file = cache.open(filename);
+            if(file && file->directory) {
+                filename.append("index.html");
+                file = cache.open(filename);
+            }
+            if(file && !file->directory) {
                 log_info("file exists");
-                filename = filename_decoded;
                 code = 200;
                 sendfile = true;
-                filesize = 0;
-                if(filesystem::is_directory(filename)) {
-                    filename.append("index.html");
-                }
-                filesize = filesystem::file_size(filename);
+                filesize = file->size;
+                headers["ETag"] = file->etag;
             }
             else {
                 log_info("file is not exist");
+                file.reset();
                 code = 404;
             }
         }
+        // 请求的If-None-Match与文件的ETag相同时改为304，不再发送文件
+        void not_modified_since(std::string_view etags) {
+            if(!sendfile || !file || etags.empty()) {
+                return;
+            }
+            if(etags != "*" && etags.find(file->etag) == std::string_view::npos) {
+                return;
+            }
+            code = 304;
+            sendfile = false;
+            filesize = 0;
+            file.reset();
+            body.clear();
+        }
         void read_file_to_body(const std::string& file) {
             using namespace std::experimental;
             filesize = filesystem::file_size(file);
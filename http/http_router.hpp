@@ -192,6 +192,14 @@ namespace cortono::http
                 methods_.emplace_back(method);
                 return *this;
             }
+            // 处理函数会阻塞(模板渲染、读写磁盘)，放到线程池中执行，不占用IO线程
+            self_t& offload() {
+                offload_ = true;
+                return *this;
+            }
+            bool is_offload() const {
+                return offload_;
+            }
 
             template <typename Func>
             void operator()(Func f) {
@@ -226,6 +234,7 @@ namespace cortono::http
             std::string rule_;
             std::vector<HttpMethod> methods_;
             std::function<void(const Request&, Response&, const routing_params&)> handler_;
+            bool offload_{ false };
     };
 
 
@@ -398,14 +407,22 @@ namespace cortono::http
                 }
             }
             void handle(const Request& req, Response& res) {
-                /* auto [rule_index, params] = method_rules_[(int)req.method].trie.find(req.url); */
-                /* method_rules_[(int)req.method].rules[rule_index]->handle(req, res, params); */
+                auto [rule, params] = route(req);
+                if(rule != nullptr) {
+                    rule->handle(req, res, params);
+                }
+            }
+            // 查找请求对应的规则，没有找到时返回nullptr
+            std::pair<DynamicRule*, routing_params> route(const Request& req) {
                 auto rules_params = method_rules_[(int)req.method].trie.find(req.url);
                 if(rules_params.first == -1) {
                     log_info("can't found handler for url:", req.url);
-                    return;
+                    return { nullptr, std::move(rules_params.second) };
                 }
-                method_rules_[(int)req.method].rules[rules_params.first]->handle(req, res, rules_params.second);
+                return { method_rules_[(int)req.method].rules[rules_params.first], std::move(rules_params.second) };
+            }
+            bool has_offload() const {
+                return std::any_of(all_rules_.begin(), all_rules_.end(), [](auto& rule) { return rule->is_offload(); });
             }
         private:
             void internal_add_rule_object(const std::string& rule, DynamicRule* rule_obj) {
@@ -29,6 +29,9 @@ namespace cortono::http
                 service_.start(concurrency_);
                 loop_.loop();
             }
+            Service& service() {
+                return service_;
+            }
         private:
             void init_callback() {
                 service_.on_conn([&](auto conn_ptr) {
@@ -65,18 +65,27 @@ namespace cortono::ip
                 return util::format("<%s:%u>", ip.data(), port);
             }
 
+            // 阻塞解析，只用于启动阶段，loop线程中使用net::Resolver
             static std::string parse_ip_address(const std::string& host) {
-                struct hostent *hptr = ::gethostbyname(host.c_str());
-                if(hptr == nullptr) {
-                    log_error("gethostbyname error...", host);
+                struct in_addr addr;
+                if(::inet_pton(AF_INET, host.data(), &addr) == 1) {
                     return host;
                 }
-                char buffer[1024] = "\0";
-                ::inet_ntop(hptr->h_addrtype, hptr->h_addr_list[0], buffer, sizeof(buffer));
+                struct addrinfo hints, *result = nullptr;
+                std::memset(&hints, 0, sizeof(hints));
+                hints.ai_family = AF_INET;
+                hints.ai_socktype = SOCK_STREAM;
+                if(int err = ::getaddrinfo(host.data(), nullptr, &hints, &result); err != 0) {
+                    log_error("getaddrinfo error...", host, ::gai_strerror(err));
+                    return host;
+                }
+                char buffer[INET_ADDRSTRLEN] = "\0";
+                ::inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in*>(result->ai_addr)->sin_addr, buffer, sizeof(buffer));
+                ::freeaddrinfo(result);
                 return std::string(buffer);
             }
 
-            static std::pair<std::string, unsigned short> parse_ip_port(struct sockaddr_in& sockaddr) {
+            static std::pair<std::string, unsigned short> parse_ip_port(const struct sockaddr_in& sockaddr) {
                 char ip[1024] = "\0";
                 ::inet_ntop(AF_INET, &sockaddr.sin_addr, ip, sizeof(ip));
                 unsigned short port = ntohs(sockaddr.sin_port);
@@ -143,6 +152,11 @@ namespace cortono::ip
                 static int accept(int sockfd) {
                     return ::accept(sockfd, nullptr, nullptr);
                 }
+                // 返回的fd已经设置了O_NONBLOCK和FD_CLOEXEC，peer不为空时同时取得对端地址
+                static int accept_nonblock(int sockfd, struct sockaddr_in* peer = nullptr) {
+                    socklen_t len = sizeof(struct sockaddr_in);
+                    return ::accept4(sockfd, reinterpret_cast<struct sockaddr*>(peer), peer ? &len : nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                }
                 static bool connect(int fd, std::string_view ip, unsigned short port) {
                     struct sockaddr addr = ip::address::to_sockaddr(ip, port);
                     return (::connect(fd, &addr, sizeof(addr)) == 0) ? true : false;
@@ -186,6 +200,61 @@ namespace cortono::ip
                         ? true
                         : false;
                 }
+                // 给SO_REUSEPORT组挂载一个经典BPF程序，按照处理软中断的CPU编号选择监听套接字
+                // 内核以(返回值 % 组内套接字数)作为下标，下标是套接字加入组的顺序
+                static bool attach_reuseport_cbpf(int fd) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+                    struct sock_filter code[] = {
+                        { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<std::uint32_t>(SKF_AD_OFF + SKF_AD_CPU) },
+                        { BPF_RET | BPF_A, 0, 0, 0 }
+                    };
+                    struct sock_fprog prog;
+                    prog.len = sizeof(code) / sizeof(code[0]);
+                    prog.filter = code;
+                    return (::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0)
+                        ? true
+                        : false;
+#else
+                    (void)fd;
+                    return false;
+#endif
+                }
+                // 阻塞读时在设备队列上忙轮询usec微秒，超过net.core.busy_read需要CAP_NET_ADMIN
+                static bool busy_poll(int fd, int usec) {
+#ifdef SO_BUSY_POLL
+                    return (::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == 0)
+                        ? true
+                        : false;
+#else
+                    (void)fd;
+                    (void)usec;
+                    return false;
+#endif
+                }
+                // reuseport组中优先把在cpu上处理软中断的连接分给这个套接字，和套接字加入组的顺序无关
+                static bool incoming_cpu(int fd, int cpu) {
+#ifdef SO_INCOMING_CPU
+                    return (::setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == 0)
+                        ? true
+                        : false;
+#else
+                    (void)fd;
+                    (void)cpu;
+                    return false;
+#endif
+                }
+                static bool shutdown(int fd, int how = SHUT_RDWR) {
+                    return ::shutdown(fd, how) == 0
+                        ? true
+                        : false;
+                }
+                // 打开时不满一个MSS的数据留在内核中等待合并，关闭时立即发出
+                static bool cork(int fd, bool on) {
+                    int val = on ? 1 : 0;
+                    return (::setsockopt(fd, SOL_TCP, TCP_CORK, &val, sizeof(val)) == 0)
+                        ? true
+                        : false;
+                }
                 static bool no_delay(int fd) {
                     int val = 1;
                     return (::setsockopt(fd, SOL_TCP, TCP_NODELAY, &val, sizeof(val)) == 0)
@@ -201,33 +270,38 @@ namespace cortono::ip
                 static int recv(int fd, char* buffer, int bytes) {
                     return ::recv(fd, buffer, bytes, MSG_NOSIGNAL);
                 }
+                static int recvv(int fd, const struct iovec* iov, int iovcnt) {
+                    return ::readv(fd, iov, iovcnt);
+                }
                 static int send(int fd, const char* str, int len) {
                     return ::send(fd, str, len, MSG_NOSIGNAL);
                 }
                 static int send(int fd, const std::string& msg) {
                     return send(fd, msg.c_str(), msg.size());
                 }
-                static int sendfile(int fd, const std::string& filename, off_t offet, std::size_t count) {
-                    int in_fd = util::io::open(filename);
-                    if(in_fd == -1) {
-                        log_error(strerror(errno));
-                        return 0;
+                // 聚集写，使用sendmsg而不是writev，以便传入MSG_NOSIGNAL
+                static int sendv(int fd, const struct iovec* iov, int iovcnt) {
+                    struct msghdr msg;
+                    std::memset(&msg, 0, sizeof(msg));
+                    msg.msg_iov = const_cast<struct iovec*>(iov);
+                    msg.msg_iovlen = iovcnt;
+                    return ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+                }
+                // 发送in_fd中[offset, offset + count)的数据，in_fd由调用者打开和关闭
+                static ssize_t sendfile(int fd, int in_fd, off_t offset, std::size_t count) {
+                    auto n = ::sendfile(fd, in_fd, &offset, count);
+                    if(n == -1 && errno != EAGAIN && errno != EINTR) {
+                        log_error(std::strerror(errno));
                     }
-                    int n = ::sendfile(fd, in_fd, &offet, count);
-                    if(n == -1) {
+                    return n;
+                }
+                // 套接字和管道之间移动最多count字节，其中一端必须是管道
+                static ssize_t splice(int fd_in, int fd_out, std::size_t count) {
+                    auto n = ::splice(fd_in, nullptr, fd_out, nullptr, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                    if(n == -1 && errno != EAGAIN && errno != EINTR) {
                         log_error(std::strerror(errno));
                     }
-                    util::io::close(in_fd);
                     return n;
-                    // sendfile的返回值可能小于指定的发送值，但是如果直接再次调用有可能因为缓冲区已满导致sendfile失败返回-1
-                    // 所以改为connection控制，等到可写的时候再次调用sendfile
-                    // if((std::size_t)n < count) {
-                        // log_info("send file return", n, "bytes is less than filesize:", count, "call senfile again");
-                        // return n + sendfile(fd, filename, offet + n, count - n);
-                    // }
-                    // else {
-                        // return n;
-                    // }
                 }
         };
 
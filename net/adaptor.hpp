@@ -3,6 +3,7 @@
 #include "socket.hpp"
 #include "eventloop.hpp"
 #include "connection.hpp"
+#include "placement.hpp"
 #include "../util/util.hpp"
 
 namespace cortono::net
@@ -10,7 +11,8 @@ namespace cortono::net
     class TcpAdaptor
     {
         public:
-            using LoopProducer = std::function<EventLoop*()>;
+            // 同一次可读事件中接收的连接共用一个Batch，负载感知的分配策略据此分散这一批连接
+            using LoopProducer = std::function<EventLoop*(LoopSelector::Batch&)>;
             using ConnCallBack = std::function<void(TcpConnection::Pointer&&)>;
 
             TcpAdaptor(EventLoop* loop, std::string_view ip, unsigned short port)
@@ -29,49 +31,93 @@ namespace cortono::net
             void start() {
                 socket_.enable_reading();
                 socket_.listen();
+                listening_ = true;
+            }
+            // 停止监听，已经完成握手还没有被accept的连接先接收下来，不会被重置
+            // 监听套接字在析构时才关闭，shutdown之后内核不再向它分配新连接
+            void stop() {
+                if(!listening_) {
+                    return;
+                }
+                listening_ = false;
+                handle_accept();
+                socket_.disable_all();
+                ip::tcp::sockets::shutdown(socket_.fd());
             }
             void on_connection(LoopProducer&& producer, ConnCallBack&& cb) {
                 loop_producer_ = std::move(producer);
                 conn_cb_ = std::move(cb);
             }
+            // 多个监听套接字绑定同一端口时，按照CPU编号分发新连接
+            bool attach_cpu_steering() {
+                if(!ip::tcp::sockets::attach_reuseport_cbpf(socket_.fd())) {
+                    log_error("fail to attach reuseport cbpf:", std::strerror(errno));
+                    return false;
+                }
+                return true;
+            }
+            // reuseport组中优先接收在cpu上处理软中断的连接
+            bool set_incoming_cpu(int cpu) {
+                if(!ip::tcp::sockets::incoming_cpu(socket_.fd(), cpu)) {
+                    log_error("fail to set incoming cpu:", std::strerror(errno));
+                    return false;
+                }
+                return true;
+            }
         protected:
-            int accept_client() {
-                int fd = socket_.accept();
+            // accept4一次完成接收、设置非阻塞和获取对端地址
+            int accept_client(struct sockaddr_in* peer = nullptr) {
+                int fd = socket_.accept_nonblock(peer);
                 if(fd == -1) {
                     if(errno == EMFILE) {
                         util::io::close(idle_fd_);
-                        fd = socket_.accept();
+                        fd = socket_.accept_nonblock();
                         ip::tcp::sockets::close(fd);
                         idle_fd_ = util::io::open("dev/null");
                     }
                 }
                 return fd;
             }
-        private:
-            void handle_accept() {
+        protected:
+            // 一次可读事件中接收的连接按目标loop分组，每个loop只投递一个任务，减少跨线程唤醒
+            virtual void handle_accept() {
                 while(true) {
-                    int fd = accept_client();
-                    if(fd == -1) {
+                    AcceptedSocket accepted;
+                    accepted.fd = accept_client(&accepted.peer);
+                    if(accepted.fd == -1) {
                         break;
                     }
                     if(loop_producer_ && conn_cb_) {
-                        auto loop = loop_producer_();
-                        loop->safe_call([this, fd, loop]() {
-                            auto new_conn_ptr = std::make_shared<TcpConnection>(loop, fd);
-                            conn_cb_(std::move(new_conn_ptr));
-                        });
+                        auto loop = loop_producer_(batch_);
+                        auto it = std::find_if(batches_.begin(), batches_.end(), [loop](auto& b) { return b.first == loop; });
+                        if(it == batches_.end()) {
+                            it = batches_.emplace(batches_.end(), loop, std::vector<AcceptedSocket>{});
+                        }
+                        it->second.push_back(accepted);
                     }
                     else {
-                        ip::tcp::sockets::close(fd);
+                        ip::tcp::sockets::close(accepted.fd);
                     }
                 }
+                for(auto& [loop, sockets] : batches_) {
+                    loop->safe_call([this, loop = loop, sockets = std::move(sockets)]() {
+                        for(auto& accepted : sockets) {
+                            conn_cb_(util::make_pooled<TcpConnection>(loop, accepted));
+                        }
+                    });
+                }
+                batches_.clear();
+                batch_.clear();
             }
         protected:
             int idle_fd_;
             EventLoop* loop_;
             TcpSocket socket_;
             LoopProducer loop_producer_;
+            bool listening_{ false };
+            LoopSelector::Batch batch_;
         private:
             ConnCallBack conn_cb_;
+            std::vector<std::pair<EventLoop*, std::vector<AcceptedSocket>>> batches_;
     };
 }
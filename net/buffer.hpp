@@ -3,6 +3,7 @@
 
 #include "../std.hpp"
 #include "../util/util.hpp"
+#include "../util/object_pool.hpp"
 
 namespace cortono::net
 {
@@ -57,22 +58,25 @@ namespace cortono::net
                 write_idx_ += bytes;
             }
 
-            void append(std::string info) {
-                int s = info.length();
-                enable_bytes(s);
-                std::move_backward(info.begin(), info.end(), end() + s);
-                retrieve_write_bytes(s);
+            void append(const std::string& info) {
+                append(info.data(), info.length());
             }
 
             void append(int n) {
                 append(std::to_string(n));
             }
 
-            void append(char *str) {
-                append(std::string(str));
+            void append(const char *str) {
+                append(str, std::strlen(str));
             }
+            // 直接拷贝到缓冲区末尾，不再构造临时的std::string
             void append(const char* s, int len) {
-                append(std::string(s, len));
+                if(len <= 0) {
+                    return;
+                }
+                enable_bytes(len);
+                std::memcpy(end(), s, len);
+                retrieve_write_bytes(len);
             }
             void enable_bytes(int bytes) {
                 if(writeable() < bytes) {
@@ -141,7 +145,8 @@ namespace cortono::net
             }
         private:
             std::size_t read_idx_, write_idx_;
-            std::vector<char> buffer_;
+            // 默认大小的存储从loop的内存池中分配，扩容到MAX_BLOCK以上的部分不进入内存池
+            std::vector<char, util::pool_allocator<char>> buffer_;
     };
 
     class Buffer : public BaseBuffer<2048>
@@ -5,9 +5,19 @@
 #include "../util/noncopyable.hpp"
 #include "eventloop.hpp"
 #include "connection.hpp"
+#include "resolver.hpp"
 
 namespace cortono::net
 {
+    // connect中的阻塞解析，在所属loop线程中解析域名会阻塞整个loop，这种情况应当使用async_connect
+    inline std::string resolve_blocking(EventLoop* loop, const std::string& host) {
+        struct in_addr addr;
+        if(::inet_pton(AF_INET, host.data(), &addr) != 1 && loop->is_in_loop_thread()) {
+            log_error("blocking resolve on loop thread, use async_connect instead:", host);
+        }
+        return ip::address::parse_ip_address(host);
+    }
+
     class TcpClient : private util::noncopyable
     {
         public:
@@ -21,7 +31,7 @@ namespace cortono::net
                                                            std::function<void(TcpConnection::Pointer)> close_cb = nullptr,
                                                            std::function<void(TcpConnection::Pointer)> conn_cb = nullptr,
                                                            std::function<void(TcpConnection::Pointer)> error_cb = nullptr) {
-                std::string ip_address = ip::address::parse_ip_address(ip);
+                std::string ip_address = resolve_blocking(loop, ip);
                 log_info(cortono::util::format("start to connect to server(%s:%u)", ip_address.data(), port));
                 int fd = ip::tcp::sockets::nonblock_socket();
                 bool connected = false;
@@ -38,7 +48,7 @@ namespace cortono::net
                     connected = true;
                     // log_info("connect to server socket done");
                 }
-                auto conn_ptr = std::make_shared<TcpConnection>(loop, fd);
+                auto conn_ptr = util::make_pooled<TcpConnection>(loop, fd);
                 auto [peer_ip, peer_port] = conn_ptr->peer_endpoint();
                 if(peer_ip != "0.0.0.0" && peer_port != 0) {
                     connected = true;
@@ -63,6 +73,29 @@ namespace cortono::net
                 }
                 return conn_ptr;
             }
+
+            /*
+             * 先通过Resolver异步解析host再连接，连接建立(或失败)后调用done，失败时参数为nullptr
+             * 只能在loop线程中调用，解析命中缓存时done可能在async_connect返回之前被调用
+             */
+            static void async_connect(EventLoop* loop,
+                                      const std::string& host,
+                                      unsigned short port,
+                                      std::function<void(TcpConnection::Pointer)> done,
+                                      std::function<void(TcpConnection::Pointer)> read_cb = nullptr,
+                                      std::function<void(TcpConnection::Pointer)> write_cb = nullptr,
+                                      std::function<void(TcpConnection::Pointer)> close_cb = nullptr,
+                                      std::function<void(TcpConnection::Pointer)> conn_cb = nullptr,
+                                      std::function<void(TcpConnection::Pointer)> error_cb = nullptr) {
+                Resolver::of(loop).resolve(host, [=](const Resolver::Addresses& addresses) {
+                    if(addresses.empty()) {
+                        log_error("fail to resolve", host);
+                        done(nullptr);
+                        return;
+                    }
+                    done(connect(loop, addresses.front(), port, read_cb, write_cb, close_cb, conn_cb, error_cb));
+                });
+            }
     };
 
 #ifdef CORTONO_USE_SSL
@@ -83,7 +116,7 @@ namespace cortono::net
                     inited = true;
                 }
                 ip::tcp::ssl::load_certificate(CA_CERT_FILE, CLIENT_CERT_FILE, CLIENT_KEY_FILE, true, false);
-                std::string ip_address = ip::address::parse_ip_address(ip);
+                std::string ip_address = resolve_blocking(loop, ip);
                 log_info("start to connect to server:", ip_address, port);
                 int fd = ip::tcp::sockets::nonblock_socket();
                 bool connected = false;
@@ -126,6 +159,23 @@ namespace cortono::net
                 conn_ptr->on_close(std::move(close_cb));
                 return conn_ptr;
             }
+
+            static void async_connect(EventLoop* loop,
+                                      const std::string& host,
+                                      unsigned short port,
+                                      std::function<void(SslConnection::Pointer)> done,
+                                      std::function<void(SslConnection::Pointer)> read_cb = nullptr,
+                                      std::function<void(SslConnection::Pointer)> write_cb = nullptr,
+                                      std::function<void(SslConnection::Pointer)> close_cb = nullptr) {
+                Resolver::of(loop).resolve(host, [=](const Resolver::Addresses& addresses) {
+                    if(addresses.empty()) {
+                        log_error("fail to resolve", host);
+                        done(nullptr);
+                        return;
+                    }
+                    done(connect(loop, addresses.front(), port, read_cb, write_cb, close_cb));
+                });
+            }
     };
 #endif
 }
@@ -2,19 +2,37 @@
 
 #include "../std.hpp"
 #include "../util/noncopyable.hpp"
+#include "../util/file_cache.hpp"
+#include "slice.hpp"
 #include "socket.hpp"
 #include "ssl_socket.hpp"
 #include "eventloop.hpp"
 
 namespace cortono::net
 {
+    /*
+     * 接管连接读写的处理者(如Tunnel)，见Connection::set_io_hook
+     * 1.可读时调用on_readable，可写并且连接自己的发送队列已经发送完时调用on_writeable
+     * 2.连接关闭(包括出错和空闲超时)时调用on_closed，之后不再调用
+     */
+    class IoHook
+    {
+        public:
+            virtual ~IoHook() = default;
+            virtual void on_readable() = 0;
+            virtual void on_writeable() = 0;
+            virtual void on_closed() = 0;
+    };
+
     /*
      * 考虑到TCP和SSL仅在io api上有少量差异，所以可以采用同个Connection代表连接
      * 模板参数传入TcpSocket或SslSocket，其中SslSocket继承自TcpSocket
      * 二者具有相同接口，保证了Connection实现的统一性
      */
         template <typename Socket>
-        class Connection : public std::enable_shared_from_this<Connection<Socket>>
+        class Connection : public std::enable_shared_from_this<Connection<Socket>>,
+                           public EventPoller::Handler,
+                           public IdleList::Node
         {
             public:
                 /*
@@ -53,23 +71,50 @@ namespace cortono::net
                 template <typename... Args>
                 Connection(EventLoop* loop, Args... args)
                     : loop_(loop),
+                      id_(next_id()),
                       socket_(args...),
-                      recv_buffer_(std::make_shared<Buffer>()),
-                      send_buffer_(std::make_shared<Buffer>())
+                      recv_buffer_(util::make_pooled<Buffer>()),
+                      send_buffer_(util::make_pooled<Buffer>())
                 {
-                    name_ = std::move(socket_.local_address() + ":" + socket_.peer_address());
-                    socket_.tie(loop_->poller());
                     socket_.set_option(socket_t::non_block);
-                    socket_.set_read_callback(std::bind(&Connection::handle_read, this));
+                    init();
+                }
+                // TcpAdaptor接收的连接，不需要再设置非阻塞，对端地址直接使用accept时取得的
+                Connection(EventLoop* loop, const AcceptedSocket& accepted)
+                    : loop_(loop),
+                      id_(next_id()),
+                      socket_(accepted.fd),
+                      recv_buffer_(util::make_pooled<Buffer>()),
+                      send_buffer_(util::make_pooled<Buffer>()),
+                      peer_endpoint_(ip::address::parse_ip_port(accepted.peer))
+                {
+                    init();
+                }
+                // 空闲表只能在loop线程中修改，而最后一个引用可能在任意线程(或loop析构之后)释放
+                // 所以只在handle_close/handle_error中移除，析构时必须已经关闭
+                ~Connection() {
+                    assert(!this->idle_linked());
+                }
+            private:
+                void init() {
+                    socket_.tie(loop_->poller());
+                    if(auto usec = loop_->sock_busy_poll(); usec > 0) {
+                        socket_.set_busy_poll(usec);
+                    }
+                    // 就绪事件直接分发到handle_events，不经过PollerCB中的std::function
+                    socket_.set_handler(this);
                     socket_.set_close_callback(std::bind(&Connection::handle_close, this));
-                    socket_.set_write_callback(std::bind(&Connection::handle_write, this));
                     socket_.enable_reading();
                     // 由于采用边缘触发，即使打开可读监听也不会无限调用可写回调
                     socket_.enable_writing();
+                    // 其它线程中创建的连接(如SslClient)在第一次事件时加入空闲表
+                    if(loop_->is_in_loop_thread()) {
+                        loop_->idle_list().touch(this, IdleList::Phase::PreFirstByte, loop_->loop_time());
+                    }
 
-
-                    log_info(name_, " connection created..."); 
+                    log_info("connection", id_, "created...");
                 }
+            public:
 
                 ConnState conn_state() const {
                     return conn_state_;
@@ -87,7 +132,7 @@ namespace cortono::net
                     // 防止二次关闭
                     if(conn_state_ != ConnState::Closed) {
                         // 如果仍有数据没有发送，等待发送完成后再关闭
-                        if(send_buffer_->empty() || sendfile_ == true) {
+                        if(sending()) {
                             conn_state_ = ConnState::WaitClosed;
                         }
                         else {
@@ -95,15 +140,24 @@ namespace cortono::net
                         }
                     }
                 }
+                // 不等待发送队列中的数据，立即关闭
+                void force_close() {
+                    handle_close();
+                }
                 void enable_reading() {
+                    reading_ = true;
                     socket_.enable_reading();
                 }
                 void enable_writing() {
                     socket_.enable_writing();
                 }
                 void disable_reading() {
+                    reading_ = false;
                     socket_.disable_reading();
                 }
+                bool is_reading() const {
+                    return reading_;
+                }
                 void disable_writing() {
                     socket_.disable_writing();
                 }
@@ -122,6 +176,67 @@ namespace cortono::net
                 void on_error(ErrorCallBack cb) {
                     error_cb_ = std::move(cb);
                 }
+                /*
+                 * 发送队列(send_buffer_和send_slices_)的高低水位
+                 * 1.待发送字节数达到high时调用on_high_water回调，之后降到low以下时调用on_drain回调
+                 * 2.high为0时不检查水位（默认）
+                 */
+                void set_water_marks(std::size_t high, std::size_t low) {
+                    high_water_ = high;
+                    low_water_ = std::min(low, high);
+                }
+                void on_high_water(MessageCallBack cb) {
+                    high_water_cb_ = std::move(cb);
+                }
+                void on_drain(MessageCallBack cb) {
+                    drain_cb_ = std::move(cb);
+                }
+                // 本连接的发送队列超过高水位时暂停peer的读取，降到低水位时恢复
+                // 用于代理等转发场景，peer的数据不会在本连接的发送队列中无限堆积
+                template <typename Peer>
+                void pause_reading_of(const std::shared_ptr<Peer>& peer) {
+                    std::weak_ptr<Peer> weak_peer = peer;
+                    backpressure_cb_ = [weak_peer](bool pause) {
+                        auto peer = weak_peer.lock();
+                        if(!peer) {
+                            return;
+                        }
+                        peer->loop()->safe_call([peer, pause] {
+                            if(peer->is_closed()) {
+                                return;
+                            }
+                            if(pause) {
+                                peer->disable_reading();
+                            }
+                            else if(!peer->is_reading()) {
+                                peer->enable_reading();
+                            }
+                        });
+                    };
+                }
+                // 由上层协议标记连接所处的阶段，用于选择空闲超时时间，只能在loop线程中调用
+                // 默认收到数据后进入MidRequest，HTTP在响应完成后标记为KeepAlive
+                void set_idle_phase(IdleList::Phase phase) {
+                    if(conn_state_ != ConnState::Closed) {
+                        loop_->idle_list().touch(this, phase, loop_->loop_time());
+                    }
+                }
+                // 还没有发送出去的字节数
+                std::size_t pending_bytes() {
+                    return send_buffer_->size() + slice_bytes_ + after_file_bytes_;
+                }
+                // 发送队列中还有数据或者正在发送文件
+                bool sending() const {
+                    return !send_buffer_->empty() || !send_slices_.empty() || sendfile_;
+                }
+                /*
+                 * 由hook接管连接的读写，连接不再读入接收缓冲区，也不再调用on_read
+                 * 1.设置之前已经在发送队列中的数据仍由连接发送，发送完之后才通知hook可写
+                 * 2.连接关闭时释放hook，只能在loop线程中调用
+                 */
+                void set_io_hook(std::shared_ptr<IoHook> hook) {
+                    io_hook_ = std::move(hook);
+                }
                 void on_conn(ConnCallBack cb) {
                     conn_cb_ = std::move(cb);
                 }
@@ -135,7 +250,7 @@ namespace cortono::net
                     return peer_endpoint_;
                 }
                 std::pair<std::string, std::uint16_t> local_endpoint() {
-                    if(local_endpoint_.first.empty() || peer_endpoint_.second == 0) {
+                    if(local_endpoint_.first.empty() || local_endpoint_.second == 0) {
                         local_endpoint_ = socket_.local_endpoint();
                     }
                     return local_endpoint_;
@@ -164,7 +279,20 @@ namespace cortono::net
                     }
                     return local_endpoint_.first;
                 }
+                int fd() const {
+                    return socket_.fd();
+                }
+                // 连接的唯一标识，用于Service中的连接表
+                std::uint64_t id() const {
+                    return id_;
+                }
+                // 名字需要两次系统调用和格式化，只在第一次使用时生成
                 std::string name() const {
+                    if(name_.empty()) {
+                        name_ = socket_.local_address() + ":" + (peer_endpoint_.second == 0
+                            ? socket_.peer_address()
+                            : util::format("<%s:%u>", peer_endpoint_.first.data(), peer_endpoint_.second));
+                    }
                     return name_;
                 }
                 std::string recv_all() {
@@ -182,16 +310,32 @@ namespace cortono::net
                 void clear_recv_buffer() {
                     recv_buffer_->clear();
                 }
+                // 每次可读通知最多读取的字节数
+                void set_read_budget(std::size_t bytes) {
+                    read_budget_ = std::max<std::size_t>(bytes, 1);
+                }
                 void send(const char* buffer, int len) {
                     // log_debug("in send... ", buffer, " ", len);
                     if(len == 0) {
                         log_error("data length is 0, ignore...");
                         return;
                     }
+                    if(sendfile_) {
+                        queue_after_file({ Slice(std::string(buffer, len)) }, nullptr);
+                        return;
+                    }
+                    // 前面还有没发送完的数据片段，为了保证顺序只能排在后面
+                    if(!send_slices_.empty()) {
+                        send_slices_.emplace_back(std::string(buffer, len));
+                        slice_bytes_ += len;
+                        check_high_water();
+                        return;
+                    }
                     // 如果正处于握手状态（客户端），则将数据添加到缓冲区等待连接建立后再发送
                     if(!send_buffer_->empty() || conn_state_ == ConnState::HandShaking) {
-                        log_info("waiting handshake done, save data to send_buffer...");
+                        log_debug("waiting handshake done, save data to send_buffer...");
                         send_buffer_->append(buffer, len);
+                        check_high_water();
                         return;
                     }
                     auto bytes = socket_.send(buffer, len);
@@ -202,43 +346,151 @@ namespace cortono::net
                     else if(bytes == -1) {
                         log_error("send return -1...");
                         if(errno == EINTR || errno == EAGAIN) {
-                            log_info("send is -1 and errno is EINTR | EAGAIN, call send again...");
-                            //FIXME: call send again ?
-                            /* send(msg); */
+                            // 内核发送缓冲区已满，全部放入send_buffer_等待可写
+                            write_handler_ = &Connection::handle_write;
+                            send_buffer_->append(buffer, len);
+                            check_high_water();
                         }
                         else {
                             handle_close();
                         }
                     }
                     else if(bytes != static_cast<int>(len)) {
-                        log_info("send length < data length, set write callback...");
+                        log_debug("send length < data length, set write callback...");
                         //没发完，设回调
-                        socket_.set_write_callback(std::bind(&Connection::handle_write, this));
+                        write_handler_ = &Connection::handle_write;
                         send_buffer_->append(buffer + bytes, len - bytes);
+                        check_high_water();
                     }
 
                 }
                 void send(const std::string& msg) {
                     send(msg.data(), msg.size());
                 }
+                // 分散/聚集发送，数据片段通过sendmsg一次写出
+                // 没有发送完的部分以引用的形式保存在send_slices_中，不会拷贝数据
+                void send(std::vector<Slice> slices) {
+                    if(sendfile_) {
+                        queue_after_file(std::move(slices), nullptr);
+                        return;
+                    }
+                    for(auto& slice : slices) {
+                        if(!slice.empty()) {
+                            slice_bytes_ += slice.size();
+                            send_slices_.emplace_back(std::move(slice));
+                        }
+                    }
+                    if(send_slices_.empty()) {
+                        return;
+                    }
+                    if(!send_buffer_->empty() || conn_state_ == ConnState::HandShaking) {
+                        check_high_water();
+                        return;
+                    }
+                    handle_write_slices();
+                    if(!is_closed()) {
+                        check_high_water();
+                    }
+                }
+                /*
+                 * 合并发送，cork和uncork之间的多次发送(包括sendfile)由内核合并成尽量少的报文段
+                 * 1.用于响应头和响应体分多次发送的情况，响应头不会单独占用一个报文段
+                 * 2.cork期间调用sendfile时，发送出第一块文件数据之后自动uncork
+                 * 3.cork期间没有更多数据时内核最多延迟200ms，调用者需要保证uncork
+                 * 4.正在发送文件时之后的数据都排在文件后面，不再合并
+                 */
+                void cork() {
+                    if(!corked_ && !sendfile_ && conn_state_ != ConnState::Closed && socket_.set_cork(true)) {
+                        corked_ = true;
+                    }
+                }
+                void uncork() {
+                    if(corked_) {
+                        corked_ = false;
+                        socket_.set_cork(false);
+                    }
+                }
+                bool is_corked() const {
+                    return corked_;
+                }
                 void sendfile(const std::string& filename) {
                     if(filename.empty()) {
                         return;
                     }
-                    fileoffet_ = 0;
-                    filesize_ = util::get_filesize(filename);
-                    if(filesize_ == 0) {
+                    sendfile(util::file_cache::instance().open(filename));
+                }
+                // 发送期间一直持有打开的文件，不再按文件名重复打开
+                // 前一个文件还没有发送完时排在它后面，不能覆盖正在发送的文件
+                void sendfile(util::file_cache::handle file) {
+                    if(!file || file->directory || file->size == 0) {
+                        uncork();
+                        return;
+                    }
+                    if(sendfile_) {
+                        queue_after_file({}, std::move(file));
                         return;
                     }
+                    fileoffet_ = 0;
+                    filesize_ = file->size;
                     sendfile_ = true;
-                    filename_ = filename;
-                    if(!send_buffer_->empty()) {
+                    file_ = std::move(file);
+                    if(!send_buffer_->empty() || !send_slices_.empty()) {
                         return;
                     }
                     handle_sendfile();
                 }
 
+                // 空闲超时，不再等待发送队列中的数据
+                void handle_idle() override {
+                    log_info("connection", id_, "idle timeout, close connection...");
+                    handle_close();
+                }
+                // 一次调用同时处理可读和可写，既不可读也不可写时(EPOLLERR/EPOLLHUP)关闭连接
+                // 读的过程中关闭了连接时跳过写，连接对象在handle_close中被延长到本轮事件处理结束
+                void handle_events(std::uint32_t events) override {
+                    if(conn_state_ == ConnState::Closed) {
+                        return;
+                    }
+                    loop_->idle_list().touch(this, loop_->loop_time());
+                    bool readable = EventPoller::readable_event(events);
+                    bool writeable = EventPoller::writeable_event(events);
+                    if(io_hook_) {
+                        handle_hooked_events(readable, writeable);
+                        return;
+                    }
+                    if(readable) {
+                        handle_read();
+                    }
+                    if(writeable && conn_state_ != ConnState::Closed) {
+                        (this->*write_handler_)();
+                        check_low_water();
+                    }
+                    if(!readable && !writeable) {
+                        handle_close();
+                    }
+                }
             private:
+                // hook可能在回调中关闭连接并被释放，先持有一份
+                void handle_hooked_events(bool readable, bool writeable) {
+                    auto hook = io_hook_;
+                    if(!readable && !writeable) {
+                        handle_close();
+                        return;
+                    }
+                    if(conn_state_ == ConnState::HandShaking && !handle_handshake()) {
+                        return;
+                    }
+                    if(readable) {
+                        hook->on_readable();
+                    }
+                    if(writeable && conn_state_ != ConnState::Closed && sending()) {
+                        (this->*write_handler_)();
+                        check_low_water();
+                    }
+                    if(writeable && conn_state_ != ConnState::Closed && !sending() && io_hook_ == hook) {
+                        hook->on_writeable();
+                    }
+                }
                 // connect没有立即成功后需要等待套接字可读并可写, 再通过getsockopt方可判断连接建立成功
                 // 对于TcpSocket，仅仅检查fd是否可写
                 // 对于SslSocket，还需要执行SSL_connect
@@ -247,7 +499,9 @@ namespace cortono::net
                     if(socket_.handshake()) {
                         log_info("handshake done");
                         conn_state_ = ConnState::Connected;
-                        conn_cb_(this->shared_from_this());
+                        if(conn_cb_) {
+                            conn_cb_(this->shared_from_this());
+                        }
                         return true;
                     }
                     else {
@@ -258,35 +512,70 @@ namespace cortono::net
                 }
                 void handle_read() {
                     // log_info("handle read");
+                    // 被hook接管之前排队的继续读取
+                    if(io_hook_) {
+                        return;
+                    }
                     if(conn_state_ == ConnState::HandShaking) {
                         if(!handle_handshake()) {
                             return;
                         }
                     }
-                    auto bytes = socket_.readable();
-                    // if(bytes == 0) {
-                        // return;
-                    // }
-                    recv_buffer_->enable_bytes(bytes);
-                    bytes = socket_.recv(recv_buffer_->end(), bytes);
-                    if(bytes == 0) {
-                        log_info("read 0 bytes, close connection...", name_);
-                        handle_close();
-                    }
-                    else if(bytes == -1) {
-                        if(errno == EINTR || errno == EAGAIN) {
-                            handle_read();
+                    // 边缘触发下一次通知需要读到EAGAIN为止，否则剩余的数据要等到下一次边缘才能读取
+                    // 没有读满也要继续读，和数据同时到达的FIN只有再读一次返回0才能发现
+                    // 每次readv同时读入缓冲区剩余空间和loop的临时缓冲区，只有用到临时缓冲区时才追加
+                    // 单次通知最多读取read_budget_字节，超过后把剩余的读取放到本轮事件处理之后，避免饿死其它连接
+                    std::size_t total = 0;
+                    while(total < read_budget_) {
+                        auto writeable = static_cast<std::size_t>(recv_buffer_->writeable());
+                        struct iovec iov[2];
+                        iov[0].iov_base = recv_buffer_->end();
+                        iov[0].iov_len = writeable;
+                        iov[1].iov_base = loop_->scratch();
+                        iov[1].iov_len = EventLoop::SCRATCH_SIZE;
+                        auto bytes = socket_.recvv(iov, 2);
+                        if(bytes == 0) {
+                            log_info("read 0 bytes, close connection...", name());
+                            if(total > 0 && read_cb_) {
+                                read_cb_(this->shared_from_this());
+                            }
+                            handle_close();
+                            return;
                         }
-                        else {
-                            log_info("read -1 bytes and errno != EINTR | EAGAIN, close connection...", name_);
+                        else if(bytes == -1) {
+                            if(errno == EINTR) {
+                                continue;
+                            }
+                            if(errno == EAGAIN) {
+                                break;
+                            }
+                            log_info("read -1 bytes and errno != EINTR | EAGAIN, close connection...", name());
                             handle_error(std::strerror(errno));
+                            return;
                         }
-                    }
-                    else {
-                        recv_buffer_->retrieve_write_bytes(bytes);
-                        if(read_cb_) {
-                            read_cb_(this->shared_from_this());
+                        auto n = static_cast<std::size_t>(bytes);
+                        if(n <= writeable) {
+                            recv_buffer_->retrieve_write_bytes(n);
                         }
+                        else {
+                            recv_buffer_->retrieve_write_bytes(writeable);
+                            recv_buffer_->append(loop_->scratch(), n - writeable);
+                        }
+                        total += n;
+                    }
+                    if(total >= read_budget_) {
+                        std::weak_ptr<Connection> weak_conn = this->shared_from_this();
+                        loop_->queue_call([weak_conn] {
+                            if(auto conn = weak_conn.lock(); conn && !conn->is_closed() && conn->is_reading()) {
+                                conn->handle_read();
+                            }
+                        });
+                    }
+                    if(total > 0 && idle_phase() != IdleList::Phase::MidRequest) {
+                        set_idle_phase(IdleList::Phase::MidRequest);
+                    }
+                    if(total > 0 && read_cb_) {
+                        read_cb_(this->shared_from_this());
                     }
                 }
                 void handle_write() {
@@ -300,10 +589,14 @@ namespace cortono::net
                         auto bytes = send_buffer_->size();
                         auto send_bytes = socket_.send(send_buffer_->begin(), bytes);
                         if(send_bytes == -1) {
-                            if(errno == EINTR || errno == EAGAIN) {
+                            if(errno == EINTR) {
                                 // FIXME: 对于SSL是否也是如此 ?
                                 handle_write();
                             }
+                            else if(errno == EAGAIN) {
+                                // 等待下一次可写，可读事件也会进入这里，不能在EAGAIN上自旋
+                                write_handler_ = &Connection::handle_write;
+                            }
                             else {
                                 log_error("send return -1, close connection...");
                                 handle_close();
@@ -314,23 +607,83 @@ namespace cortono::net
                         }
                         else if(bytes == send_bytes) {
                             send_buffer_->clear();
-                            if(sendfile_) {
-                                socket_.set_write_callback(std::bind(&Connection::handle_sendfile, this));
-                                handle_sendfile();
+                            if(!send_slices_.empty()) {
+                                handle_write_slices();
                             }
                             else {
-                                if(write_cb_) {
-                                    write_cb_(this->shared_from_this());
-                                }
-                                // 数据发送完成，如果之前已经尝试关闭连接但由于有数据未发送完而没有关闭，则进行关闭
-                                if(conn_state_ == ConnState::WaitClosed) {
-                                    handle_close();
-                                }
+                                handle_write_done();
                             }
                         }
                         else {
                             send_buffer_->retrieve_read_bytes(send_bytes);
-                            socket_.set_write_callback(std::bind(&Connection::handle_write, this));
+                            write_handler_ = &Connection::handle_write;
+                        }
+                    }
+                    else if(!send_slices_.empty()) {
+                        handle_write_slices();
+                    }
+                }
+                // 从send_slices_的第一个片段的当前偏移处继续发送，直到发送完或者套接字不可写
+                void handle_write_slices() {
+                    constexpr int max_iov = 64;
+                    struct iovec iov[max_iov];
+                    while(!send_slices_.empty()) {
+                        int iovcnt = 0;
+                        std::size_t bytes = 0;
+                        for(auto it = send_slices_.begin(); it != send_slices_.end() && iovcnt < max_iov; ++it) {
+                            iov[iovcnt].iov_base = const_cast<char*>(it->data());
+                            iov[iovcnt].iov_len = it->size();
+                            bytes += it->size();
+                            ++iovcnt;
+                        }
+                        auto send_bytes = socket_.sendv(iov, iovcnt);
+                        if(send_bytes == -1) {
+                            if(errno == EINTR) {
+                                continue;
+                            }
+                            if(errno != EAGAIN) {
+                                log_error("sendmsg return -1, close connection...");
+                                handle_close();
+                            }
+                            else {
+                                // 等待下一次可写
+                                write_handler_ = &Connection::handle_write;
+                            }
+                            return;
+                        }
+                        else if(send_bytes == 0) {
+                            handle_close();
+                            return;
+                        }
+                        std::size_t left = send_bytes;
+                        slice_bytes_ -= send_bytes;
+                        while(left > 0 && left >= send_slices_.front().size()) {
+                            left -= send_slices_.front().size();
+                            send_slices_.pop_front();
+                        }
+                        if(left > 0) {
+                            send_slices_.front().remove_prefix(left);
+                        }
+                        if(static_cast<std::size_t>(send_bytes) < bytes) {
+                            write_handler_ = &Connection::handle_write;
+                            return;
+                        }
+                    }
+                    handle_write_done();
+                }
+                // 缓冲区中的数据都发送完成后，继续发送文件或者通知上层
+                void handle_write_done() {
+                    if(sendfile_) {
+                        write_handler_ = &Connection::handle_sendfile;
+                        handle_sendfile();
+                    }
+                    else {
+                        if(write_cb_) {
+                            write_cb_(this->shared_from_this());
+                        }
+                        // 数据发送完成，如果之前已经尝试关闭连接但由于有数据未发送完而没有关闭，则进行关闭
+                        if(conn_state_ == ConnState::WaitClosed) {
+                            handle_close();
                         }
                     }
                 }
@@ -339,6 +692,12 @@ namespace cortono::net
                     if(conn_state_ != ConnState::Closed) {
                         conn_state_ = ConnState::Closed;
                         socket_.disable_all();
+                        loop_->idle_list().remove(this);
+                        keep_alive_until_round_end();
+                        release_backpressure();
+                        if(auto hook = std::move(io_hook_); hook) {
+                            hook->on_closed();
+                        }
                         if(close_cb_)
                             close_cb_(this->shared_from_this());
                     }
@@ -348,59 +707,155 @@ namespace cortono::net
                     if(conn_state_ != ConnState::Closed) {
                         conn_state_ = ConnState::Closed;
                         socket_.disable_all();
+                        loop_->idle_list().remove(this);
+                        keep_alive_until_round_end();
+                        release_backpressure();
+                        if(auto hook = std::move(io_hook_); hook) {
+                            hook->on_closed();
+                        }
                         if(error_cb_) {
                             error_cb_(this->shared_from_this());
                         }
                     }
                 }
-                void handle_sendfile() {
-                    if(!sendfile_) {
+                // 待发送的数据超过高水位时通知一次，回落到低水位以下(check_low_water)之前不再重复通知
+                void check_high_water() {
+                    if(high_water_ == 0 || above_high_water_ || pending_bytes() < high_water_) {
                         return;
                     }
-                    int bytes = socket_.sendfile(filename_, fileoffet_, filesize_);
-                    if(bytes == 0) {
-                        handle_close();
+                    above_high_water_ = true;
+                    if(high_water_cb_) {
+                        high_water_cb_(this->shared_from_this());
                     }
-                    else if(bytes == -1) {
-                        if(errno == EINTR || errno == EAGAIN) {
-                            handle_sendfile();
+                    if(backpressure_cb_) {
+                        backpressure_cb_(true);
+                    }
+                }
+                void check_low_water() {
+                    if(!above_high_water_ || pending_bytes() > low_water_) {
+                        return;
+                    }
+                    above_high_water_ = false;
+                    if(drain_cb_) {
+                        drain_cb_(this->shared_from_this());
+                    }
+                    if(backpressure_cb_) {
+                        backpressure_cb_(false);
+                    }
+                }
+                // 连接关闭后发送队列不会再减少，不能让peer一直处于暂停读取的状态
+                void release_backpressure() {
+                    if(above_high_water_) {
+                        above_high_water_ = false;
+                        if(backpressure_cb_) {
+                            backpressure_cb_(false);
+                        }
+                    }
+                }
+                // 关闭回调中通常会释放最后一个引用，而调用者(handle_events等)在返回后还会访问连接
+                void keep_alive_until_round_end() {
+                    loop_->queue_call([self = this->shared_from_this()] {});
+                }
+                // 和handle_write一样发送到EAGAIN为止，边缘触发下不会再有可写通知
+                void handle_sendfile() {
+                    while(sendfile_) {
+                        auto bytes = socket_.sendfile(file_->fd, fileoffet_, filesize_);
+                        if(bytes > 0) {
+                            // 第一块文件数据已经和之前的数据合并
+                            uncork();
+                            fileoffet_ += bytes;
+                            filesize_ -= static_cast<std::size_t>(bytes);
+                            if(filesize_ == 0) {
+                                sendfile_ = false;
+                                fileoffet_ = 0;
+                                file_.reset();
+                                write_handler_ = &Connection::handle_write;
+                                send_after_file();
+                                // 如果之前尝试关闭连接但是由于有文件没有发送完而没有关闭，则关闭连接
+                                if(conn_state_ == ConnState::WaitClosed && !sending()) {
+                                    handle_close();
+                                }
+                                return;
+                            }
+                        }
+                        else if(bytes == -1 && errno == EINTR) {
+                            continue;
+                        }
+                        else if(bytes == -1 && errno == EAGAIN) {
+                            write_handler_ = &Connection::handle_sendfile;
+                            return;
                         }
                         else {
+                            // 返回0说明文件在发送期间被截断
                             handle_close();
+                            return;
                         }
                     }
-                    else if(bytes < static_cast<int>(filesize_)) {
-                        socket_.set_write_callback(std::bind(&Connection::handle_sendfile, this));
-                        fileoffet_ += bytes;
-                        filesize_ -= bytes;
+                }
+                void queue_after_file(std::vector<Slice> slices, util::file_cache::handle file) {
+                    for(auto& slice : slices) {
+                        after_file_bytes_ += slice.size();
                     }
-                    else {
-                        sendfile_ = false;
-                        filesize_ = 0;
-                        fileoffet_ = 0;
-                        // 如果之前尝试关闭连接但是由于有文件没有发送完而没有关闭，则关闭连接
-                        if(conn_state_ == ConnState::WaitClosed) {
-                            handle_close();
+                    after_file_.push_back({ std::move(slices), std::move(file) });
+                    check_high_water();
+                }
+                // 文件发送完成后按顺序重新发送排在后面的数据，遇到下一个文件时等它发送完成再继续
+                void send_after_file() {
+                    while(!sendfile_ && !after_file_.empty() && conn_state_ != ConnState::Closed) {
+                        auto pending = std::move(after_file_.front());
+                        after_file_.pop_front();
+                        if(pending.file) {
+                            sendfile(std::move(pending.file));
+                            continue;
                         }
+                        for(auto& slice : pending.slices) {
+                            after_file_bytes_ -= slice.size();
+                        }
+                        send(std::move(pending.slices));
                     }
                 }
+            private:
+                static std::uint64_t next_id() {
+                    static std::atomic<std::uint64_t> seq{ 0 };
+                    return seq.fetch_add(1, std::memory_order_relaxed) + 1;
+                }
             protected:
-                std::string name_;
-                // 通过读取文件内容发送数据而非直接调用::sendfile时使用
-                std::ifstream fin;
-                std::string filename_;
+                mutable std::string name_;
+                // 正在发送的文件，filesize_为剩余的字节数
+                util::file_cache::handle file_;
                 std::size_t filesize_{ 0 };
                 off_t fileoffet_{ 0 };
                 bool sendfile_{ false };
+                // 发送文件期间调用的send和sendfile，每一项是一组数据片段或者一个文件
+                struct PendingSend
+                {
+                    std::vector<Slice> slices;
+                    util::file_cache::handle file;
+                };
+                std::deque<PendingSend> after_file_;
+                std::size_t after_file_bytes_{ 0 };
 
                 EventLoop* loop_;
+                std::uint64_t id_;
                 // socket_t可以是TcpSocket或者SslSocket
                 socket_t socket_;
+                // 可写时执行的函数，发送文件时为handle_sendfile，否则为handle_write
+                void (Connection::*write_handler_)(){ &Connection::handle_write };
                 MessageCallBack read_cb_, write_cb_;
                 ErrorCallBack error_cb_;
                 CloseCallBack close_cb_;
                 ConnCallBack conn_cb_;
                 std::shared_ptr<Buffer> recv_buffer_, send_buffer_;
+                std::deque<Slice> send_slices_;
+                std::size_t slice_bytes_{ 0 };
+                std::size_t high_water_{ 0 }, low_water_{ 0 };
+                bool above_high_water_{ false };
+                bool reading_{ true };
+                bool corked_{ false };
+                MessageCallBack high_water_cb_, drain_cb_;
+                std::function<void(bool)> backpressure_cb_;
+                std::shared_ptr<IoHook> io_hook_;
+                std::size_t read_budget_{ 4 * EventLoop::SCRATCH_SIZE };
 
                 ConnState conn_state_ { ConnState::Closed };
 
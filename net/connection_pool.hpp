@@ -0,0 +1,410 @@
+#pragma once
+
+#include "../std.hpp"
+#include "../util/noncopyable.hpp"
+#include "eventloop.hpp"
+#include "client.hpp"
+
+namespace cortono::net
+{
+    /*
+     * 上游连接池，按照(host, port)保存空闲连接
+     * 1.acquire优先取最近放回的空闲连接，取出时检查连接状态、空闲时间并且用MSG_PEEK确认对端没有关闭也没有多余的数据
+     *   没有空闲连接并且连接数没有达到max_total时通过Client::async_connect新建连接，否则排队等待
+     * 2.release时连接仍然可用并且没有未发送或未读取的数据时，先交给排队的请求，其次放回空闲队列(最多max_idle个)
+     *   其它情况关闭连接，空出的名额用来为排队的请求新建连接
+     * 3.空闲连接收到数据或者被关闭时直接丢弃，定时清理超过idle_ttl的空闲连接
+     * 4.排队超过wait_timeout的请求回调nullptr
+     *
+     * 每个loop线程一个，通过ConnectionPool::of(loop)获取，只能在loop线程中使用
+     * 借出的连接无论是否可用都必须调用release，否则占用的名额不会归还
+     * 可以在这个连接的关闭回调中release，不能在它的其它回调中release
+     */
+    template <typename Client>
+    class ConnectionPool : private util::noncopyable
+    {
+        public:
+            using Connection = typename Client::ClientConnType;
+            using Pointer = typename Connection::Pointer;
+            using AcquireCallBack = std::function<void(Pointer)>;
+
+            struct Options
+            {
+                std::size_t max_idle{ 8 };                    // 每个(host, port)最多保留的空闲连接数
+                std::size_t max_total{ 64 };                  // 每个(host, port)最多同时存在的连接数，包括正在建立的
+                std::size_t max_waiters{ 1024 };              // 每个(host, port)最多排队的请求数，超过时直接失败
+                Timer::milliseconds idle_ttl{ 30000 };
+                Timer::milliseconds wait_timeout{ 3000 };
+            };
+            // 所有loop的累计值，可以在任意线程读取
+            struct Stats
+            {
+                std::size_t acquires;
+                std::size_t hits;                   // 直接取得空闲连接或者被放回的连接
+                std::size_t waits;                  // 需要排队的请求
+                std::size_t wait_timeouts;
+                std::chrono::microseconds wait_time;    // 排队时间之和
+                std::chrono::microseconds max_wait_time;
+                std::size_t connects;               // 新建成功的连接
+                std::size_t connect_failures;
+                std::chrono::microseconds connect_time; // 从发起解析到连接建立的时间之和
+                std::chrono::microseconds max_connect_time;
+                std::size_t evictions;              // 因为超时、对端关闭或者多余的数据而丢弃的空闲连接
+                std::size_t idle;                   // 当前的空闲连接数
+
+                double hit_rate() const {
+                    return acquires == 0 ? 0.0 : static_cast<double>(hits) / acquires;
+                }
+            };
+
+            static ConnectionPool& of(EventLoop* loop) {
+                if(!current_ || current_->loop_ != loop) {
+                    current_.reset(new ConnectionPool(loop));
+                    // 空闲连接析构时需要访问loop，必须在loop之前释放
+                    loop->at_exit([loop] {
+                        if(current_ && current_->loop_ == loop) {
+                            current_.reset();
+                        }
+                    });
+                }
+                return *current_;
+            }
+            // 只对之后创建的ConnectionPool生效，需要在loop启动之前调用
+            static void set_options(Options options) {
+                std::unique_lock lock{ options_mutex() };
+                global_options() = options;
+            }
+            static Options options() {
+                std::unique_lock lock{ options_mutex() };
+                return global_options();
+            }
+            static Stats stats() {
+                auto& c = counters();
+                auto load = [](const std::atomic<std::size_t>& v) { return v.load(std::memory_order_relaxed); };
+                return {
+                    load(c.acquires), load(c.hits), load(c.waits), load(c.wait_timeouts),
+                    std::chrono::microseconds(load(c.wait_us)), std::chrono::microseconds(load(c.max_wait_us)),
+                    load(c.connects), load(c.connect_failures),
+                    std::chrono::microseconds(load(c.connect_us)), std::chrono::microseconds(load(c.max_connect_us)),
+                    load(c.evictions), load(c.idle)
+                };
+            }
+
+            // 在loop线程中析构，空闲连接在这里关闭，从loop的空闲表中移除
+            ~ConnectionPool() {
+                for(auto& [key, host] : hosts_) {
+                    counters().idle.fetch_sub(host.idle.size(), std::memory_order_relaxed);
+                    for(auto& idle : host.idle) {
+                        detach(idle.conn);
+                        idle.conn->force_close();
+                    }
+                }
+            }
+
+            void acquire(const std::string& host, unsigned short port, AcquireCallBack cb) {
+                add(counters().acquires);
+                auto key = host + ":" + std::to_string(port);
+                auto& h = hosts_[key];
+                h.host = host;
+                h.port = port;
+                if(auto conn = take_idle(h); conn) {
+                    add(counters().hits);
+                    checkout(key, h, conn);
+                    cb(std::move(conn));
+                    return;
+                }
+                if(h.idle.size() + h.active < options_.max_total) {
+                    connect(key, h, std::move(cb));
+                    return;
+                }
+                if(h.waiters.size() >= options_.max_waiters) {
+                    log_error("too many waiters for", key);
+                    cb(nullptr);
+                    return;
+                }
+                add(counters().waits);
+                auto id = ++waiter_seq_;
+                auto timer = loop_->run_after(options_.wait_timeout, [this, alive = std::weak_ptr<char>(alive_), key, id] {
+                    if(!alive.expired()) {
+                        handle_wait_timeout(key, id);
+                    }
+                });
+                h.waiters.push_back({ id, std::move(cb), Timer::now(), timer });
+            }
+
+            // reusable为false时直接关闭连接，例如响应没有读完或者连接上有不能复用的状态
+            void release(const Pointer& conn, bool reusable = true) {
+                auto it = active_.find(conn->id());
+                if(it == active_.end()) {
+                    return;
+                }
+                auto key = std::move(it->second);
+                active_.erase(it);
+                auto& h = hosts_[key];
+                --h.active;
+                if(reusable && conn->is_connected() && conn->is_reading()
+                        && conn->pending_bytes() == 0 && conn->recv_buffer()->empty()) {
+                    if(!h.waiters.empty()) {
+                        auto waiter = pop_waiter(h);
+                        add(counters().hits);
+                        checkout(key, h, conn);
+                        waiter.cb(conn);
+                        return;
+                    }
+                    if(h.idle.size() < options_.max_idle) {
+                        park(key, h, conn);
+                        return;
+                    }
+                }
+                // 在连接自己的关闭回调中release时不能替换正在执行的回调
+                if(!conn->is_closed()) {
+                    detach(conn);
+                    conn->close();
+                }
+                serve_waiter(key, h);
+            }
+
+        private:
+            struct Idle
+            {
+                Pointer conn;
+                Timer::time_point since;
+            };
+            struct Waiter
+            {
+                std::uint64_t id;
+                AcquireCallBack cb;
+                Timer::time_point since;
+                Timer::timer_id timer;
+            };
+            struct Host
+            {
+                std::string host;
+                unsigned short port{ 0 };
+                std::deque<Idle> idle;              // 队尾是最近放回的
+                std::size_t active{ 0 };            // 借出和正在建立的连接数
+                std::deque<Waiter> waiters;
+            };
+            struct Counters
+            {
+                std::atomic<std::size_t> acquires{ 0 }, hits{ 0 }, waits{ 0 }, wait_timeouts{ 0 };
+                std::atomic<std::size_t> wait_us{ 0 }, max_wait_us{ 0 };
+                std::atomic<std::size_t> connects{ 0 }, connect_failures{ 0 };
+                std::atomic<std::size_t> connect_us{ 0 }, max_connect_us{ 0 };
+                std::atomic<std::size_t> evictions{ 0 }, idle{ 0 };
+            };
+
+            explicit ConnectionPool(EventLoop* loop)
+                : loop_(loop),
+                  options_(options())
+            {
+                auto interval = std::clamp(options_.idle_ttl / 2, Timer::milliseconds(100), Timer::milliseconds(10000));
+                loop_->run_every(interval, [this, alive = std::weak_ptr<char>(alive_)] {
+                    if(!alive.expired()) {
+                        sweep();
+                    }
+                });
+            }
+
+            static Counters& counters() {
+                static Counters inst;
+                return inst;
+            }
+            static void add(std::atomic<std::size_t>& counter, std::size_t n = 1) {
+                counter.fetch_add(n, std::memory_order_relaxed);
+            }
+            static void record(std::atomic<std::size_t>& total, std::atomic<std::size_t>& max, Timer::time_point since) {
+                auto us = static_cast<std::size_t>(std::chrono::duration_cast<std::chrono::microseconds>(Timer::now() - since).count());
+                add(total, us);
+                auto cur = max.load(std::memory_order_relaxed);
+                while(us > cur && !max.compare_exchange_weak(cur, us, std::memory_order_relaxed)) {
+                }
+            }
+
+            // 对端关闭时recv返回0，有多余的数据时返回正数，都不能复用
+            static bool healthy(const Pointer& conn) {
+                if(!conn->is_connected()) {
+                    return false;
+                }
+                char c;
+                auto n = ::recv(conn->fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+                return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            }
+
+            Pointer take_idle(Host& h) {
+                auto now = Timer::now();
+                while(!h.idle.empty()) {
+                    auto idle = std::move(h.idle.back());
+                    h.idle.pop_back();
+                    counters().idle.fetch_sub(1, std::memory_order_relaxed);
+                    detach(idle.conn);
+                    if(now - idle.since < options_.idle_ttl && healthy(idle.conn)) {
+                        return idle.conn;
+                    }
+                    add(counters().evictions);
+                    idle.conn->force_close();
+                }
+                return nullptr;
+            }
+
+            void checkout(const std::string& key, Host& h, const Pointer& conn) {
+                ++h.active;
+                active_[conn->id()] = key;
+            }
+
+            void park(const std::string& key, Host& h, const Pointer& conn) {
+                std::weak_ptr<char> alive = alive_;
+                auto evict = [this, alive, key](auto conn) {
+                    if(!alive.expired()) {
+                        evict_idle(key, conn);
+                    }
+                };
+                conn->on_read(evict);
+                conn->on_close(evict);
+                conn->on_error(evict);
+                conn->on_write(nullptr);
+                conn->set_idle_phase(IdleList::Phase::KeepAlive);
+                h.idle.push_back({ conn, Timer::now() });
+                add(counters().idle);
+            }
+
+            // 清除连接上由借用者设置的回调
+            static void detach(const Pointer& conn) {
+                conn->on_read(nullptr);
+                conn->on_write(nullptr);
+                conn->on_close(nullptr);
+                conn->on_error(nullptr);
+            }
+
+            void evict_idle(std::string key, const Pointer& conn) {
+                auto& h = hosts_[key];
+                auto it = std::find_if(h.idle.begin(), h.idle.end(), [&conn](auto& idle) { return idle.conn == conn; });
+                if(it == h.idle.end()) {
+                    return;
+                }
+                h.idle.erase(it);
+                counters().idle.fetch_sub(1, std::memory_order_relaxed);
+                add(counters().evictions);
+                // 在连接的回调中执行，保留回调，再次触发时已经不在空闲队列中
+                conn->force_close();
+                serve_waiter(key, h);
+            }
+
+            void connect(const std::string& key, Host& h, AcquireCallBack cb) {
+                ++h.active;
+                auto start = Timer::now();
+                std::weak_ptr<char> alive = alive_;
+                // 连接建立之前的关闭和错误都算作连接失败，只回调一次
+                auto failed = std::make_shared<bool>(false);
+                auto fail = [this, alive, key, cb, failed](auto conn) {
+                    if(alive.expired() || *failed) {
+                        return;
+                    }
+                    *failed = true;
+                    if(conn) {
+                        connecting_.erase(conn->id());
+                    }
+                    add(counters().connect_failures);
+                    auto& h = hosts_[key];
+                    --h.active;
+                    serve_waiter(key, h);
+                    cb(nullptr);
+                };
+                auto conn_cb = [this, alive, key, cb, start](auto conn) {
+                    detach(conn);
+                    if(alive.expired()) {
+                        conn->close();
+                        return;
+                    }
+                    add(counters().connects);
+                    record(counters().connect_us, counters().max_connect_us, start);
+                    connecting_.erase(conn->id());
+                    active_[conn->id()] = key;
+                    cb(conn);
+                };
+                // 连接建立之前由连接池持有，立即连接成功时conn_cb已经在async_connect中执行
+                auto done = [this, alive, fail](Pointer conn) {
+                    if(!conn) {
+                        fail(conn);
+                    }
+                    else if(!alive.expired() && conn->conn_state() == Connection::ConnState::HandShaking) {
+                        connecting_[conn->id()] = conn;
+                    }
+                };
+                Client::async_connect(loop_, h.host, h.port, std::move(done), nullptr, nullptr, fail, std::move(conn_cb), fail);
+            }
+
+            Waiter pop_waiter(Host& h) {
+                auto waiter = std::move(h.waiters.front());
+                h.waiters.pop_front();
+                loop_->cancel_timer(waiter.timer);
+                record(counters().wait_us, counters().max_wait_us, waiter.since);
+                return waiter;
+            }
+
+            // 有空出的名额时为排队最久的请求新建连接
+            void serve_waiter(const std::string& key, Host& h) {
+                if(h.waiters.empty() || h.idle.size() + h.active >= options_.max_total) {
+                    return;
+                }
+                auto waiter = pop_waiter(h);
+                connect(key, h, std::move(waiter.cb));
+            }
+
+            void handle_wait_timeout(const std::string& key, std::uint64_t id) {
+                auto& h = hosts_[key];
+                auto it = std::find_if(h.waiters.begin(), h.waiters.end(), [id](auto& w) { return w.id == id; });
+                if(it == h.waiters.end()) {
+                    return;
+                }
+                auto cb = std::move(it->cb);
+                record(counters().wait_us, counters().max_wait_us, it->since);
+                h.waiters.erase(it);
+                add(counters().wait_timeouts);
+                log_info("wait for connection timeout:", key);
+                cb(nullptr);
+            }
+
+            void sweep() {
+                auto now = Timer::now();
+                for(auto it = hosts_.begin(); it != hosts_.end();) {
+                    auto& h = it->second;
+                    // 队头是最早放回的
+                    while(!h.idle.empty() && now - h.idle.front().since >= options_.idle_ttl) {
+                        auto conn = std::move(h.idle.front().conn);
+                        h.idle.pop_front();
+                        counters().idle.fetch_sub(1, std::memory_order_relaxed);
+                        add(counters().evictions);
+                        detach(conn);
+                        conn->force_close();
+                    }
+                    if(h.idle.empty() && h.active == 0 && h.waiters.empty()) {
+                        it = hosts_.erase(it);
+                    }
+                    else {
+                        ++it;
+                    }
+                }
+            }
+
+            static std::mutex& options_mutex() {
+                static std::mutex inst;
+                return inst;
+            }
+            static Options& global_options() {
+                static Options inst;
+                return inst;
+            }
+
+        private:
+            inline static thread_local std::unique_ptr<ConnectionPool> current_;
+
+            EventLoop* loop_;
+            Options options_;
+            std::shared_ptr<char> alive_{ std::make_shared<char>() };
+            std::unordered_map<std::string, Host> hosts_;
+            std::unordered_map<std::uint64_t, std::string> active_;
+            std::unordered_map<std::uint64_t, Pointer> connecting_;
+            std::uint64_t waiter_seq_{ 0 };
+    };
+}
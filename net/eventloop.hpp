@@ -4,8 +4,12 @@
 #include "poller.hpp"
 #include "socket.hpp"
 #include "timer.hpp"
+#include "timer_wheel.hpp"
+#include "idle_list.hpp"
 #include "../std.hpp"
 #include "../util/noncopyable.hpp"
+#include "../util/mpsc_queue.hpp"
+#include "../util/object_pool.hpp"
 
 namespace cortono::net
 {
@@ -17,11 +21,27 @@ namespace cortono::net
                   quit_(false),
                   poller_(std::make_shared<EventPoller>()),
                   watcher_(std::make_shared<Watcher>()),
-                  watch_socket_(std::make_shared<TcpSocket>(watcher_->read_fd()))
+                  watch_socket_(std::make_shared<TcpSocket>(watcher_->read_fd())),
+                  scratch_(SCRATCH_SIZE),
+                  loop_time_(Timer::now())
             {
+                pool_.make_current();
                 watch_socket_->tie(poller_);
                 watch_socket_->enable_reading();
                 watch_socket_->set_read_callback([this] { watcher_->clear(); });
+                init_timer_fd();
+            }
+
+            ~EventLoop() {
+                // 后注册的先执行，此时loop的成员都还有效
+                for(auto it = exit_funcs_.rbegin(); it != exit_funcs_.rend(); ++it) {
+                    (*it)();
+                }
+            }
+
+            // 注册loop析构时执行的函数，用于释放绑定到本loop的对象(如连接池中的连接)
+            void at_exit(std::function<void()> cb) {
+                exit_funcs_.emplace_back(std::move(cb));
             }
 
             void quit() {
@@ -37,53 +57,113 @@ namespace cortono::net
                 }
             }
             void loop_once() {
-                if(!timers_.empty() && timers_.begin()->expires_milliseconds() <= 0) {
-                    handle_time_func();
+                auto idle_start = loop_time_ = Timer::now();
+                ready_events_ = 0;
+                if(max_spin_budget_.count() == 0 || !busy_poll()) {
+                    // 先声明即将睡眠再检查任务队列，与safe_call中先入队再检查sleeping_的顺序相对应
+                    // 保证要么这里看到新任务不阻塞，要么生产者看到sleeping_为true并唤醒
+                    sleeping_.store(true, std::memory_order_seq_cst);
+                    int timeout = pending_functors_.empty() ? wait_timeout() : 0;
+                    ready_events_ = poller_->wait(timeout);
+                    sleeping_.store(false, std::memory_order_relaxed);
+                    if(max_spin_budget_.count() > 0) {
+                        add_stat(busy_poll_sleeps_);
+                    }
                 }
-                int timeout = timers_.empty() ? -1 : timers_.begin()->expires_milliseconds();
-                poller_->wait(timeout);
-                handle_pending_func();
+                loop_time_ = Timer::now();
+                // 本轮之后的日志使用缓存的时间
+                util::logger::tick();
+                if(max_spin_budget_.count() > 0) {
+                    adapt_spin_budget(loop_time_ - idle_start);
+                }
+                auto tasks = handle_pending_func();
                 handle_time_func();
+                queue_depth_.store(ready_events_ + tasks, std::memory_order_relaxed);
             }
-            void handle_pending_func() {
-                std::vector<std::function<void()>> pending_functors;
-                {
-                    std::unique_lock lock { mutex_ };
-                    pending_functors.swap(pending_functors_);
+            // 轮询到事件或任务时返回true，否则返回false并进入阻塞等待
+            bool busy_poll() {
+                if(spin_budget_.count() == 0) {
+                    return false;
                 }
-                for(auto& cb : pending_functors) {
-                    cb();
-                }
-            }
-            void handle_time_func() {
-                while(!timers_.empty() && timers_.begin()->is_expires()) {
-                    auto t = *timers_.begin();
-                    timers_.erase(timers_.begin());
-                    t.run();
-                    if(t.is_periodic()) {
-                        t.update_time();
-                        timers_.emplace(std::move(t));
-                        id_to_timers_[t.id()] = t;
+                auto start = loop_time_;
+                auto end = start + spin_budget_;
+                // 不能越过最近的定时器
+                if(auto due = timers_.next_deadline(); due) {
+                    if(*due <= start) {
+                        return false;
                     }
-                    else {
-                        id_to_timers_.erase(t.id());
+                    end = std::min(end, *due);
+                }
+                do {
+                    if(!pending_functors_.empty() || (ready_events_ = poller_->wait(0)) > 0) {
+                        add_stat(busy_poll_hits_);
+                        return true;
                     }
+                } while(Timer::now() < end);
+                add_stat(busy_poll_misses_);
+                return false;
+            }
+            void adapt_spin_budget(Timer::time_point::duration gap) {
+                auto us = std::chrono::duration_cast<std::chrono::microseconds>(gap);
+                arrival_gap_ = (arrival_gap_ * 7 + us) / 8;
+                spin_budget_ = arrival_gap_ <= max_spin_budget_
+                    ? std::min(max_spin_budget_, arrival_gap_ * 2)
+                    : std::chrono::microseconds(0);
+                spin_budget_us_.store(spin_budget_.count(), std::memory_order_relaxed);
+            }
+            // 只有loop线程写入
+            static void add_stat(std::atomic<std::size_t>& counter) {
+                counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+            // 返回执行的任务数
+            std::size_t handle_pending_func() {
+                // 只执行本轮开始时已有的任务，执行过程中新加入的任务留到下一轮
+                std::function<void()> cb;
+                while(pending_functors_.pop(cb)) {
+                    running_functors_.emplace_back(std::move(cb));
+                }
+                for(auto& f : running_functors_) {
+                    f();
                 }
+                auto tasks = running_functors_.size();
+                running_functors_.clear();
+                return tasks;
+            }
+            // 上一轮处理的就绪事件数和任务数之和，由loop线程在每轮结束时更新，用于连接的负载均衡
+            std::size_t queue_depth() const {
+                return queue_depth_.load(std::memory_order_relaxed);
+            }
+            void handle_time_func() {
+                timers_.expire(Timer::now());
+            }
+            bool is_in_loop_thread() const {
+                return std::this_thread::get_id() == tid_;
             }
             void safe_call(std::function<void()> cb) {
-                if(std::this_thread::get_id() == tid_)
+                if(is_in_loop_thread())
                 {
                     cb();
                 }
                 else
                 {
-                    {
-                        std::unique_lock lock { mutex_ };
-                        pending_functors_.emplace_back(std::move(cb));
+                    pending_functors_.push(std::move(cb));
+                    // 只有loop阻塞在epoll_wait中时才需要唤醒，多个生产者只有一个会写eventfd
+                    if(sleeping_.exchange(false, std::memory_order_seq_cst)) {
+                        wake_up();
                     }
+                }
+            }
+            // 与safe_call不同，即使在loop线程中调用也不会立即执行，而是在本轮事件处理完成后执行
+            void queue_call(std::function<void()> cb) {
+                pending_functors_.push(std::move(cb));
+                if(!is_in_loop_thread() && sleeping_.exchange(false, std::memory_order_seq_cst)) {
                     wake_up();
                 }
             }
+            // 每个loop一块64KiB的临时缓冲区，连接读数据时用于接收超出缓冲区剩余空间的部分
+            char* scratch() {
+                return scratch_.data();
+            }
             void wake_up() {
                 watcher_->notify();
             }
@@ -91,51 +171,238 @@ namespace cortono::net
                 return poller_;
             }
 
-            Timer::timer_id set_timer(Timer::time_point&& point, Timer::milliseconds&& interval, std::function<void()>&& cb) {
-                Timer timer(std::move(point), std::move(interval), std::move(cb));
-                auto id = timer.id();
-                safe_call([this, timer = std::move(timer)] {
-                    timers_.emplace(timer);
-                    id_to_timers_.emplace(timer.id(), timer);
+            Timer::timer_id set_timer(Timer::time_point&& point, Timer::duration&& interval, std::function<void()>&& cb) {
+                if(is_in_loop_thread()) {
+                    return timers_.add(std::move(point), std::move(interval), std::move(cb));
+                }
+                // 时间轮只能在loop线程中访问，其它线程先分配一个远程id，在loop线程中插入后记录映射
+                // 一次性定时器在执行时删除映射，周期定时器在取消时删除映射
+                auto id = TimerWheel::REMOTE_FLAG | (++remote_timer_seq_);
+                safe_call([this, id, point = std::move(point), interval = std::move(interval), cb = std::move(cb)]() mutable {
+                    // 插入之前已经被取消
+                    if(cancelled_remote_timers_.erase(id) > 0) {
+                        return;
+                    }
+                    if(interval.count() > 0) {
+                        remote_timers_[id] = timers_.add(point, interval, std::move(cb));
+                    }
+                    else {
+                        remote_timers_[id] = timers_.add(point, interval, [this, id, cb = std::move(cb)] {
+                            remote_timers_.erase(id);
+                            cb();
+                        });
+                    }
                 });
                 return id;
             }
+            // 时间间隔可以小于1ms，如Timer::microseconds(200)
             Timer::timer_id run_at(Timer::time_point point, std::function<void()> cb) {
-                Timer::milliseconds interval{0};
+                Timer::duration interval{0};
                 return set_timer(std::move(point), std::move(interval), std::move(cb));
             }
-            Timer::timer_id run_at(Timer::time_point point, Timer::milliseconds interval, std::function<void()> cb) {
+            Timer::timer_id run_at(Timer::time_point point, Timer::duration interval, std::function<void()> cb) {
                 return set_timer(std::move(point), std::move(interval), std::move(cb));
             }
-            Timer::timer_id run_after(Timer::milliseconds interval, std::function<void()> cb) {
+            Timer::timer_id run_after(Timer::duration interval, std::function<void()> cb) {
                 return run_at(Timer::now() + interval, cb);
             }
-            Timer::timer_id run_after(Timer::milliseconds interval1, Timer::milliseconds interval2, std::function<void()> cb) {
+            Timer::timer_id run_after(Timer::duration interval1, Timer::duration interval2, std::function<void()> cb) {
                 return run_at(Timer::now() + interval1, interval2, cb);
             }
-            Timer::timer_id run_every(Timer::milliseconds interval, std::function<void()> cb) {
+            Timer::timer_id run_every(Timer::duration interval, std::function<void()> cb) {
                 return run_after(interval, interval, cb);
             }
+            // 定时器执行时相对到期时间的延迟分布，可以在任意线程读取
+            TimerWheel::Lateness timer_lateness() const {
+                return timers_.lateness();
+            }
             void cancel_timer(const Timer::timer_id& id) {
-                if(id_to_timers_.count(id)) {
-                    timers_.erase(id_to_timers_[id]);
-                    id_to_timers_.erase(id);
+                if(!is_in_loop_thread()) {
+                    safe_call([this, id] { cancel_timer(id); });
+                    return;
+                }
+                bool cancelled = false;
+                if(id & TimerWheel::REMOTE_FLAG) {
+                    if(auto it = remote_timers_.find(id); it != remote_timers_.end()) {
+                        cancelled = timers_.cancel(it->second);
+                        remote_timers_.erase(it);
+                    }
+                    else {
+                        // 插入任务可能还在队列中(如在loop线程中取消其它线程刚创建的定时器)，记录下来由插入任务丢弃
+                        // 插入任务在返回id之前已经入队，排在下面的检查之前，检查时仍未被取走说明id无效
+                        cancelled_remote_timers_.insert(id);
+                        queue_call([this, id] {
+                            if(cancelled_remote_timers_.erase(id) > 0) {
+                                log_error("cannot find timer:", id);
+                            }
+                        });
+                        return;
+                    }
                 }
                 else {
+                    cancelled = timers_.cancel(id);
+                }
+                if(!cancelled) {
                     log_error("cannot find timer:", id);
                 }
             }
+        public:
+            static constexpr std::size_t SCRATCH_SIZE = 64 * 1024;
+            // 本轮事件处理开始的时间，用于不需要精确时间的场合(如连接的活跃时间)，避免每次读写都获取时间
+            Timer::time_point loop_time() const {
+                return loop_time_;
+            }
+            IdleList& idle_list() {
+                return idle_list_;
+            }
+            // 设置某个阶段的空闲超时时间，0表示不检查
+            // 由一个周期定时器统一检查，周期为最小超时时间的1/4，限制在[10ms, 1s]之间
+            void set_idle_timeout(IdleList::Phase phase, Timer::milliseconds timeout) {
+                if(!is_in_loop_thread()) {
+                    safe_call([this, phase, timeout] { set_idle_timeout(phase, timeout); });
+                    return;
+                }
+                idle_list_.set_timeout(phase, timeout);
+                if(idle_sweep_timer_ != 0) {
+                    cancel_timer(idle_sweep_timer_);
+                    idle_sweep_timer_ = 0;
+                }
+                auto min_timeout = idle_list_.min_timeout();
+                if(min_timeout.count() == 0) {
+                    return;
+                }
+                auto interval = std::clamp(min_timeout / 4, Timer::milliseconds(10), Timer::milliseconds(1000));
+                idle_sweep_timer_ = run_every(interval, [this] {
+                    if(auto n = idle_list_.sweep(Timer::now()); n > 0) {
+                        log_info("close", n, "idle connections");
+                    }
+                });
+            }
+            /*
+             * 忙轮询模式，用于对延迟敏感的loop，需要在loop线程中或者loop开始之前调用
+             * 1.阻塞等待之前先以0超时轮询，最多轮询spin_budget_，期间有事件或任务到达就不进入睡眠
+             *   轮询期间sleeping_为false，其它线程safe_call时不需要写eventfd唤醒
+             * 2.spin_budget_为事件到达间隔滑动平均值的两倍，不超过max_budget
+             *   平均间隔超过max_budget时不再轮询，空闲的loop不会空转
+             * 3.sock_busy_poll_usec大于0时，本loop上新建的连接设置SO_BUSY_POLL
+             * max_budget为0时关闭忙轮询
+             */
+            void set_busy_poll(std::chrono::microseconds max_budget, int sock_busy_poll_usec = 0) {
+                max_spin_budget_ = max_budget;
+                spin_budget_ = max_budget;
+                arrival_gap_ = std::chrono::microseconds(0);
+                sock_busy_poll_ = sock_busy_poll_usec;
+                spin_budget_us_.store(spin_budget_.count(), std::memory_order_relaxed);
+            }
+            int sock_busy_poll() const {
+                return sock_busy_poll_;
+            }
+            struct BusyPollStats
+            {
+                std::size_t spin_hits;      // 轮询期间等到了事件或任务
+                std::size_t spin_misses;    // 轮询了整个预算仍然没有事件，随后进入睡眠
+                std::size_t sleeps;         // 阻塞等待的次数(包括spin_misses和预算为0时)
+                std::chrono::microseconds spin_budget;
+            };
+            // 可以在任意线程读取
+            BusyPollStats busy_poll_stats() const {
+                return {
+                    busy_poll_hits_.load(std::memory_order_relaxed),
+                    busy_poll_misses_.load(std::memory_order_relaxed),
+                    busy_poll_sleeps_.load(std::memory_order_relaxed),
+                    std::chrono::microseconds(spin_budget_us_.load(std::memory_order_relaxed))
+                };
+            }
+            // Service::drain期间为true，上层协议据此不再保持长连接
+            bool draining() const {
+                return draining_;
+            }
+            void set_draining(bool draining) {
+                draining_ = draining;
+            }
+            // 本loop线程的内存池，连接、缓冲区和回调块关闭后回收到这里
+            util::object_pool& pool() {
+                return pool_;
+            }
+        private:
+            /*
+             * 使用timerfd(CLOCK_MONOTONIC，绝对时间)唤醒阻塞的loop，精度不受epoll_wait毫秒超时的限制
+             * 1.每次阻塞之前把timerfd设置为时间轮中最早的到期时间，和上次设置的相同时不需要系统调用
+             * 2.取消定时器之后不重新设置，最多多唤醒一次
+             * 3.创建失败时退回到epoll_wait的毫秒超时
+             */
+            void init_timer_fd() {
+                int fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                if(fd == -1) {
+                    log_error("create timerfd failed:", std::strerror(errno));
+                    return;
+                }
+                timer_socket_ = std::make_shared<TcpSocket>(fd);
+                timer_socket_->tie(poller_);
+                timer_socket_->enable_reading();
+                timer_socket_->set_read_callback([fd] {
+                    std::uint64_t expirations = 0;
+                    int ret = ::read(fd, &expirations, sizeof(expirations));
+                    (void)ret;
+                });
+            }
+            // 有到期的定时器时返回0，timerfd可用时由timerfd唤醒，返回-1
+            int wait_timeout() {
+                if(!timer_socket_) {
+                    return timers_.next_timeout();
+                }
+                auto due = timers_.next_deadline();
+                if(!due) {
+                    return -1;
+                }
+                if(*due <= Timer::now()) {
+                    return 0;
+                }
+                if(*due != armed_deadline_) {
+                    armed_deadline_ = *due;
+                    // steady_clock的起点就是CLOCK_MONOTONIC的起点
+                    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(due->time_since_epoch()).count();
+                    struct itimerspec spec{};
+                    spec.it_value.tv_sec = ns / 1000000000;
+                    spec.it_value.tv_nsec = ns % 1000000000;
+                    ::timerfd_settime(timer_socket_->fd(), TFD_TIMER_ABSTIME, &spec, nullptr);
+                }
+                return -1;
+            }
+
         private:
+            // 最先构造、最后析构，其它成员释放的内存可以放回内存池
+            util::object_pool pool_;
             std::thread::id tid_;
-            std::mutex mutex_;
             std::atomic_bool quit_;
+            std::atomic_bool sleeping_{ false };
             std::shared_ptr<EventPoller> poller_;
             std::shared_ptr<Watcher> watcher_;
             std::shared_ptr<TcpSocket> watch_socket_;
-            std::vector<std::function<void()>> pending_functors_;
-            /* std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_; */
-            std::set<Timer> timers_;
-            std::unordered_map<Timer::timer_id, Timer> id_to_timers_;
+            std::shared_ptr<TcpSocket> timer_socket_;
+            Timer::time_point armed_deadline_;
+            util::mpsc_queue<std::function<void()>> pending_functors_;
+            std::vector<std::function<void()>> running_functors_;
+            std::vector<char> scratch_;
+            TimerWheel timers_;
+            std::atomic<Timer::timer_id> remote_timer_seq_{ 0 };
+            std::unordered_map<Timer::timer_id, Timer::timer_id> remote_timers_;
+            std::unordered_set<Timer::timer_id> cancelled_remote_timers_;
+            Timer::time_point loop_time_;
+            IdleList idle_list_;
+            Timer::timer_id idle_sweep_timer_{ 0 };
+            bool draining_{ false };
+            std::chrono::microseconds max_spin_budget_{ 0 };
+            std::chrono::microseconds spin_budget_{ 0 };
+            std::chrono::microseconds arrival_gap_{ 0 };
+            int sock_busy_poll_{ 0 };
+            std::atomic<std::int64_t> spin_budget_us_{ 0 };
+            std::atomic<std::size_t> busy_poll_hits_{ 0 };
+            std::atomic<std::size_t> busy_poll_misses_{ 0 };
+            std::atomic<std::size_t> busy_poll_sleeps_{ 0 };
+            int ready_events_{ 0 };
+            std::atomic<std::size_t> queue_depth_{ 0 };
+            std::vector<std::function<void()>> exit_funcs_;
     };
 }
 
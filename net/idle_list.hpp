@@ -0,0 +1,157 @@
+#pragma once
+
+#include "timer.hpp"
+#include "../std.hpp"
+#include "../util/noncopyable.hpp"
+
+namespace cortono::net
+{
+    /*
+     * 每个EventLoop一个的空闲连接表，用于关闭长时间没有读写的连接
+     * 1.每个阶段一个按最近活跃时间排序的侵入式双向链表，读写时把节点移到所在链表的尾部，O(1)
+     * 2.各阶段的超时时间可以分别设置，0表示不检查
+     *   PreFirstByte: 建立连接后还没有收到任何数据
+     *   KeepAlive:    一个请求处理完成，等待下一个请求
+     *   MidRequest:   收到了部分请求或者正在收发数据
+     * 3.由EventLoop的周期定时器调用sweep，只需要从每个链表的头部开始检查，遇到没有超时的节点即可停止
+     *
+     * 不是线程安全的，只能在所属EventLoop的线程中使用
+     */
+    class IdleList : private util::noncopyable
+    {
+        public:
+            enum class Phase : std::uint8_t
+            {
+                PreFirstByte,
+                KeepAlive,
+                MidRequest
+            };
+            static constexpr std::size_t PHASE_NUMS = 3;
+
+            class Node
+            {
+                public:
+                    virtual ~Node() = default;
+                    // 超时后由sweep调用，调用前节点已经从链表中移除
+                    virtual void handle_idle() = 0;
+
+                    Phase idle_phase() const {
+                        return phase_;
+                    }
+                    bool idle_linked() const {
+                        return linked_;
+                    }
+                private:
+                    friend class IdleList;
+                    Node* prev_{ nullptr };
+                    Node* next_{ nullptr };
+                    Timer::time_point last_active_;
+                    Phase phase_{ Phase::PreFirstByte };
+                    bool linked_{ false };
+            };
+
+            IdleList() {
+                timeouts_.fill(Timer::milliseconds(0));
+            }
+
+            void set_timeout(Phase phase, Timer::milliseconds timeout) {
+                timeouts_[index(phase)] = timeout;
+            }
+            Timer::milliseconds timeout(Phase phase) const {
+                return timeouts_[index(phase)];
+            }
+            // 最小的非0超时时间，全部为0时返回0
+            Timer::milliseconds min_timeout() const {
+                Timer::milliseconds result{ 0 };
+                for(auto& t : timeouts_) {
+                    if(t.count() > 0 && (result.count() == 0 || t < result)) {
+                        result = t;
+                    }
+                }
+                return result;
+            }
+
+            // 更新活跃时间，节点移到phase对应链表的尾部
+            void touch(Node* node, Phase phase, Timer::time_point now) {
+                if(node->linked_) {
+                    unlink(node);
+                }
+                node->phase_ = phase;
+                node->last_active_ = now;
+                link_back(node);
+            }
+            void touch(Node* node, Timer::time_point now) {
+                touch(node, node->phase_, now);
+            }
+            void remove(Node* node) {
+                if(node->linked_) {
+                    unlink(node);
+                }
+            }
+
+            // 关闭所有超时的节点，返回关闭的数量
+            std::size_t sweep(Timer::time_point now) {
+                std::size_t expired = 0;
+                for(std::size_t i = 0; i < PHASE_NUMS; ++i) {
+                    if(timeouts_[i].count() == 0) {
+                        continue;
+                    }
+                    while(heads_[i] != nullptr && now - heads_[i]->last_active_ >= timeouts_[i]) {
+                        auto node = heads_[i];
+                        unlink(node);
+                        ++expired;
+                        // handle_idle中可能会销毁节点或者修改链表
+                        node->handle_idle();
+                    }
+                }
+                return expired;
+            }
+
+            std::size_t size() const {
+                return size_;
+            }
+
+        private:
+            static std::size_t index(Phase phase) {
+                return static_cast<std::size_t>(phase);
+            }
+            void link_back(Node* node) {
+                auto i = index(node->phase_);
+                node->prev_ = tails_[i];
+                node->next_ = nullptr;
+                if(tails_[i] != nullptr) {
+                    tails_[i]->next_ = node;
+                }
+                else {
+                    heads_[i] = node;
+                }
+                tails_[i] = node;
+                node->linked_ = true;
+                ++size_;
+            }
+            void unlink(Node* node) {
+                auto i = index(node->phase_);
+                if(node->prev_ != nullptr) {
+                    node->prev_->next_ = node->next_;
+                }
+                else {
+                    heads_[i] = node->next_;
+                }
+                if(node->next_ != nullptr) {
+                    node->next_->prev_ = node->prev_;
+                }
+                else {
+                    tails_[i] = node->prev_;
+                }
+                node->prev_ = node->next_ = nullptr;
+                node->linked_ = false;
+                --size_;
+            }
+
+        private:
+            std::array<Node*, PHASE_NUMS> heads_{};
+            std::array<Node*, PHASE_NUMS> tails_{};
+            std::array<Timer::milliseconds, PHASE_NUMS> timeouts_;
+            std::size_t size_{ 0 };
+    };
+}
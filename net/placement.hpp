@@ -0,0 +1,153 @@
+#pragma once
+
+#include "../std.hpp"
+#include "../util/noncopyable.hpp"
+
+namespace cortono::net
+{
+    /*
+     * 新连接在工作loop之间的分配策略
+     * RoundRobin:        轮询，不考虑负载
+     * LeastConnections:  选择当前连接数最少的loop
+     * LeastQueueDepth:   选择上一轮处理的就绪事件和任务数最少的loop，连接数作为次要比较
+     * PowerOfTwoChoices: 随机选两个loop，取连接数较少的一个，深度作为次要比较
+     *                    连接数的计数由loop在接收连接后更新，有一定延迟，随机选择可以避免同一时刻的连接全部分到同一个loop
+     * 同一批连续选择(一次可读事件中accept的所有连接)时传入Batch，见LoopSelector::Batch
+     */
+    enum class Placement
+    {
+        RoundRobin,
+        LeastConnections,
+        LeastQueueDepth,
+        PowerOfTwoChoices
+    };
+
+    // 每个loop的负载快照，由各个loop自己维护的原子变量读出
+    struct LoopLoad
+    {
+        std::size_t connections;
+        std::size_t depth;
+    };
+
+    /*
+     * 根据策略从n个loop中选择一个，可以在任意线程调用
+     * load_of(i)返回第i个loop的负载，只在需要时调用
+     */
+    class LoopSelector : private util::noncopyable
+    {
+        public:
+            explicit LoopSelector(Placement policy = Placement::RoundRobin)
+                : policy_(policy)
+            {  }
+
+            void set_policy(Placement policy) {
+                policy_.store(policy, std::memory_order_relaxed);
+            }
+            Placement policy() const {
+                return policy_.load(std::memory_order_relaxed);
+            }
+
+            /*
+             * 一批连续的选择，只在一个线程中使用，例如Adaptor一次可读事件中accept的所有连接
+             * 负载快照要等目标loop处理完新连接之后才更新，同一批中读到的都是同一份快照
+             * 已经分给某个loop的连接在本地加到它的连接数和深度上，避免这一批连接全部分到快照中最空闲的loop
+             */
+            class Batch
+            {
+                public:
+                    void clear() {
+                        assigned_.clear();
+                    }
+                private:
+                    friend class LoopSelector;
+                    LoopLoad adjust(std::size_t i, LoopLoad load) const {
+                        if(i < assigned_.size()) {
+                            load.connections = saturating_add(load.connections, assigned_[i]);
+                            load.depth = saturating_add(load.depth, assigned_[i]);
+                        }
+                        return load;
+                    }
+                    void assign(std::size_t i) {
+                        if(i >= assigned_.size()) {
+                            assigned_.resize(i + 1, 0);
+                        }
+                        ++assigned_[i];
+                    }
+                    // 还没有启动的loop负载为最大值，不能溢出
+                    static std::size_t saturating_add(std::size_t a, std::size_t b) {
+                        return a > std::numeric_limits<std::size_t>::max() - b ? std::numeric_limits<std::size_t>::max() : a + b;
+                    }
+
+                    std::vector<std::size_t> assigned_;
+            };
+
+            template <typename LoadOf>
+            std::size_t select(std::size_t n, LoadOf&& load_of, Batch& batch) {
+                auto i = select(n, [&load_of, &batch](std::size_t i) {
+                    return batch.adjust(i, load_of(i));
+                });
+                batch.assign(i);
+                return i;
+            }
+
+            template <typename LoadOf>
+            std::size_t select(std::size_t n, LoadOf&& load_of) {
+                if(n <= 1) {
+                    return 0;
+                }
+                // 负载相同时从轮询位置开始比较，避免总是选中第0个
+                auto start = next_.fetch_add(1, std::memory_order_relaxed) % n;
+                switch(policy()) {
+                    case Placement::RoundRobin:
+                        return start;
+                    case Placement::LeastConnections:
+                        return least(start, n, load_of, [](const LoopLoad& a, const LoopLoad& b) {
+                            return a.connections < b.connections;
+                        });
+                    case Placement::LeastQueueDepth:
+                        return least(start, n, load_of, [](const LoopLoad& a, const LoopLoad& b) {
+                            return a.depth < b.depth || (a.depth == b.depth && a.connections < b.connections);
+                        });
+                    case Placement::PowerOfTwoChoices: {
+                        auto a = random() % n;
+                        auto b = random() % (n - 1);
+                        b += b >= a ? 1 : 0;
+                        auto la = load_of(a), lb = load_of(b);
+                        if(lb.connections < la.connections || (lb.connections == la.connections && lb.depth < la.depth)) {
+                            return b;
+                        }
+                        return a;
+                    }
+                }
+                return start;
+            }
+
+        private:
+            template <typename LoadOf, typename Less>
+            static std::size_t least(std::size_t start, std::size_t n, LoadOf& load_of, Less less) {
+                auto best = start;
+                auto best_load = load_of(start);
+                for(std::size_t k = 1; k < n; ++k) {
+                    auto i = (start + k) % n;
+                    auto load = load_of(i);
+                    if(less(load, best_load)) {
+                        best = i;
+                        best_load = load;
+                    }
+                }
+                return best;
+            }
+            // 每个线程一个xorshift，不需要同步
+            static std::uint64_t random() {
+                thread_local std::uint64_t state = std::random_device{}() | 1;
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                return state;
+            }
+
+        private:
+            std::atomic<Placement> policy_;
+            std::atomic<std::size_t> next_{ 0 };
+    };
+}
@@ -10,10 +10,45 @@ namespace cortono::net
     {
 
         public:
-            struct PollerCB
+            /*
+             * epoll_event.data.ptr指向的就绪事件处理者
+             * 1.每个就绪事件只有一次虚函数调用，由处理者自己解析可读、可写、错误位
+             * 2.Connection直接继承Handler，在handle_events中调用自己的成员函数，可以内联
+             * 3.其它套接字(Adaptor、Watcher等)使用PollerCB，通过std::function设置回调
+             */
+            class Handler
+            {
+                public:
+                    virtual ~Handler() = default;
+                    virtual void handle_events(std::uint32_t events) = 0;
+            };
+
+            struct PollerCB : public Handler, public std::enable_shared_from_this<PollerCB>
             {
                 PollerCB() { clear(); }
                 void clear() { read_cb = write_cb = close_cb = nullptr; }
+                // 同时可读可写时两个回调都执行，既不可读也不可写(EPOLLERR/EPOLLHUP)时执行close_cb
+                void handle_events(std::uint32_t events) override {
+                    bool readable = readable_event(events) && read_cb;
+                    bool writeable = writeable_event(events) && write_cb;
+                    if(readable && writeable) {
+                        // read_cb可能销毁套接字，先保证自身在write_cb执行前有效
+                        auto self = shared_from_this();
+                        read_cb();
+                        if(self->write_cb) {
+                            self->write_cb();
+                        }
+                    }
+                    else if(readable) {
+                        read_cb();
+                    }
+                    else if(writeable) {
+                        write_cb();
+                    }
+                    else if(!readable_event(events) && !writeable_event(events) && close_cb) {
+                        close_cb();
+                    }
+                }
                 std::function<void()> read_cb, write_cb, close_cb;
             };
 
@@ -49,7 +84,7 @@ namespace cortono::net
                 util::io::close(epollfd_);
             }
 
-            void update(int fd, uint32_t old_events, uint32_t new_events, std::shared_ptr<PollerCB> poller_cbs) {
+            void update(int fd, uint32_t old_events, uint32_t new_events, Handler* handler) {
                 int epoll_opt = EPOLL_CTL_ADD;
                 if(new_events != NONE_EVENT) {
                     if(old_events != NONE_EVENT)
@@ -63,38 +98,30 @@ namespace cortono::net
                 }
                 struct epoll_event event;
                 event.events = new_events;
-                event.data.ptr = poller_cbs.get();
+                event.data.ptr = handler;
                 ::epoll_ctl(epollfd_, epoll_opt, fd, &event);
             }
 
-            void wait(int timeout = -1)
+            // 返回就绪事件的数量
+            int wait(int timeout = -1)
             {
                 if(event_nums_ > static_cast<int>(events_.size()))
                     events_.resize(event_nums_);
                 int n = ::epoll_wait(epollfd_, &events_[0], events_.size(), timeout);
                 for(int i = 0; i < n; ++i) {
-                    bool io_event = false;
-                    if(readable_event(events_[i].events) && events_[i].data.ptr != nullptr) {
-                        static_cast<PollerCB*>(events_[i].data.ptr)->read_cb();
-                        io_event = true;
-                    }
-                    else if(writeable_event(events_[i].events) && events_[i].data.ptr != nullptr) {
-                        static_cast<PollerCB*>(events_[i].data.ptr)->write_cb();
-                        io_event = true;
-                    }
-                    else if(!io_event && events_[i].data.ptr != nullptr) {
-                        static_cast<PollerCB*>(events_[i].data.ptr)->close_cb();
+                    if(events_[i].data.ptr != nullptr) {
+                        static_cast<Handler*>(events_[i].data.ptr)->handle_events(events_[i].events);
                     }
                 }
+                return n;
             }
 
 
-        private:
-            bool readable_event(uint32_t events) {
+            static bool readable_event(uint32_t events) {
                 return events & READ_EVENT;
             }
 
-            bool writeable_event(uint32_t events) {
+            static bool writeable_event(uint32_t events) {
                 return events & WRITE_EVENT;
             }
 
@@ -0,0 +1,461 @@
+#pragma once
+
+#include "../std.hpp"
+#include "../ip/sockets.hpp"
+#include "../util/util.hpp"
+#include "../util/noncopyable.hpp"
+#include "eventloop.hpp"
+#include "socket.hpp"
+
+namespace cortono::net
+{
+    /*
+     * 进程内共享的DNS缓存，按主机名哈希分片，每个分片一把锁
+     * 1.addresses为空的条目是否定缓存(NXDOMAIN或者没有A记录)
+     * 2.每个分片最多MAX_ENTRIES个条目，满了以后先清理过期条目，仍然满时随便淘汰一个
+     */
+    class DnsCache : private util::noncopyable
+    {
+        public:
+            using Addresses = std::vector<std::string>;
+            static constexpr std::size_t SHARD_NUMS = 16;
+            static constexpr std::size_t MAX_ENTRIES = 4096;
+
+            bool get(const std::string& host, Timer::time_point now, Addresses& addresses) {
+                auto& shard = shard_of(host);
+                std::unique_lock lock{ shard.mutex };
+                auto it = shard.entries.find(host);
+                if(it == shard.entries.end()) {
+                    return false;
+                }
+                if(it->second.expires <= now) {
+                    shard.entries.erase(it);
+                    return false;
+                }
+                addresses = it->second.addresses;
+                return true;
+            }
+            void put(const std::string& host, Addresses addresses, Timer::time_point expires) {
+                auto& shard = shard_of(host);
+                std::unique_lock lock{ shard.mutex };
+                if(shard.entries.size() >= MAX_ENTRIES && !shard.entries.count(host)) {
+                    auto now = Timer::now();
+                    for(auto it = shard.entries.begin(); it != shard.entries.end();) {
+                        it = it->second.expires <= now ? shard.entries.erase(it) : std::next(it);
+                    }
+                    if(shard.entries.size() >= MAX_ENTRIES) {
+                        shard.entries.erase(shard.entries.begin());
+                    }
+                }
+                shard.entries[host] = { std::move(addresses), expires };
+            }
+            void clear() {
+                for(auto& shard : shards_) {
+                    std::unique_lock lock{ shard.mutex };
+                    shard.entries.clear();
+                }
+            }
+
+        private:
+            struct Entry
+            {
+                Addresses addresses;
+                Timer::time_point expires;
+            };
+            struct Shard
+            {
+                std::mutex mutex;
+                std::unordered_map<std::string, Entry> entries;
+            };
+            Shard& shard_of(const std::string& host) {
+                return shards_[std::hash<std::string>{}(host) % SHARD_NUMS];
+            }
+
+            std::array<Shard, SHARD_NUMS> shards_;
+    };
+
+    /*
+     * 基于EventLoop的异步DNS解析，只查询A记录
+     * 1.nameserver、超时时间和重试次数从/etc/resolv.conf读取，也可以通过set_options指定
+     *   IP地址和/etc/hosts中的名字直接返回，不支持search域
+     * 2.结果按照应答中的TTL写入DnsCache，NXDOMAIN和没有A记录的应答按照SOA中的TTL写入否定缓存
+     * 3.同一个loop中同一个名字同时只有一个查询，其它请求加入等待列表
+     * 4.超时或者SERVFAIL时换下一个nameserver重试，全部失败时回调收到空列表，失败不写入缓存
+     *
+     * 每个loop线程一个，通过Resolver::of(loop)获取，只能在loop线程中使用
+     * 命中缓存时在resolve中直接回调
+     */
+    class Resolver : public EventPoller::Handler, private util::noncopyable
+    {
+        public:
+            using Addresses = DnsCache::Addresses;
+            using ResolveCallBack = std::function<void(const Addresses&)>;
+
+            struct Options
+            {
+                std::vector<struct sockaddr_in> nameservers;
+                Timer::milliseconds timeout{ 2000 };
+                int attempts{ 2 };
+                std::chrono::seconds min_ttl{ 1 };
+                std::chrono::seconds max_ttl{ 300 };
+                std::chrono::seconds negative_ttl{ 30 };
+            };
+
+            static Resolver& of(EventLoop* loop) {
+                if(!current_ || current_->loop_ != loop) {
+                    current_.reset(new Resolver(loop));
+                }
+                return *current_;
+            }
+            // 只对之后创建的Resolver生效，需要在loop启动之前调用
+            static void set_options(Options options) {
+                std::unique_lock lock{ options_mutex() };
+                global_options() = std::move(options);
+            }
+            static Options options() {
+                std::unique_lock lock{ options_mutex() };
+                return global_options();
+            }
+            static DnsCache& cache() {
+                static DnsCache inst;
+                return inst;
+            }
+
+            void resolve(std::string host, ResolveCallBack cb) {
+                host = normalize(std::move(host));
+                struct in_addr addr;
+                if(::inet_pton(AF_INET, host.data(), &addr) == 1) {
+                    cb({ host });
+                    return;
+                }
+                if(auto it = hosts().find(host); it != hosts().end()) {
+                    cb(it->second);
+                    return;
+                }
+                Addresses addresses;
+                if(cache().get(host, loop_->loop_time(), addresses)) {
+                    cb(addresses);
+                    return;
+                }
+                if(auto it = inflight_.find(host); it != inflight_.end()) {
+                    it->second.callbacks.emplace_back(std::move(cb));
+                    return;
+                }
+                if(options_.nameservers.empty() || socket_ == nullptr || !valid_name(host)) {
+                    log_error("cannot resolve", host);
+                    cb({});
+                    return;
+                }
+                auto& query = inflight_[host];
+                query.callbacks.emplace_back(std::move(cb));
+                send_query(host, query);
+            }
+
+            void handle_events(std::uint32_t events) override {
+                if(!EventPoller::readable_event(events)) {
+                    return;
+                }
+                unsigned char buffer[4096];
+                while(true) {
+                    struct sockaddr_in from;
+                    socklen_t len = sizeof(from);
+                    auto n = ::recvfrom(socket_->fd(), buffer, sizeof(buffer), 0, reinterpret_cast<struct sockaddr*>(&from), &len);
+                    if(n < 0) {
+                        break;
+                    }
+                    if(from_nameserver(from)) {
+                        handle_response(buffer, static_cast<std::size_t>(n));
+                    }
+                }
+            }
+
+        private:
+            struct Query
+            {
+                std::uint16_t id{ 0 };
+                std::size_t server{ 0 };
+                int tries{ 0 };
+                Timer::timer_id timer{ 0 };
+                std::vector<ResolveCallBack> callbacks;
+            };
+
+            explicit Resolver(EventLoop* loop)
+                : loop_(loop),
+                  options_(options()),
+                  rng_(std::random_device{}())
+            {
+                int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if(fd == -1) {
+                    log_error("fail to create dns socket:", std::strerror(errno));
+                    return;
+                }
+                socket_ = std::make_unique<TcpSocket>(fd);
+                socket_->tie(loop_->poller());
+                socket_->set_handler(this);
+                socket_->enable_reading();
+            }
+
+            static std::string normalize(std::string host) {
+                while(!host.empty() && host.back() == '.') {
+                    host.pop_back();
+                }
+                return util::to_lower(host);
+            }
+            static bool valid_name(const std::string& host) {
+                if(host.empty() || host.size() > 253) {
+                    return false;
+                }
+                for(auto label : util::split(host, '.')) {
+                    if(label.empty() || label.size() > 63) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            void send_query(const std::string& host, Query& query) {
+                do {
+                    query.id = static_cast<std::uint16_t>(rng_());
+                } while(ids_.count(query.id));
+                ids_[query.id] = host;
+                auto packet = build_query(query.id, host);
+                auto& server = options_.nameservers[query.server % options_.nameservers.size()];
+                if(::sendto(socket_->fd(), packet.data(), packet.size(), 0,
+                            reinterpret_cast<const struct sockaddr*>(&server), sizeof(server)) < 0) {
+                    log_error("fail to send dns query:", host, std::strerror(errno));
+                }
+                // Resolver随线程退出析构时loop可能已经不存在，不取消定时器，通过alive_判断是否还有效
+                query.timer = loop_->run_after(options_.timeout, [this, alive = std::weak_ptr<char>(alive_), host] {
+                    if(alive.expired()) {
+                        return;
+                    }
+                    if(auto it = inflight_.find(host); it != inflight_.end()) {
+                        log_info("dns query timeout:", host);
+                        retry(host, it->second);
+                    }
+                });
+            }
+
+            // 换下一个nameserver重试，次数用完时回调失败
+            void retry(const std::string& host, Query& query) {
+                ids_.erase(query.id);
+                if(++query.tries < options_.attempts * static_cast<int>(options_.nameservers.size())) {
+                    ++query.server;
+                    send_query(host, query);
+                }
+                else {
+                    finish(host, {});
+                }
+            }
+
+            void finish(const std::string& host, const Addresses& addresses) {
+                auto it = inflight_.find(host);
+                auto callbacks = std::move(it->second.callbacks);
+                inflight_.erase(it);
+                // 回调中可能再次调用resolve
+                for(auto& cb : callbacks) {
+                    cb(addresses);
+                }
+            }
+
+            bool from_nameserver(const struct sockaddr_in& from) const {
+                for(auto& server : options_.nameservers) {
+                    if(server.sin_addr.s_addr == from.sin_addr.s_addr && server.sin_port == from.sin_port) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void handle_response(const unsigned char* p, std::size_t n) {
+                if(n < 12 || !(p[2] & 0x80)) {
+                    return;
+                }
+                std::uint16_t id = (p[0] << 8) | p[1];
+                auto id_it = ids_.find(id);
+                if(id_it == ids_.end()) {
+                    return;
+                }
+                auto host = id_it->second;
+                auto rcode = p[3] & 0x0f;
+                std::size_t qd = (p[4] << 8) | p[5], an = (p[6] << 8) | p[7], ns = (p[8] << 8) | p[9];
+                std::size_t pos = 12;
+                // 应答中的问题必须和查询的名字相同，防止伪造的应答
+                std::string qname;
+                if(qd != 1 || !read_name(p, n, pos, qname) || normalize(qname) != host || (pos += 4) > n) {
+                    return;
+                }
+                auto& query = inflight_[host];
+                loop_->cancel_timer(query.timer);
+                if(rcode != 0 && rcode != 3) {
+                    log_info("dns server failure:", host, "rcode:", rcode);
+                    retry(host, query);
+                    return;
+                }
+                ids_.erase(id_it);
+
+                Addresses addresses;
+                std::uint32_t ttl = std::numeric_limits<std::uint32_t>::max();
+                auto negative_ttl = static_cast<std::uint32_t>(options_.negative_ttl.count());
+                for(std::size_t i = 0; i < an + ns; ++i) {
+                    std::string name;
+                    if(!read_name(p, n, pos, name) || pos + 10 > n) {
+                        break;
+                    }
+                    std::uint16_t type = (p[pos] << 8) | p[pos + 1];
+                    std::uint32_t record_ttl = (static_cast<std::uint32_t>(p[pos + 4]) << 24) | (p[pos + 5] << 16) | (p[pos + 6] << 8) | p[pos + 7];
+                    std::uint16_t rdlen = (p[pos + 8] << 8) | p[pos + 9];
+                    pos += 10;
+                    if(pos + rdlen > n) {
+                        break;
+                    }
+                    if(i < an && type == 1 && rdlen == 4) {
+                        char ip[INET_ADDRSTRLEN];
+                        ::inet_ntop(AF_INET, p + pos, ip, sizeof(ip));
+                        addresses.emplace_back(ip);
+                        ttl = std::min(ttl, record_ttl);
+                    }
+                    else if(i >= an && type == 6 && rdlen >= 4) {
+                        // 否定应答的TTL为SOA记录的TTL和其中minimum字段的较小值
+                        auto m = p + pos + rdlen - 4;
+                        std::uint32_t minimum = (static_cast<std::uint32_t>(m[0]) << 24) | (m[1] << 16) | (m[2] << 8) | m[3];
+                        negative_ttl = std::min({ negative_ttl, record_ttl, minimum });
+                    }
+                    pos += rdlen;
+                }
+                std::chrono::seconds expires{ addresses.empty() ? negative_ttl : ttl };
+                expires = std::clamp(expires, options_.min_ttl, options_.max_ttl);
+                cache().put(host, addresses, loop_->loop_time() + expires);
+                finish(host, addresses);
+            }
+
+            static std::string build_query(std::uint16_t id, const std::string& host) {
+                std::string packet(12, '\0');
+                packet[0] = static_cast<char>(id >> 8);
+                packet[1] = static_cast<char>(id & 0xff);
+                packet[2] = 0x01;    // RD
+                packet[5] = 0x01;    // QDCOUNT
+                for(auto label : util::split(host, '.')) {
+                    packet.push_back(static_cast<char>(label.size()));
+                    packet.append(label.data(), label.size());
+                }
+                packet.push_back('\0');
+                packet.append("\x00\x01\x00\x01", 4);    // QTYPE=A, QCLASS=IN
+                return packet;
+            }
+
+            // 读取可能经过压缩的名字，pos移动到名字之后
+            static bool read_name(const unsigned char* p, std::size_t n, std::size_t& pos, std::string& name) {
+                auto cur = pos;
+                bool jumped = false;
+                for(int jumps = 0; jumps < 64;) {
+                    if(cur >= n) {
+                        return false;
+                    }
+                    auto len = p[cur];
+                    if((len & 0xc0) == 0xc0) {
+                        if(cur + 1 >= n) {
+                            return false;
+                        }
+                        if(!jumped) {
+                            pos = cur + 2;
+                        }
+                        jumped = true;
+                        cur = ((len & 0x3f) << 8) | p[cur + 1];
+                        ++jumps;
+                        continue;
+                    }
+                    if(len == 0) {
+                        if(!jumped) {
+                            pos = cur + 1;
+                        }
+                        return true;
+                    }
+                    if(cur + 1 + len > n) {
+                        return false;
+                    }
+                    if(!name.empty()) {
+                        name.push_back('.');
+                    }
+                    name.append(reinterpret_cast<const char*>(p + cur + 1), len);
+                    cur += 1 + len;
+                }
+                return false;
+            }
+
+            static std::unordered_map<std::string, Addresses>& hosts() {
+                static std::unordered_map<std::string, Addresses> inst = load_hosts("/etc/hosts");
+                return inst;
+            }
+            static std::unordered_map<std::string, Addresses> load_hosts(const std::string& filename) {
+                std::unordered_map<std::string, Addresses> results;
+                std::ifstream fin{ filename };
+                std::string line;
+                while(std::getline(fin, line)) {
+                    std::istringstream iss{ line.substr(0, line.find('#')) };
+                    std::string ip, name;
+                    struct in_addr addr;
+                    if(!(iss >> ip) || ::inet_pton(AF_INET, ip.data(), &addr) != 1) {
+                        continue;
+                    }
+                    while(iss >> name) {
+                        results[normalize(name)].emplace_back(ip);
+                    }
+                }
+                return results;
+            }
+            static Options load_resolv_conf(const std::string& filename) {
+                Options options;
+                std::ifstream fin{ filename };
+                std::string line;
+                while(std::getline(fin, line)) {
+                    std::istringstream iss{ line };
+                    std::string key, value;
+                    iss >> key;
+                    if(key == "nameserver" && iss >> value) {
+                        struct sockaddr_in addr;
+                        std::memset(&addr, 0, sizeof(addr));
+                        addr.sin_family = AF_INET;
+                        addr.sin_port = htons(53);
+                        if(::inet_pton(AF_INET, value.data(), &addr.sin_addr) == 1) {
+                            options.nameservers.push_back(addr);
+                        }
+                    }
+                    else if(key == "options") {
+                        while(iss >> value) {
+                            if(value.compare(0, 8, "timeout:") == 0) {
+                                options.timeout = std::chrono::seconds(std::max(1, std::atoi(value.data() + 8)));
+                            }
+                            else if(value.compare(0, 9, "attempts:") == 0) {
+                                options.attempts = std::max(1, std::atoi(value.data() + 9));
+                            }
+                        }
+                    }
+                }
+                if(options.nameservers.empty()) {
+                    auto addr = ip::address::to_sockaddr("127.0.0.1", 53);
+                    options.nameservers.push_back(*reinterpret_cast<struct sockaddr_in*>(&addr));
+                }
+                return options;
+            }
+            static std::mutex& options_mutex() {
+                static std::mutex inst;
+                return inst;
+            }
+            static Options& global_options() {
+                static Options inst = load_resolv_conf("/etc/resolv.conf");
+                return inst;
+            }
+
+        private:
+            inline static thread_local std::unique_ptr<Resolver> current_;
+
+            EventLoop* loop_;
+            Options options_;
+            std::mt19937 rng_;
+            std::shared_ptr<char> alive_{ std::make_shared<char>() };
+            std::unique_ptr<TcpSocket> socket_;
+            std::unordered_map<std::string, Query> inflight_;
+            std::unordered_map<std::uint16_t, std::string> ids_;
+    };
+}
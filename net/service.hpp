@@ -2,8 +2,9 @@
 
 #include "../std.hpp"
 #include "../util/noncopyable.hpp"
-#include "../util/threadpool.hpp"
+#include "../util/affinity.hpp"
 #include "adaptor.hpp"
+#include "placement.hpp"
 #include "ssl_adaptor.hpp"
 
 namespace cortono::net
@@ -20,43 +21,29 @@ namespace cortono::net
             typedef typename Connection::MessageCallBack  MessageCallBack;
             typedef typename Connection::ErrorCallBack    ErrorCallBack;
             typedef typename Connection::CloseCallBack    CloseCallBack;
+        private:
+            // 每个loop一个连接表，只在所属loop线程中访问，接收和关闭连接都不需要加锁
+            struct Shard
+            {
+                std::atomic<EventLoop*> loop{ nullptr };
+                std::unordered_map<std::uint64_t, typename Connection::Pointer> connections;
+                std::atomic<std::size_t> count{ 0 };
+                // reuseport模式下工作线程自己的监听套接字
+                Adaptor* acceptor{ nullptr };
+            };
 
+        public:
             Service(EventLoop* loop, std::string_view ip, unsigned short port)
                 : loop_(loop),
-                  acceptor_(loop, ip, port)
+                  ip_(ip),
+                  port_(port),
+                  acceptor_(loop, ip, port),
+                  shards_(std::make_unique<Shard[]>(1)),
+                  shard_nums_(1)
             {
-                // 由于Connection类型不确定，只有Adaptor内部知道如何创建Connection对象
-                // 所以代替将参数传给Service，改为在Adaptor内部构造后返回给Service
-                acceptor_.on_connection(
-                    // Adaptor需要知道选择哪个EventLoop
-                    [this]{
-                        return eventloops_.empty()
-                            ? loop_
-                            : eventloops_[(++loop_idx_) % eventloops_.size()];
-                    },
-                    // 建立连接后的回调，这里传入的是Connection::Pointer而非构造Connection的参数
-                    [this](auto&& new_conn_ptr) { 
-                        // called in new_conn_ptr->loop() thread
-                        new_conn_ptr->set_conn_state(Connection::ConnState::Connected);
-                        new_conn_ptr->on_read([this](const auto& c) {
-                            if(msg_cb_) { msg_cb_(c); }
-                        });
-                        new_conn_ptr->on_error([this](const auto& c) {
-                            if(error_cb_) { error_cb_(c); }
-                        });
-                        new_conn_ptr->on_close([this](const auto& c) {
-                            if(close_cb_) { close_cb_(c); }
-                            remove_connection(c);
-                        });
-                        {
-                            std::unique_lock lock{ mutex_ };
-                            connections_[new_conn_ptr->name()] = new_conn_ptr;
-                        }
-                        if(conn_cb_) {
-                            conn_cb_(new_conn_ptr);
-                        }
-                    }
-                );
+                shards_[0].loop.store(loop_, std::memory_order_release);
+                // Adaptor需要知道选择哪个EventLoop
+                init_acceptor(acceptor_, [this](LoopSelector::Batch& batch) { return acquire_eventloop(&batch); });
             }
 
             ~Service() {
@@ -76,10 +63,93 @@ namespace cortono::net
             void on_error(ErrorCallBack cb) {
                 error_cb_ = std::move(cb);
             }
-            EventLoop* acquire_eventloop() {
-                std::unique_lock lock{ mutex_ };
-                return eventloops_.size() ? eventloops_[(++loop_idx_) % eventloops_.size()]
-                                          : loop_;
+            // 每个工作线程的EventLoop各自持有一个绑定同一端口的SO_REUSEPORT监听套接字
+            // 1.由内核在多个监听套接字之间分配新连接，不再由主loop接收后跨线程转交
+            // 2.cpu_steering为true时挂载SO_ATTACH_REUSEPORT_CBPF程序，按照处理软中断的CPU选择监听套接字
+            //   内核按照套接字加入组的顺序编号，只有工作线程绑定了CPU时这种分配才有意义
+            // 需要在start之前调用
+            void enable_reuseport(bool cpu_steering = false) {
+                reuseport_ = true;
+                cpu_steering_ = cpu_steering;
+            }
+            // 工作线程的CPU绑定方式，cpus只在cpu_list模式下使用，需要在start之前调用
+            // 绑定后loop在工作线程中构造，内存池和缓冲区都分配在线程所在的NUMA节点上
+            // reuseport模式下绑定到单个CPU的loop会给自己的监听套接字设置SO_INCOMING_CPU
+            void set_affinity(util::affinity_mode mode, std::vector<int> cpus = {}) {
+                affinity_mode_ = mode;
+                affinity_cpus_ = std::move(cpus);
+            }
+            // 在每个连接所属的loop线程中执行cb
+            void for_each_connection(std::function<void(const typename Connection::Pointer&)> cb) {
+                auto shared_cb = std::make_shared<decltype(cb)>(std::move(cb));
+                for_each_shard([shared_cb](Shard& shard) {
+                    for(auto& [id, conn] : shard.connections) {
+                        (*shared_cb)(conn);
+                    }
+                });
+            }
+            // 所有连接共享同一份数据
+            void broadcast(std::string msg) {
+                Slice slice(std::move(msg));
+                for_each_shard([slice](Shard& shard) {
+                    for(auto& [id, conn] : shard.connections) {
+                        conn->send(std::vector<Slice>{ slice });
+                    }
+                });
+            }
+            // 各个loop的计数之和，不加锁，只是一个近似的快照
+            std::size_t connection_count() const {
+                std::size_t count = 0;
+                for(std::size_t i = 0; i < shard_nums_; ++i) {
+                    count += shards_[i].count.load(std::memory_order_relaxed);
+                }
+                return count;
+            }
+            // 每个loop的空闲超时时间，需要在start之前调用，之后调用只对已经启动的loop生效
+            void set_idle_timeout(IdleList::Phase phase, Timer::milliseconds timeout) {
+                idle_timeouts_[static_cast<std::size_t>(phase)] = timeout;
+                for(std::size_t i = 0; i < shard_nums_; ++i) {
+                    if(auto loop = shards_[i].loop.load(std::memory_order_acquire); loop) {
+                        loop->set_idle_timeout(phase, timeout);
+                    }
+                }
+            }
+            // 每个loop的忙轮询参数(见EventLoop::set_busy_poll)，工作loop启动时设置
+            // 已经启动的loop在各自的线程中修改，max_budget为0时关闭
+            void set_busy_poll(std::chrono::microseconds max_budget, int sock_busy_poll_usec = 0) {
+                busy_poll_budget_ = max_budget;
+                sock_busy_poll_usec_ = sock_busy_poll_usec;
+                for(std::size_t i = 0; i < shard_nums_; ++i) {
+                    if(auto loop = shards_[i].loop.load(std::memory_order_acquire); loop) {
+                        loop->safe_call([loop, max_budget, sock_busy_poll_usec] {
+                            loop->set_busy_poll(max_budget, sock_busy_poll_usec);
+                        });
+                    }
+                }
+            }
+            // 新连接在工作loop之间的分配策略，默认轮询，可以在任意时刻修改
+            void set_placement(Placement policy) {
+                selector_.set_policy(policy);
+            }
+            // 按照分配策略选择一个工作loop，没有工作loop时返回主loop，可以在任意线程调用
+            // batch不为空时属于同一批选择(见LoopSelector::Batch)，只能在一个线程中使用
+            EventLoop* acquire_eventloop(LoopSelector::Batch* batch = nullptr) {
+                if(shard_nums_ <= 1) {
+                    return loop_;
+                }
+                auto load_of = [this](std::size_t i) {
+                    auto& shard = shards_[i + 1];
+                    auto loop = shard.loop.load(std::memory_order_acquire);
+                    // 还没有启动的loop不参与比较
+                    if(loop == nullptr) {
+                        constexpr auto max = std::numeric_limits<std::size_t>::max();
+                        return LoopLoad{ max, max };
+                    }
+                    return LoopLoad{ shard.count.load(std::memory_order_relaxed), loop->queue_depth() };
+                };
+                auto i = batch ? selector_.select(shard_nums_ - 1, load_of, *batch) : selector_.select(shard_nums_ - 1, load_of);
+                auto loop = shards_[i + 1].loop.load(std::memory_order_acquire);
+                return loop ? loop : loop_;
             }
         public:
             void start(int thread_nums = std::thread::hardware_concurrency()) {
@@ -91,55 +161,242 @@ namespace cortono::net
                 ip::tcp::ssl::init_ssl();
                 ip::tcp::ssl::load_certificate(CA_CERT_FILE, SERVER_CERT_FILE, SERVER_KEY_FILE);
 #endif
+                // 第0个分片属于主loop，工作线程启动后填入自己的loop，此时还没有连接
+                shard_nums_ = thread_nums + 1;
+                shards_ = std::make_unique<Shard[]>(shard_nums_);
+                shards_[0].loop.store(loop_, std::memory_order_release);
+                auto cpu_sets = util::cpu_affinity::plan(affinity_mode_, affinity_cpus_);
+                // 每个工作loop独占一个线程，不和计算任务共用线程池
                 for(int i = 0; i < thread_nums; ++i) {
-                    // FIXME: thread_nums应为线程池的大小，应该传给instance函数
-                    util::threadpool::instance().async([this] {
+                    auto cpus = cpu_sets.empty() ? std::vector<int>{} : cpu_sets[i % cpu_sets.size()];
+                    loop_threads_.emplace_back([this, i, cpus] {
+                        util::cpu_affinity::pin_current_thread(cpus);
                         EventLoop loop;
-                        {
-                            std::unique_lock lock{ mutex_ };
-                            eventloops_.emplace_back(&loop);
+                        shards_[i + 1].loop.store(&loop, std::memory_order_release);
+                        for(std::size_t phase = 0; phase < IdleList::PHASE_NUMS; ++phase) {
+                            if(idle_timeouts_[phase].count() > 0) {
+                                loop.set_idle_timeout(static_cast<IdleList::Phase>(phase), idle_timeouts_[phase]);
+                            }
+                        }
+                        if(busy_poll_budget_.count() > 0) {
+                            loop.set_busy_poll(busy_poll_budget_, sock_busy_poll_usec_);
+                        }
+                        std::unique_ptr<Adaptor> acceptor;
+                        if(reuseport_) {
+                            // 新连接直接留在接收它的loop中
+                            acceptor = std::make_unique<Adaptor>(&loop, ip_, port_);
+                            shards_[i + 1].acceptor = acceptor.get();
+                            init_acceptor(*acceptor, [&loop](LoopSelector::Batch&) { return &loop; });
+                            acceptor->start();
+                            if(cpu_steering_) {
+                                acceptor->attach_cpu_steering();
+                            }
+                            if(cpus.size() == 1) {
+                                acceptor->set_incoming_cpu(cpus.front());
+                            }
                         }
                         loop.loop();
+                        shards_[i + 1].acceptor = nullptr;
+                        // 退出之前已经排队的任务(如停止监听时接收的一批连接)先全部执行，再关闭剩余的连接
+                        while(loop.handle_pending_func() > 0) {
+                        }
+                        close_remaining(shards_[i + 1]);
+                        // 释放关闭时延长生命周期的引用，连接在loop析构之前销毁
+                        while(loop.handle_pending_func() > 0) {
+                        }
+                        // loop在线程栈上，退出后其它线程不能再通过分片访问
+                        shards_[i + 1].loop.store(nullptr, std::memory_order_release);
                     });
                 }
-                util::threadpool::instance().start(thread_nums);
             }
             void start_acceptor() {
-                acceptor_.start();
+                // reuseport模式下主loop的监听套接字只占用端口，不调用listen，不会分到连接
+                if(!reuseport_) {
+                    acceptor_.start();
+                }
+            }
+            /*
+             * 平滑退出，用于滚动重启
+             * 1.所有监听套接字停止监听，不再接收新连接
+             * 2.各个loop进入draining状态，没有请求在处理的连接(PreFirstByte、KeepAlive阶段)立即关闭
+             *   正在处理的请求正常完成，HTTP在响应中返回Connection: close并在发送完成后关闭
+             * 3.主loop每隔100ms报告剩余的连接数，全部关闭后调用stop
+             * 4.到达deadline时强制关闭剩余的连接，然后调用stop
+             */
+            void drain(Timer::time_point deadline, std::function<void(std::size_t)> on_progress = nullptr) {
+                loop_->safe_call([this] { acceptor_.stop(); });
+                for_each_shard([](Shard& shard) {
+                    shard.loop.load(std::memory_order_relaxed)->set_draining(true);
+                    if(shard.acceptor) {
+                        shard.acceptor->stop();
+                    }
+                    std::vector<typename Connection::Pointer> idle;
+                    for(auto& [id, conn] : shard.connections) {
+                        if(conn->idle_phase() != IdleList::Phase::MidRequest) {
+                            idle.push_back(conn);
+                        }
+                    }
+                    for(auto& conn : idle) {
+                        conn->close();
+                    }
+                });
+                log_info("service draining, connections:", connection_count());
+                // 定时器在主loop线程中创建，id写入之后定时器才会执行，不会和读取id的回调竞争
+                loop_->safe_call([this, deadline, on_progress = std::move(on_progress)] {
+                    auto timer = std::make_shared<Timer::timer_id>(0);
+                    *timer = loop_->run_every(Timer::milliseconds(100), [this, deadline, timer, on_progress] {
+                        auto remaining = connection_count();
+                        log_info("drain progress, remaining connections:", remaining);
+                        if(on_progress) {
+                            on_progress(remaining);
+                        }
+                        if(remaining != 0 && Timer::now() < deadline) {
+                            return;
+                        }
+                        loop_->cancel_timer(*timer);
+                        if(remaining != 0) {
+                            log_info("drain deadline reached, force close", remaining, "connections");
+                            for_each_shard([](Shard& shard) {
+                                for(auto it = shard.connections.begin(); it != shard.connections.end();) {
+                                    (it++)->second->force_close();
+                                }
+                            });
+                        }
+                        stop();
+                    });
+                });
             }
             void stop() {
-                for(auto it = connections_.begin(); it != connections_.end();) {
-                    (it++)->second->close();
+                stop_acceptors();
+                // 连接只能在所属的loop线程中关闭，退出请求排在关闭任务之后，保证关闭先执行
+                for_each_shard([](Shard& shard) {
+                    for(auto it = shard.connections.begin(); it != shard.connections.end();) {
+                        (it++)->second->close();
+                    }
+                });
+                log_info("connection close queued, start quit eventloops");
+                for(std::size_t i = 1; i < shard_nums_; ++i) {
+                    if(auto loop = shards_[i].loop.load(std::memory_order_acquire); loop) {
+                        loop->safe_call([loop] { loop->quit(); });
+                    }
                 }
-                log_info("connection close done, start quit eventloops");
-                for(auto& loop : eventloops_) {
-                    loop->quit();
+                log_info("eventloops quit queued, start join loop threads");
+                for(auto& th : loop_threads_) {
+                    th.join();
                 }
-                log_info("eventloops quit done, start close threadpool");
-                util::threadpool::instance().quit();
-                log_info("threadpool close done, start quit main loop");
-                loop_->quit();
+                loop_threads_.clear();
+                log_info("loop threads join done, start quit main loop");
+                loop_->safe_call([this] {
+                    close_remaining(shards_[0]);
+                    loop_->quit();
+                });
                 log_info("main loop quit done, service quit done");
 
                 is_quit_ = true;
             }
         private:
-            void remove_connection(const typename Connection::Pointer& conn) {
-                std::unique_lock lock { mutex_ };
-                connections_.erase(conn->name());
+            // 停止所有监听套接字，停止时接收的最后一批连接排在之后的关闭任务之前
+            // 主loop的监听套接字会把连接分配给工作loop，需要等它停止之后才能让工作loop退出
+            void stop_acceptors() {
+                if(loop_->is_in_loop_thread()) {
+                    acceptor_.stop();
+                }
+                else {
+                    std::promise<void> stopped;
+                    loop_->safe_call([this, &stopped] {
+                        acceptor_.stop();
+                        stopped.set_value();
+                    });
+                    stopped.get_future().wait();
+                }
+                for_each_shard([](Shard& shard) {
+                    if(shard.acceptor) {
+                        shard.acceptor->stop();
+                    }
+                });
+            }
+            void init_acceptor(Adaptor& acceptor, typename Adaptor::LoopProducer producer) {
+                // 由于Connection类型不确定，只有Adaptor内部知道如何创建Connection对象
+                // 所以代替将参数传给Service，改为在Adaptor内部构造后返回给Service
+                acceptor.on_connection(
+                    std::move(producer),
+                    // 建立连接后的回调，这里传入的是Connection::Pointer而非构造Connection的参数
+                    [this](auto&& new_conn_ptr) { 
+                        // called in new_conn_ptr->loop() thread
+                        auto shard = shard_of(new_conn_ptr->loop());
+                        new_conn_ptr->set_conn_state(Connection::ConnState::Connected);
+                        new_conn_ptr->on_read([this](const auto& c) {
+                            if(msg_cb_) { msg_cb_(c); }
+                        });
+                        new_conn_ptr->on_error([this](const auto& c) {
+                            if(error_cb_) { error_cb_(c); }
+                        });
+                        new_conn_ptr->on_close([this, shard](const auto& c) {
+                            if(close_cb_) { close_cb_(c); }
+                            remove_connection(shard, c);
+                        });
+                        shard->connections.emplace(new_conn_ptr->id(), new_conn_ptr);
+                        shard->count.fetch_add(1, std::memory_order_relaxed);
+                        if(conn_cb_) {
+                            conn_cb_(new_conn_ptr);
+                        }
+                    }
+                );
+            }
+            // loop退出之后发送队列不会再减少，还在等待发送完成(WaitClosed)的连接直接关闭
+            // 必须在所属loop线程中、loop析构之前调用，连接在析构之前从空闲表中移除
+            void close_remaining(Shard& shard) {
+                for(auto it = shard.connections.begin(); it != shard.connections.end();) {
+                    (it++)->second->force_close();
+                }
+                shard.connections.clear();
+                shard.count.store(0, std::memory_order_relaxed);
+            }
+            void remove_connection(Shard* shard, const typename Connection::Pointer& conn) {
+                if(shard->connections.erase(conn->id())) {
+                    shard->count.fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+            // 分片数量等于loop数量，新连接和关闭时各查找一次，线性扫描即可
+            Shard* shard_of(EventLoop* loop) {
+                for(std::size_t i = 0; i < shard_nums_; ++i) {
+                    if(shards_[i].loop.load(std::memory_order_acquire) == loop) {
+                        return &shards_[i];
+                    }
+                }
+                log_fatal("cannot find connection shard for eventloop");
+                return nullptr;
+            }
+            template <typename F>
+            void for_each_shard(F f) {
+                for(std::size_t i = 0; i < shard_nums_; ++i) {
+                    auto shard = &shards_[i];
+                    if(auto loop = shard->loop.load(std::memory_order_acquire); loop) {
+                        loop->safe_call([shard, f] { f(*shard); });
+                    }
+                }
             }
         private:
             EventLoop *loop_{ nullptr };
+            std::string ip_;
+            unsigned short port_;
             Adaptor acceptor_;
-            int loop_idx_{ -1 };
-            std::mutex mutex_;
-            std::vector<EventLoop*> eventloops_;
-            std::unordered_map<std::string, typename Connection::Pointer> connections_;
+            LoopSelector selector_;
+            std::vector<std::thread> loop_threads_;
+            std::unique_ptr<Shard[]> shards_;
+            std::size_t shard_nums_;
             ConnCallBack conn_cb_{ nullptr };
             MessageCallBack msg_cb_{ nullptr };
             ErrorCallBack error_cb_{ nullptr };
             CloseCallBack close_cb_{ nullptr };
 
+            std::array<Timer::milliseconds, IdleList::PHASE_NUMS> idle_timeouts_{};
+            std::chrono::microseconds busy_poll_budget_{ 0 };
+            int sock_busy_poll_usec_{ 0 };
+            util::affinity_mode affinity_mode_{ util::affinity_mode::none };
+            std::vector<int> affinity_cpus_;
+            bool reuseport_{ false };
+            bool cpu_steering_{ false };
             bool is_quit_{ false };
     };
 
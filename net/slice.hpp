@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../std.hpp"
+
+namespace cortono::net
+{
+    /*
+     * 引用计数的只读数据片段，用于Connection的分散/聚集发送
+     * 1.多个连接可以共享同一份静态数据(如文件内容、固定的响应头)，发送时不需要拷贝
+     * 2.没有发送完的部分只需要移动offset，仍然引用原来的数据
+     */
+    class Slice
+    {
+        public:
+            using data_t = std::shared_ptr<const std::string>;
+
+            Slice() = default;
+            Slice(std::string&& s)
+                : Slice(std::make_shared<const std::string>(std::move(s)))
+            {  }
+            Slice(data_t data)
+                : Slice(data, 0, data ? data->size() : 0)
+            {  }
+            Slice(data_t data, std::size_t offset, std::size_t length)
+                : data_(std::move(data)),
+                  offset_(offset),
+                  length_(length)
+            {  }
+
+            const char* data() const {
+                return data_->data() + offset_;
+            }
+            std::size_t size() const {
+                return length_;
+            }
+            bool empty() const {
+                return length_ == 0;
+            }
+            void remove_prefix(std::size_t n) {
+                n = std::min(n, length_);
+                offset_ += n;
+                length_ -= n;
+            }
+        private:
+            data_t data_;
+            std::size_t offset_{ 0 };
+            std::size_t length_{ 0 };
+    };
+}
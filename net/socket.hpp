@@ -6,9 +6,17 @@
 #include "../ip/sockets.hpp"
 #include "../util/util.hpp"
 #include "../util/noncopyable.hpp"
+#include "../util/object_pool.hpp"
 
 namespace cortono::net
 {
+    // accept4得到的连接，fd已经是非阻塞的，对端地址在accept时一起取得
+    struct AcceptedSocket
+    {
+        int fd;
+        struct sockaddr_in peer;
+    };
+
     class TcpSocket
     {
         public:
@@ -31,7 +39,8 @@ namespace cortono::net
             TcpSocket(int fd)
                 : fd_(fd),
                   events_(EventPoller::NONE_EVENT),
-                  poller_cbs_(std::make_shared<EventPoller::PollerCB>())
+                  poller_cbs_(util::make_pooled<EventPoller::PollerCB>()),
+                  handler_(poller_cbs_.get())
             { }
 
             ~TcpSocket() { ip::tcp::sockets::close(fd_); }
@@ -46,6 +55,9 @@ namespace cortono::net
             int accept() {
                 return ip::tcp::sockets::accept(fd_);
             }
+            int accept_nonblock(struct sockaddr_in* peer = nullptr) {
+                return ip::tcp::sockets::accept_nonblock(fd_, peer);
+            }
             bool close() {
                 exitif(poller_cbs_->close_cb != nullptr, "close cb is nullptr");
                 poller_cbs_->close_cb();
@@ -73,7 +85,7 @@ namespace cortono::net
             }
             void enable_reading() {
                 if(auto poller = weak_poller_.lock(); poller) {
-                    poller->update(fd_, events_, events_ | EventPoller::READ_EVENT, poller_cbs_);
+                    poller->update(fd_, events_, events_ | EventPoller::READ_EVENT, handler_);
                     events_ |= EventPoller::READ_EVENT;
                 }
                 else {
@@ -82,7 +94,7 @@ namespace cortono::net
             }
             void enable_writing() {
                 if(auto poller = weak_poller_.lock(); poller) {
-                    poller->update(fd_, events_, events_ | EventPoller::WRITE_EVENT, poller_cbs_);
+                    poller->update(fd_, events_, events_ | EventPoller::WRITE_EVENT, handler_);
                     events_ |= EventPoller::WRITE_EVENT;
                 }
                 else {
@@ -91,7 +103,7 @@ namespace cortono::net
             }
             void disable_reading() {
                 if(auto poller = weak_poller_.lock(); poller) {
-                    poller->update(fd_, events_, events_ & (~EventPoller::READ_EVENT), poller_cbs_);
+                    poller->update(fd_, events_, events_ & (~EventPoller::READ_EVENT), handler_);
                     events_ &= (~EventPoller::READ_EVENT);
                 }
                 else {
@@ -100,7 +112,7 @@ namespace cortono::net
             }
             void disable_writing() {
                 if(auto poller = weak_poller_.lock(); poller) {
-                    poller->update(fd_, events_, events_ & (~EventPoller::WRITE_EVENT), poller_cbs_);
+                    poller->update(fd_, events_, events_ & (~EventPoller::WRITE_EVENT), handler_);
                     events_ &= (~EventPoller::WRITE_EVENT);
                 }
                 else {
@@ -109,7 +121,7 @@ namespace cortono::net
             }
             void disable_all() {
                 if(auto poller = weak_poller_.lock(); poller) {
-                    poller->update(fd_, events_, EventPoller::NONE_EVENT, poller_cbs_);
+                    poller->update(fd_, events_, EventPoller::NONE_EVENT, handler_);
                     events_ = EventPoller::NONE_EVENT;
                 }
                 else {
@@ -154,6 +166,13 @@ namespace cortono::net
             int fd() const {
                 return fd_;
             }
+            bool set_busy_poll(int usec) {
+                return ip::tcp::sockets::busy_poll(fd_, usec);
+            }
+            // 使用自定义的事件处理者代替PollerCB中的回调，需要在enable_reading/enable_writing之前设置
+            void set_handler(EventPoller::Handler* handler) {
+                handler_ = handler;
+            }
             void set_read_callback(EventCallBack cb) {
                 poller_cbs_->read_cb = cb;
             }
@@ -166,20 +185,30 @@ namespace cortono::net
             int send(const char* buffer, int len) {
                 return ip::tcp::sockets::send(fd_, buffer, len);
             }
+            int sendv(const struct iovec* iov, int iovcnt) {
+                return ip::tcp::sockets::sendv(fd_, iov, iovcnt);
+            }
             int recv(char* buffer, int len) {
                 return ip::tcp::sockets::recv(fd_, buffer, len);
             }
+            int recvv(const struct iovec* iov, int iovcnt) {
+                return ip::tcp::sockets::recvv(fd_, iov, iovcnt);
+            }
             int readable() {
                 return ip::tcp::sockets::readable(fd_);
             }
-            int sendfile(const std::string& filename, off_t fileoffet, std::size_t filesize) {
-                return ip::tcp::sockets::sendfile(fd_, filename, fileoffet, filesize);
+            bool set_cork(bool on) {
+                return ip::tcp::sockets::cork(fd_, on);
+            }
+            ssize_t sendfile(int in_fd, off_t offset, std::size_t count) {
+                return ip::tcp::sockets::sendfile(fd_, in_fd, offset, count);
             }
         protected:
             int fd_;
             uint32_t events_;
             std::weak_ptr<EventPoller> weak_poller_;
             std::shared_ptr<EventPoller::PollerCB> poller_cbs_;
+            EventPoller::Handler* handler_;
             static std::map<socket_option, std::function<bool(int)>> opt_functors_;
     };
 
@@ -23,25 +23,31 @@ namespace cortono::net
                 conn_cb_ = std::move(cb);
             }
         private:
-            void handle_accept() {
+            void handle_accept() override {
                 while(true) {
                     int fd = accept_client();
                     if(fd == -1) {
                         break;
                     }
+                    // SSL握手是阻塞进行的，完成后由Connection重新设置为非阻塞
+                    ip::tcp::sockets::set_block(fd);
                     SSL* ssl = ip::tcp::ssl::new_ssl_and_set_fd(fd);
                     if(!ip::tcp::ssl::accept(ssl)) {
                         log_fatal("SSL_accept error");
                     }
                     if(loop_producer_ && conn_cb_) {
-                        auto new_conn_ptr = std::make_shared<SslConnection>(loop_producer_(), fd, ssl);
-                        conn_cb_(std::move(new_conn_ptr));
+                        // 和TcpAdaptor一样在所属loop线程中创建连接并调用回调，Service的连接表只在loop线程中访问
+                        auto loop = loop_producer_(batch_);
+                        loop->safe_call([this, loop, fd, ssl] {
+                            conn_cb_(std::make_shared<SslConnection>(loop, fd, ssl));
+                        });
                     }
                     else {
                         ip::tcp::sockets::close(fd);
                         ip::tcp::ssl::close(ssl);
                     }
                 }
+                batch_.clear();
             }
         private:
             ConnCallBack conn_cb_;
@@ -54,9 +54,57 @@ namespace cortono::net
             int send(const char* buffer, int len) {
                 return ssl_sockets::send(ssl_, buffer, len);
             }
+            // SSL没有聚集写，依次写入每一段，遇到部分写入时返回已写入的字节数
+            int sendv(const struct iovec* iov, int iovcnt) {
+                int total = 0;
+                for(int i = 0; i < iovcnt; ++i) {
+                    int len = static_cast<int>(iov[i].iov_len);
+                    int bytes = send(static_cast<const char*>(iov[i].iov_base), len);
+                    if(bytes <= 0) {
+                        return total > 0 ? total : bytes;
+                    }
+                    total += bytes;
+                    if(bytes != len) {
+                        break;
+                    }
+                }
+                return total;
+            }
             int recv(char* buffer, int len) {
                 return ssl_sockets::recv(ssl_, buffer, len);
             }
+            // SSL_read一次最多返回一个记录(不超过16K)，所以部分读取不代表套接字已经读空
+            // 1.每一段循环调用SSL_read直到读满或者SSL返回WANT_READ，期间SSL_pending中已解密的数据也会被读出
+            // 2.WANT_READ/WANT_WRITE转换为EAGAIN，返回值小于总长度说明底层套接字已经读到EAGAIN
+            int recvv(const struct iovec* iov, int iovcnt) {
+                int total = 0;
+                for(int i = 0; i < iovcnt; ++i) {
+                    auto base = static_cast<char*>(iov[i].iov_base);
+                    int len = static_cast<int>(iov[i].iov_len);
+                    int filled = 0;
+                    while(filled < len) {
+                        int bytes = ::SSL_read(ssl_, base + filled, len - filled);
+                        if(bytes <= 0) {
+                            int ssl_error = ::SSL_get_error(ssl_, bytes);
+                            if(ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE) {
+                                errno = EAGAIN;
+                                bytes = -1;
+                            }
+                            else if(ssl_error == SSL_ERROR_ZERO_RETURN || (ssl_error == SSL_ERROR_SYSCALL && errno == 0)) {
+                                bytes = 0;
+                            }
+                            else if(ssl_error != SSL_ERROR_SYSCALL) {
+                                errno = EIO;
+                                bytes = -1;
+                            }
+                            return total > 0 ? total : bytes;
+                        }
+                        filled += bytes;
+                        total += bytes;
+                    }
+                }
+                return total;
+            }
         protected:
             ::SSL* ssl_;
     };
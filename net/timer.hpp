@@ -9,6 +9,8 @@ namespace cortono::net
     {
         public:
             using time_point = std::chrono::steady_clock::time_point;
+            using duration = time_point::duration;
+            using microseconds = std::chrono::microseconds;
             using milliseconds = std::chrono::milliseconds;
             using seconds = std::chrono::seconds;
             using timer_id = std::uint64_t;
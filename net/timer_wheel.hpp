@@ -0,0 +1,420 @@
+#pragma once
+
+#include "timer.hpp"
+#include "../std.hpp"
+#include "../util/util.hpp"
+#include "../util/noncopyable.hpp"
+
+namespace cortono::net
+{
+    /*
+     * 分层时间轮，用于替代std::set<Timer> + std::unordered_map<timer_id, Timer>
+     * 1.一个tick为1ms，第0层256个槽，第1~4层各64个槽，总共可以表示2^32个tick（约49天）
+     *   超过范围的定时器先放在最高层，每次级联时根据剩余时间重新放置，不会提前触发
+     * 2.定时器节点保存在std::deque中（扩容时不会使已有节点失效），回收后通过空闲链表复用
+     *   槽中的链表是用下标实现的侵入式双向链表，插入和取消都是O(1)
+     * 3.timer_id由节点下标和版本号组成，节点回收时版本号加一，取消一个已经被复用的节点不会误删
+     * 4.每层有一个位图记录非空槽，计算下一次超时时间时不需要逐个槽扫描
+     * 5.节点保存精确的到期时间，tick只用于放置。当前tick的槽中只执行已经到期的节点，
+     *   配合EventLoop的timerfd，定时器的精度不受1ms的tick限制
+     * 6.记录每个定时器执行时相对到期时间的延迟，按2的幂(微秒)分桶
+     *
+     * 时间轮不是线程安全的，只能在所属EventLoop的线程中使用
+     */
+    class TimerWheel : private util::noncopyable
+    {
+        public:
+            using timer_id = Timer::timer_id;
+            using time_point = Timer::time_point;
+            using milliseconds = Timer::milliseconds;
+            using duration = Timer::duration;
+            using tick_t = std::uint64_t;
+
+            // 延迟的分桶：第0个桶为[0, 1us)，第i个桶为[2^(i-1), 2^i)us，最后一个桶包括更大的延迟
+            static constexpr std::size_t LATENESS_BUCKETS = 24;
+            struct Lateness
+            {
+                std::array<std::size_t, LATENESS_BUCKETS> buckets;
+                std::size_t fired;
+                std::chrono::microseconds max;
+
+                // 至少p(0~1)比例的定时器的延迟小于返回值，返回的是桶的上界
+                std::chrono::microseconds percentile(double p) const {
+                    std::size_t count = 0;
+                    for(std::size_t i = 0; i < LATENESS_BUCKETS; ++i) {
+                        count += buckets[i];
+                        if(count > 0 && count >= p * fired) {
+                            return i + 1 == LATENESS_BUCKETS ? max : std::chrono::microseconds(1ll << i);
+                        }
+                    }
+                    return std::chrono::microseconds(0);
+                }
+            };
+
+            // EventLoop中跨线程创建的定时器使用这个标记位，与时间轮分配的id区分
+            static constexpr timer_id REMOTE_FLAG = 1ull << 63;
+
+        private:
+            static constexpr std::uint32_t NIL = std::numeric_limits<std::uint32_t>::max();
+            static constexpr int LEVELS = 5;
+            static constexpr int ROOT_BITS = 8;
+            static constexpr int LEVEL_BITS = 6;
+            static constexpr std::uint32_t ROOT_SLOTS = 1u << ROOT_BITS;
+            static constexpr std::uint32_t LEVEL_SLOTS = 1u << LEVEL_BITS;
+            static constexpr std::uint32_t SLOT_NUMS = ROOT_SLOTS + (LEVELS - 1) * LEVEL_SLOTS;
+            // 到期的槽先整体摘到WORK_SLOT中再逐个执行，防止回调中新加入的定时器被提前执行
+            static constexpr std::uint32_t WORK_SLOT = SLOT_NUMS;
+            static constexpr tick_t MAX_DELTA = (1ull << (ROOT_BITS + (LEVELS - 1) * LEVEL_BITS)) - 1;
+
+            enum class NodeState : std::uint8_t
+            {
+                Free,
+                Pending,
+                Running,
+                Cancelled
+            };
+
+            struct TimerNode
+            {
+                std::uint32_t prev{ NIL };
+                std::uint32_t next{ NIL };
+                std::uint32_t slot{ NIL };
+                std::uint32_t version{ 1 };
+                NodeState state{ NodeState::Free };
+                tick_t expires{ 0 };
+                time_point deadline;
+                duration interval{ 0 };
+                std::function<void()> cb;
+            };
+
+        public:
+            TimerWheel()
+                : base_(Timer::now())
+            {
+                heads_.fill(NIL);
+                bitmap_.fill(0);
+            }
+
+            timer_id add(time_point point, duration interval, std::function<void()> cb) {
+                auto idx = allocate();
+                auto& node = nodes_[idx];
+                node.expires = to_tick_ceil(point);
+                node.deadline = point;
+                node.interval = interval.count() > 0 ? interval : duration(0);
+                node.cb = std::move(cb);
+                node.state = NodeState::Pending;
+                place(idx);
+                ++size_;
+                return (static_cast<timer_id>(node.version) << 32) | idx;
+            }
+
+            bool cancel(timer_id id) {
+                if(id & REMOTE_FLAG) {
+                    return false;
+                }
+                auto idx = static_cast<std::uint32_t>(id & 0xffffffff);
+                auto version = static_cast<std::uint32_t>(id >> 32);
+                if(idx >= nodes_.size() || nodes_[idx].version != version) {
+                    return false;
+                }
+                auto& node = nodes_[idx];
+                if(node.state == NodeState::Pending) {
+                    unlink(idx);
+                    release(idx);
+                    return true;
+                }
+                // 在自己的回调中取消自己，等回调返回后再回收
+                if(node.state == NodeState::Running) {
+                    node.state = NodeState::Cancelled;
+                    return true;
+                }
+                return false;
+            }
+
+            // 下一次需要处理时间轮的时间，没有定时器时返回std::nullopt
+            // 第0层的槽返回其中最早的精确到期时间，高层返回的是级联的时间，是实际超时时间的下界
+            std::optional<time_point> next_deadline() const {
+                if(size_ == 0) {
+                    return std::nullopt;
+                }
+                auto tick = next_tick();
+                auto due = base_ + milliseconds(tick);
+                // 第0层中的节点到期时间都在[current_, current_ + ROOT_SLOTS)中，同一个槽只对应一个tick
+                for(auto idx = heads_[tick & (ROOT_SLOTS - 1)]; idx != NIL; idx = nodes_[idx].next) {
+                    due = std::min(due, nodes_[idx].deadline);
+                }
+                return due;
+            }
+            // 距离下一次需要处理时间轮的毫秒数(向上取整)，没有定时器时返回-1
+            int next_timeout(time_point now = Timer::now()) const {
+                auto due = next_deadline();
+                if(!due) {
+                    return -1;
+                }
+                if(*due <= now) {
+                    return 0;
+                }
+                auto timeout = std::chrono::ceil<milliseconds>(*due - now).count();
+                return static_cast<int>(std::min<decltype(timeout)>(timeout, std::numeric_limits<int>::max()));
+            }
+
+            // 执行所有在now之前到期的定时器
+            void expire(time_point now = Timer::now()) {
+                auto target = to_tick(now);
+                while(current_ <= target) {
+                    if(size_ == 0) {
+                        current_ = target + 1;
+                        break;
+                    }
+                    // [current_, next_tick())之间没有任何非空槽，可以直接跳过
+                    auto tick = next_tick();
+                    if(tick > target) {
+                        current_ = target + 1;
+                        break;
+                    }
+                    current_ = tick;
+                    process_tick(tick, now);
+                }
+                // now不在tick边界上，当前tick的槽中可能有已经到期的节点
+                if(size_ > 0 && next_tick() == current_) {
+                    process_tick(current_, now);
+                }
+            }
+
+            // 可以在任意线程读取
+            Lateness lateness() const {
+                Lateness result;
+                for(std::size_t i = 0; i < LATENESS_BUCKETS; ++i) {
+                    result.buckets[i] = lateness_[i].load(std::memory_order_relaxed);
+                }
+                result.fired = fired_.load(std::memory_order_relaxed);
+                result.max = std::chrono::microseconds(max_lateness_us_.load(std::memory_order_relaxed));
+                return result;
+            }
+
+            std::size_t size() const {
+                return size_;
+            }
+            bool empty() const {
+                return size_ == 0;
+            }
+
+        private:
+            tick_t to_tick(time_point point) const {
+                if(point <= base_) {
+                    return 0;
+                }
+                return std::chrono::duration_cast<milliseconds>(point - base_).count();
+            }
+            // 到期时间向上取整，保证定时器不会提前触发
+            tick_t to_tick_ceil(time_point point) const {
+                if(point <= base_) {
+                    return 0;
+                }
+                return std::chrono::ceil<milliseconds>(point - base_).count();
+            }
+
+            static int level_shift(int level) {
+                return ROOT_BITS + (level - 1) * LEVEL_BITS;
+            }
+            static std::uint32_t level_slot(int level, std::uint32_t idx) {
+                return ROOT_SLOTS + (level - 1) * LEVEL_SLOTS + idx;
+            }
+
+            std::uint32_t allocate() {
+                if(free_head_ != NIL) {
+                    auto idx = free_head_;
+                    free_head_ = nodes_[idx].next;
+                    nodes_[idx].next = NIL;
+                    return idx;
+                }
+                nodes_.emplace_back();
+                return static_cast<std::uint32_t>(nodes_.size() - 1);
+            }
+            void release(std::uint32_t idx) {
+                auto& node = nodes_[idx];
+                node.cb = nullptr;
+                node.state = NodeState::Free;
+                node.version = (node.version + 1) & 0x7fffffff;
+                if(node.version == 0) {
+                    node.version = 1;
+                }
+                node.prev = NIL;
+                node.slot = NIL;
+                node.next = free_head_;
+                free_head_ = idx;
+                --size_;
+            }
+
+            void link(std::uint32_t idx, std::uint32_t slot) {
+                auto& node = nodes_[idx];
+                node.slot = slot;
+                node.prev = NIL;
+                node.next = heads_[slot];
+                if(node.next != NIL) {
+                    nodes_[node.next].prev = idx;
+                }
+                heads_[slot] = idx;
+                if(slot != WORK_SLOT) {
+                    bitmap_[slot >> 6] |= 1ull << (slot & 63);
+                }
+            }
+            void unlink(std::uint32_t idx) {
+                auto& node = nodes_[idx];
+                if(node.prev != NIL) {
+                    nodes_[node.prev].next = node.next;
+                }
+                else {
+                    heads_[node.slot] = node.next;
+                }
+                if(node.next != NIL) {
+                    nodes_[node.next].prev = node.prev;
+                }
+                if(heads_[node.slot] == NIL && node.slot != WORK_SLOT) {
+                    bitmap_[node.slot >> 6] &= ~(1ull << (node.slot & 63));
+                }
+                node.prev = node.next = NIL;
+                node.slot = NIL;
+            }
+
+            void place(std::uint32_t idx) {
+                auto& node = nodes_[idx];
+                if(node.expires < current_) {
+                    node.expires = current_;
+                }
+                tick_t delta = node.expires - current_;
+                if(delta < ROOT_SLOTS) {
+                    link(idx, node.expires & (ROOT_SLOTS - 1));
+                    return;
+                }
+                // 超出范围的定时器只是暂时放在最高层，级联时会根据真实的到期时间重新放置
+                tick_t expires = current_ + std::min(delta, MAX_DELTA);
+                for(int level = 1; level < LEVELS; ++level) {
+                    if(level == LEVELS - 1 || delta < (1ull << level_shift(level + 1))) {
+                        link(idx, level_slot(level, (expires >> level_shift(level)) & (LEVEL_SLOTS - 1)));
+                        return;
+                    }
+                }
+            }
+
+            void cascade(std::uint32_t slot) {
+                while(heads_[slot] != NIL) {
+                    auto idx = heads_[slot];
+                    unlink(idx);
+                    place(idx);
+                }
+            }
+
+            // now在tick之前时只执行槽中已经到期的节点，current_停留在tick
+            void process_tick(tick_t tick, time_point now) {
+                auto idx = static_cast<std::uint32_t>(tick & (ROOT_SLOTS - 1));
+                if(idx == 0) {
+                    for(int level = 1; level < LEVELS; ++level) {
+                        auto level_idx = static_cast<std::uint32_t>((tick >> level_shift(level)) & (LEVEL_SLOTS - 1));
+                        cascade(level_slot(level, level_idx));
+                        if(level_idx != 0) {
+                            break;
+                        }
+                    }
+                }
+                for(auto node_idx = heads_[idx]; node_idx != NIL; ) {
+                    auto next = nodes_[node_idx].next;
+                    if(nodes_[node_idx].deadline <= now) {
+                        unlink(node_idx);
+                        link(node_idx, WORK_SLOT);
+                    }
+                    node_idx = next;
+                }
+                if(to_tick(now) >= tick) {
+                    current_ = tick + 1;
+                }
+                while(heads_[WORK_SLOT] != NIL) {
+                    run(heads_[WORK_SLOT]);
+                }
+            }
+
+            void run(std::uint32_t idx) {
+                unlink(idx);
+                auto& node = nodes_[idx];
+                node.state = NodeState::Running;
+                exitif(node.cb == nullptr, "timer callback is nullptr");
+                record_lateness(Timer::now() - node.deadline);
+                node.cb();
+                if(node.state == NodeState::Cancelled || node.interval.count() == 0) {
+                    release(idx);
+                }
+                else {
+                    node.state = NodeState::Pending;
+                    node.deadline += node.interval;
+                    node.expires = to_tick_ceil(node.deadline);
+                    place(idx);
+                }
+            }
+
+            // 只有loop线程写入
+            void record_lateness(duration late) {
+                auto us = std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(late).count(), 0);
+                std::size_t bucket = us == 0 ? 0 : 64 - __builtin_clzll(static_cast<std::uint64_t>(us));
+                bucket = std::min(bucket, LATENESS_BUCKETS - 1);
+                lateness_[bucket].store(lateness_[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                fired_.store(fired_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                if(us > max_lateness_us_.load(std::memory_order_relaxed)) {
+                    max_lateness_us_.store(us, std::memory_order_relaxed);
+                }
+            }
+
+            // 下一个需要处理的tick：第0层是槽的到期时间，其它层是级联时间
+            tick_t next_tick() const {
+                tick_t best = std::numeric_limits<tick_t>::max();
+                auto pos = static_cast<std::uint32_t>(current_ & (ROOT_SLOTS - 1));
+                for(std::uint32_t i = 0; i <= ROOT_SLOTS / 64; ++i) {
+                    auto w = ((pos >> 6) + i) & (ROOT_SLOTS / 64 - 1);
+                    auto word = bitmap_[w];
+                    if(i == 0) {
+                        word &= ~0ull << (pos & 63);
+                    }
+                    else if(i == ROOT_SLOTS / 64) {
+                        word &= (1ull << (pos & 63)) - 1;
+                    }
+                    if(word) {
+                        auto slot = w * 64 + __builtin_ctzll(word);
+                        best = current_ + ((slot - pos) & (ROOT_SLOTS - 1));
+                        break;
+                    }
+                }
+                for(int level = 1; level < LEVELS; ++level) {
+                    auto word = bitmap_[level_slot(level, 0) >> 6];
+                    if(word == 0) {
+                        continue;
+                    }
+                    auto shift = level_shift(level);
+                    auto p = static_cast<int>((current_ >> shift) & (LEVEL_SLOTS - 1));
+                    auto rotated = p ? ((word >> p) | (word << (64 - p))) : word;
+                    tick_t d = 0;
+                    // 当前tick不在边界上时，当前块对应的槽要等转完一圈才会级联
+                    if((current_ & ((1ull << shift) - 1)) != 0) {
+                        rotated &= ~1ull;
+                        d = rotated ? __builtin_ctzll(rotated) : LEVEL_SLOTS;
+                        best = std::min(best, ((current_ >> shift) + d) << shift);
+                    }
+                    else {
+                        d = __builtin_ctzll(rotated);
+                        best = std::min(best, current_ + (d << shift));
+                    }
+                }
+                return best;
+            }
+
+        private:
+            time_point base_;
+            tick_t current_{ 0 };
+            std::size_t size_{ 0 };
+            std::uint32_t free_head_{ NIL };
+            std::deque<TimerNode> nodes_;
+            std::array<std::uint32_t, SLOT_NUMS + 1> heads_;
+            std::array<std::uint64_t, SLOT_NUMS / 64> bitmap_;
+            std::array<std::atomic<std::size_t>, LATENESS_BUCKETS> lateness_{};
+            std::atomic<std::size_t> fired_{ 0 };
+            std::atomic<std::int64_t> max_lateness_us_{ 0 };
+    };
+}
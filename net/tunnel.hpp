@@ -0,0 +1,254 @@
+#pragma once
+
+#include "../std.hpp"
+#include "../util/noncopyable.hpp"
+#include "connection.hpp"
+
+namespace cortono::net
+{
+    /*
+     * 双向转发两个连接之间的数据，用于代理的CONNECT隧道
+     * 1.两个TcpSocket连接：每个方向一条管道，splice(2)把数据从源套接字移到管道再移到目的套接字，不经过用户空间
+     * 2.管道中的数据没有写完(目的端EAGAIN)时不再读源端，目的端可写之后先写完管道再继续读，即背压
+     * 3.一端读到EOF并且管道写空后shutdown另一端的写方向，两个方向都结束或者任意一端出错时关闭两个连接
+     * 4.SslSocket需要在用户空间解密，或者创建管道失败时，退回到通过接收/发送缓冲区复制转发
+     *   此时a的可读回调持有b，关闭由调用者处理，join返回false
+     * 5.两个连接必须属于同一个loop，只能在loop线程中调用join
+     */
+    template <typename ConnA, typename ConnB>
+    class Tunnel : public std::enable_shared_from_this<Tunnel<ConnA, ConnB>>,
+                   private util::noncopyable
+    {
+        public:
+            struct Stats
+            {
+                std::size_t spliced;        // 使用splice的隧道数
+                std::size_t copied;         // 退回到缓冲区复制的隧道数
+                std::size_t bytes;          // splice转发的字节数
+            };
+
+            static constexpr std::size_t PIPE_SIZE = 256 * 1024;
+            // 单次事件最多转发的字节数，超过后放到本轮事件处理之后继续，避免饿死其它连接
+            static constexpr std::size_t PUMP_BUDGET = 1024 * 1024;
+
+            // 连接中已经收到但还没有处理的数据(如紧跟在CONNECT之后的TLS ClientHello)先转发给对方
+            static bool join(const std::shared_ptr<ConnA>& a, const std::shared_ptr<ConnB>& b) {
+                if(a->is_closed() || b->is_closed()) {
+                    a->close();
+                    b->close();
+                    return true;
+                }
+                forward_received(a, b);
+                forward_received(b, a);
+                if constexpr(std::is_same_v<typename ConnA::socket_t, TcpSocket> && std::is_same_v<typename ConnB::socket_t, TcpSocket>) {
+                    if(a->loop() == b->loop()) {
+                        auto tunnel = std::shared_ptr<Tunnel>(new Tunnel(a, b));
+                        if(tunnel->open_pipes()) {
+                            tunnel->start();
+                            return true;
+                        }
+                    }
+                }
+                copy(a, b);
+                return false;
+            }
+            static Stats stats() {
+                return {
+                    spliced_.load(std::memory_order_relaxed),
+                    copied_.load(std::memory_order_relaxed),
+                    bytes_.load(std::memory_order_relaxed)
+                };
+            }
+
+        private:
+            // 一个方向的管道，bytes为管道中还没有写出的字节数
+            struct Pipe
+            {
+                int fds[2]{ -1, -1 };
+                std::size_t bytes{ 0 };
+                std::size_t capacity{ 0 };
+                bool eof{ false };
+                bool shutdown{ false };
+
+                ~Pipe() {
+                    for(auto fd : fds) {
+                        if(fd != -1) {
+                            ::close(fd);
+                        }
+                    }
+                }
+                bool open() {
+                    if(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+                        log_error("create pipe failed:", std::strerror(errno));
+                        return false;
+                    }
+                    // 扩大管道失败(如超过pipe-user-pages-soft)时使用默认大小
+                    ::fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(PIPE_SIZE));
+                    auto size = ::fcntl(fds[1], F_GETPIPE_SZ);
+                    capacity = size > 0 ? static_cast<std::size_t>(size) : 64 * 1024;
+                    return true;
+                }
+            };
+
+            // 连接的读写事件转交给Tunnel，first表示是否为连接a
+            class Side : public IoHook
+            {
+                public:
+                    Side(std::shared_ptr<Tunnel> tunnel, bool first)
+                        : tunnel_(std::move(tunnel)),
+                          first_(first)
+                    {  }
+                    void on_readable() override {
+                        first_ ? tunnel_->pump_ab() : tunnel_->pump_ba();
+                    }
+                    void on_writeable() override {
+                        first_ ? tunnel_->pump_ba() : tunnel_->pump_ab();
+                    }
+                    void on_closed() override {
+                        tunnel_->close_all();
+                    }
+                private:
+                    std::shared_ptr<Tunnel> tunnel_;
+                    bool first_;
+            };
+
+            Tunnel(const std::shared_ptr<ConnA>& a, const std::shared_ptr<ConnB>& b)
+                : a_(a),
+                  b_(b)
+            {  }
+
+            bool open_pipes() {
+                return ab_.open() && ba_.open();
+            }
+            // 连接和hook互相持有，在连接关闭时释放hook时解除
+            void start() {
+                spliced_.fetch_add(1, std::memory_order_relaxed);
+                a_->set_io_hook(std::make_shared<Side>(this->shared_from_this(), true));
+                b_->set_io_hook(std::make_shared<Side>(this->shared_from_this(), false));
+                // 之前的可读边缘已经被缓冲区读取消耗，这里主动转发一次
+                pump_ab();
+                pump_ba();
+            }
+            void pump_ab() {
+                pump(ab_, a_, b_, &Tunnel::pump_ab);
+            }
+            void pump_ba() {
+                pump(ba_, b_, a_, &Tunnel::pump_ba);
+            }
+            // 先把管道写空再从源端读，读到EAGAIN或者目的端EAGAIN为止，边缘触发下不会丢失通知
+            template <typename Src, typename Dst>
+            void pump(Pipe& pipe, const std::shared_ptr<Src>& src, const std::shared_ptr<Dst>& dst, void (Tunnel::*next)()) {
+                std::size_t moved = 0;
+                while(!closed_) {
+                    // 目的端还在连接，或者发送队列中还有join之前的数据，完成之后会通知可写
+                    if((pipe.bytes > 0 || pipe.eof) && (dst->conn_state() == Dst::ConnState::HandShaking || dst->sending())) {
+                        return;
+                    }
+                    if(pipe.bytes > 0) {
+                        auto n = ip::tcp::sockets::splice(pipe.fds[0], dst->fd(), pipe.bytes);
+                        if(n > 0) {
+                            pipe.bytes -= static_cast<std::size_t>(n);
+                            moved += static_cast<std::size_t>(n);
+                            bytes_.fetch_add(static_cast<std::size_t>(n), std::memory_order_relaxed);
+                            continue;
+                        }
+                        if(n == -1 && errno == EINTR) {
+                            continue;
+                        }
+                        if(n == -1 && errno == EAGAIN) {
+                            return;
+                        }
+                        close_all();
+                        return;
+                    }
+                    if(pipe.eof) {
+                        if(!pipe.shutdown) {
+                            pipe.shutdown = true;
+                            ip::tcp::sockets::shutdown(dst->fd(), SHUT_WR);
+                        }
+                        if(ab_.shutdown && ba_.shutdown) {
+                            close_all();
+                        }
+                        return;
+                    }
+                    if(src->conn_state() == Src::ConnState::HandShaking) {
+                        return;
+                    }
+                    if(moved >= PUMP_BUDGET) {
+                        std::weak_ptr<Tunnel> weak_tunnel = this->shared_from_this();
+                        src->loop()->queue_call([weak_tunnel, next] {
+                            if(auto tunnel = weak_tunnel.lock(); tunnel) {
+                                ((*tunnel).*next)();
+                            }
+                        });
+                        return;
+                    }
+                    auto n = ip::tcp::sockets::splice(src->fd(), pipe.fds[1], pipe.capacity);
+                    if(n > 0) {
+                        pipe.bytes = static_cast<std::size_t>(n);
+                    }
+                    else if(n == 0) {
+                        pipe.eof = true;
+                    }
+                    else if(errno == EAGAIN) {
+                        return;
+                    }
+                    else if(errno != EINTR) {
+                        close_all();
+                        return;
+                    }
+                }
+            }
+            // 关闭连接时释放hook，从而释放Tunnel，调用者通过hook持有自身
+            void close_all() {
+                if(closed_) {
+                    return;
+                }
+                closed_ = true;
+                a_->force_close();
+                b_->force_close();
+            }
+
+            template <typename From, typename To>
+            static void forward_received(const std::shared_ptr<From>& from, const std::shared_ptr<To>& to) {
+                if(from->recv_buffer()->size() > 0) {
+                    to->send(from->recv_all());
+                }
+            }
+            // 通过缓冲区复制转发，一端的发送队列超过高水位时暂停读取另一端
+            static void copy(const std::shared_ptr<ConnA>& a, const std::shared_ptr<ConnB>& b) {
+                copied_.fetch_add(1, std::memory_order_relaxed);
+                std::weak_ptr<ConnA> weak_a = a;
+                a->on_read([b](auto a) {
+                    b->send(a->recv_all());
+                });
+                b->on_read([weak_a](auto b) {
+                    if(auto a = weak_a.lock(); a) {
+                        a->send(b->recv_all());
+                    }
+                });
+                a->set_water_marks(HIGH_WATER_MARK, LOW_WATER_MARK);
+                b->set_water_marks(HIGH_WATER_MARK, LOW_WATER_MARK);
+                a->pause_reading_of(b);
+                b->pause_reading_of(a);
+            }
+
+        private:
+            static constexpr std::size_t HIGH_WATER_MARK = 1024 * 1024;
+            static constexpr std::size_t LOW_WATER_MARK = 256 * 1024;
+
+            std::shared_ptr<ConnA> a_;
+            std::shared_ptr<ConnB> b_;
+            Pipe ab_, ba_;
+            bool closed_{ false };
+
+            inline static std::atomic<std::size_t> spliced_{ 0 };
+            inline static std::atomic<std::size_t> copied_{ 0 };
+            inline static std::atomic<std::size_t> bytes_{ 0 };
+    };
+
+    template <typename ConnA, typename ConnB>
+    bool join_tunnel(const std::shared_ptr<ConnA>& a, const std::shared_ptr<ConnB>& b) {
+        return Tunnel<ConnA, ConnB>::join(a, b);
+    }
+}
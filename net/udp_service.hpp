@@ -23,7 +23,7 @@ namespace cortono::net
                     log_fatal("bind error", std::strerror(errno));
                 }
                 poller_cb_->read_cb = std::bind(&UdpService::handle_read, this);
-                loop->poller()->update(sockfd_, EventPoller::NONE_EVENT, EventPoller::READ_EVENT, poller_cb_);
+                loop->poller()->update(sockfd_, EventPoller::NONE_EVENT, EventPoller::READ_EVENT, poller_cb_.get());
             }
             ~UdpService() {
                 ip::udp::sockets::close(sockfd_);
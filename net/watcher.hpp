@@ -4,35 +4,37 @@
 
 namespace cortono::net
 {
+    // 使用eventfd唤醒阻塞在epoll_wait中的EventLoop
+    // 多次notify会累加到同一个计数器上，一次read即可全部清除
     class Watcher
     {
         public:
-            Watcher() {
-                int ret = ::pipe(fd_);
-                (void)ret;
+            Watcher()
+                : fd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+            {
             }
 
             ~Watcher() {
-                util::io::close(fd_[0]);
-                util::io::close(fd_[1]);
+                util::io::close(fd_);
             }
 
             void notify() {
-                int ret = ::write(fd_[1], "0", 1);
+                std::uint64_t one = 1;
+                int ret = ::write(fd_, &one, sizeof(one));
                 (void)ret;
             }
 
             void clear() {
-                char buffer[1024];
-                int ret = ::read(fd_[0], buffer, sizeof(buffer));
+                std::uint64_t count = 0;
+                int ret = ::read(fd_, &count, sizeof(count));
                 (void)ret;
             }
 
             int read_fd() {
-                return fd_[0];
+                return fd_;
             }
 
         private:
-            int fd_[2];
+            int fd_;
     };
 }
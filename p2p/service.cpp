@@ -79,13 +79,23 @@ bool Service::connect_peer(const std::string& ip, std::uint16_t port) {
             session->send_datagram(GetAddrDatagram{ configuration_.local_ip, configuration_.local_port });
         };
 
-        // XXX note: client doesn't belong to this thread
-        auto client = cortono::net::TcpClient::connect(
-            loop, ip, port, std::move(read_cb), nullptr, std::move(close_cb), std::move(conn_cb), std::move(error_cb));
-
-        if(!client->is_connected()) {
-            append_to_connectings(client);
-        }
+        // 对端地址可能是域名，通过Resolver解析，不阻塞loop线程
+        auto done = [=](cortono::net::TcpConnection::Pointer client) {
+            if(!client) {
+                log_error(cortono::util::format("fail to connect to peer(%s:%u)", ip.data(), port));
+                peer_manager_.remove(ip, port);
+                {
+                    std::unique_lock lock { server_session_size_mutex_ };
+                    --server_session_size_;
+                }
+                return;
+            }
+            if(!client->is_connected()) {
+                append_to_connectings(client);
+            }
+        };
+        cortono::net::TcpClient::async_connect(
+            loop, ip, port, std::move(done), std::move(read_cb), nullptr, std::move(close_cb), std::move(conn_cb), std::move(error_cb));
     });
 
     return true;
@@ -51,19 +51,19 @@ public:
             switch(datagram_->type()) 
             {
                 case AddrDatagram::type:
-                    log_info(cortono::util::format("receive AddrDatagram(%s:%u) from %s", ip.data(), port, conn_->name().data()));
+                    log_debug(cortono::util::format("receive AddrDatagram(%s:%u) from %s", ip.data(), port, conn_->name().data()));
                     handle_addr_datagram();
                     break;
                 case GetAddrDatagram::type:
-                    log_info(cortono::util::format("receive GetAddrDatagram(%s:%u) from %s", ip.data(), port, conn_->name().data()));
+                    log_debug(cortono::util::format("receive GetAddrDatagram(%s:%u) from %s", ip.data(), port, conn_->name().data()));
                     handle_getaddr_datagram();
                     break;
                 case PingDatagram::type:
-                    log_info(cortono::util::format("receive PingDatagram from %s, send PongDatagram", conn_->name().data()));
+                    log_debug(cortono::util::format("receive PingDatagram from %s, send PongDatagram", conn_->name().data()));
                     handle_ping_datagram();
                     break;
                 case PongDatagram::type:
-                    log_info(cortono::util::format("receive PongDatagram from %s, reset heartbeat_timer", conn_->name().data()));
+                    log_debug(cortono::util::format("receive PongDatagram from %s, reset heartbeat_timer", conn_->name().data()));
                     handle_pong_datagram();
                     break;
                 default:
@@ -13,7 +13,7 @@ int main()
 
     static_assert(2 * WindowSize < BufferSize);
 
-    constexpr std::uint64_t Timeout = 100;
+    constexpr std::uint64_t Timeout = 100 * 1000;    // 微秒
     constexpr std::uint64_t SendRate = 50;
     constexpr std::int32_t MaxDataSize = 4096;
 
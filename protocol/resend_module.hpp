@@ -5,6 +5,7 @@
 namespace cortono
 {
 
+    // Time为重传超时时间，单位为微秒，可以小于1ms
     template <std::uint64_t BufferSize, std::uint64_t Time>
     class ResendModule
     {
@@ -90,7 +91,7 @@ namespace cortono
                 std::string packet_str = packet.to_string();
                 auto des_port = packet.des_port();
                 auto des_ip = packet.des_ip();
-                auto id = loop_->run_every(std::chrono::milliseconds(Time),
+                auto id = loop_->run_every(std::chrono::microseconds(Time),
                     [=, packet_str = std::move(packet_str)]{
                     log_info("resend packet:", start_seq, "to", end_seq);
                     sender_(packet_str, des_ip, des_port);
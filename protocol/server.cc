@@ -14,7 +14,7 @@ int main()
 
     static_assert(2 * WindowSize < BufferSize);
 
-    constexpr std::uint64_t Timeout = 100;
+    constexpr std::uint64_t Timeout = 100 * 1000;    // 微秒
     constexpr std::int32_t MaxDataSize = 4096;
 
     using seq_t = black_magic::promote_t<black_magic::RoundUp<SeqBits, 8>::value>;
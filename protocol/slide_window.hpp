@@ -72,7 +72,7 @@ namespace cortono
                     win_right_ = (win_right_ + 1) % BufferSize;
                     ++readable_bytes_;
                 }
-                log_info("window move to", win_left_, win_right_);
+                log_debug("window move to", win_left_, win_right_);
                 return true;
             }
             bool move_if_valid(std::uint64_t end_index) {
@@ -113,7 +113,7 @@ namespace cortono
                 if(n == 0) {
                     return "";
                 }
-                log_info("readable bytes:", n);
+                log_debug("readable bytes:", n);
                 std::string info;
                 info.reserve(n);
                 if(read_idx_ <= win_left_) {
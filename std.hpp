@@ -3,6 +3,8 @@
 #include <fstream>
 #include <vector>
 #include <list>
+#include <deque>
+#include <array>
 #include <queue>
 #include <bitset>
 #include <string>
@@ -12,11 +14,14 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <any>
+#include <optional>
 #include <random>
 
 #include <iterator>
+#include <limits>
 #include <type_traits>
 #include <algorithm>
+#include <numeric>
 #include <atomic>
 #include <memory>
 #include <functional>
@@ -29,6 +34,7 @@
 #include <condition_variable>
 
 #include <sstream>
+#include <charconv>
 #include <stdexcept>
 
 #include <cstdint>
@@ -39,17 +45,26 @@
 
 #include <string.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 #include <wait.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <poll.h>
 
 #include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <linux/filter.h>
+#include <linux/mempolicy.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <net/if.h>
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+// 测试程序共用的检查函数
+// 1.check打印每一项的结果并记录失败次数
+// 2.main最后返回finish()，全部通过时打印all passed
+inline int failures = 0;
+
+inline void check(bool cond, const std::string& what) {
+    std::cout << (cond ? "ok   " : "FAIL ") << what << std::endl;
+    if(!cond) {
+        ++failures;
+    }
+}
+
+inline int finish() {
+    std::cout << (failures == 0 ? "all passed" : "FAILED") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
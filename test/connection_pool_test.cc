@@ -0,0 +1,164 @@
+#include "../net/connection_pool.hpp"
+#include <iostream>
+#include "check.hpp"
+
+// 测试上游连接池
+// 1.本机启动一个只accept的服务器，记录建立的连接数，可以主动关闭所有连接
+// 2.检查复用、max_idle、空闲超时、对端关闭后丢弃、排队等待、等待超时和连接失败
+using namespace cortono;
+using namespace cortono::net;
+
+using Pool = ConnectionPool<TcpClient>;
+
+class AcceptServer
+{
+    public:
+        AcceptServer() {
+            fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            auto addr = ip::address::to_sockaddr("127.0.0.1", 0);
+            ::bind(fd_, &addr, sizeof(addr));
+            ::listen(fd_, 128);
+            struct sockaddr_in local;
+            socklen_t len = sizeof(local);
+            ::getsockname(fd_, reinterpret_cast<struct sockaddr*>(&local), &len);
+            port_ = ntohs(local.sin_port);
+            thread_ = std::thread([this] {
+                while(true) {
+                    int fd = ::accept(fd_, nullptr, nullptr);
+                    if(fd < 0) {
+                        break;
+                    }
+                    std::unique_lock lock{ mutex_ };
+                    fds_.push_back(fd);
+                }
+            });
+        }
+        ~AcceptServer() {
+            ::shutdown(fd_, SHUT_RDWR);
+            thread_.join();
+            ::close(fd_);
+            close_all();
+        }
+        unsigned short port() const {
+            return port_;
+        }
+        std::size_t accepted() {
+            std::unique_lock lock{ mutex_ };
+            return accepted_ + fds_.size();
+        }
+        void close_all() {
+            std::unique_lock lock{ mutex_ };
+            for(auto fd : fds_) {
+                ::close(fd);
+            }
+            accepted_ += fds_.size();
+            fds_.clear();
+        }
+
+    private:
+        int fd_;
+        unsigned short port_;
+        std::thread thread_;
+        std::mutex mutex_;
+        std::vector<int> fds_;
+        std::size_t accepted_{ 0 };
+};
+
+int main()
+{
+    AcceptServer server;
+    Pool::Options options;
+    options.max_idle = 2;
+    options.max_total = 3;
+    options.idle_ttl = Timer::milliseconds(300);
+    options.wait_timeout = Timer::milliseconds(200);
+    Pool::set_options(options);
+
+    EventLoop loop;
+    loop.run_every(Timer::milliseconds(10), [] {});
+    auto wait_until = [&loop](auto pred) {
+        auto deadline = Timer::now() + Timer::milliseconds(3000);
+        while(!pred() && Timer::now() < deadline) {
+            loop.loop_once();
+        }
+    };
+    auto& pool = Pool::of(&loop);
+    auto port = server.port();
+    auto acquire = [&](std::vector<TcpConnection::Pointer>& out) {
+        pool.acquire("127.0.0.1", port, [&out](auto conn) { out.push_back(conn); });
+    };
+
+    // 新建连接，放回后再次取得的是同一个连接
+    std::vector<TcpConnection::Pointer> conns;
+    acquire(conns);
+    wait_until([&] { return conns.size() == 1; });
+    check(conns.size() == 1 && conns[0] && conns[0]->is_connected(), "connect on miss");
+    // 客户端连接建立时服务端线程不一定已经accept
+    wait_until([&] { return server.accepted() == 1; });
+    auto first = conns[0];
+    pool.release(first);
+    conns.clear();
+    acquire(conns);
+    check(conns.size() == 1 && conns[0] == first, "reuse idle connection");
+    check(server.accepted() == 1, "no new handshake on hit");
+
+    // 连接数达到max_total后排队，放回的连接直接交给排队的请求
+    acquire(conns);
+    acquire(conns);
+    wait_until([&] { return conns.size() == 3; });
+    std::vector<TcpConnection::Pointer> waiting;
+    acquire(waiting);
+    loop.loop_once();
+    check(waiting.empty(), "wait when exhausted");
+    pool.release(conns[1]);
+    check(waiting.size() == 1 && waiting[0] == conns[1], "hand released connection to waiter");
+
+    // 排队超时
+    std::vector<TcpConnection::Pointer> timeout;
+    acquire(timeout);
+    wait_until([&] { return !timeout.empty(); });
+    check(timeout.size() == 1 && timeout[0] == nullptr, "wait timeout");
+
+    // 不能复用的连接被关闭，空出的名额为排队的请求新建连接
+    std::vector<TcpConnection::Pointer> fresh;
+    acquire(fresh);
+    pool.release(conns[2], false);
+    wait_until([&] { return !fresh.empty(); });
+    check(fresh.size() == 1 && fresh[0] && fresh[0] != conns[2] && conns[2]->is_closed(), "connect for waiter after close");
+
+    // 最多保留max_idle个空闲连接
+    pool.release(conns[0]);
+    pool.release(waiting[0]);
+    pool.release(fresh[0]);
+    check(Pool::stats().idle == 2 && fresh[0]->is_closed(), "max idle");
+
+    // 对端关闭后空闲连接被丢弃
+    server.close_all();
+    wait_until([&] { return Pool::stats().idle == 0; });
+    check(Pool::stats().idle == 0, "evict idle connection closed by peer");
+
+    // 空闲超时
+    conns.clear();
+    acquire(conns);
+    wait_until([&] { return conns.size() == 1; });
+    pool.release(conns[0]);
+    check(Pool::stats().idle == 1, "park connection");
+    wait_until([&] { return Pool::stats().idle == 0; });
+    check(Pool::stats().idle == 0 && conns[0]->is_closed(), "evict after idle ttl");
+
+    // 连接失败
+    std::vector<TcpConnection::Pointer> refused;
+    pool.acquire("127.0.0.1", 1, [&refused](auto conn) { refused.push_back(conn); });
+    wait_until([&] { return !refused.empty(); });
+    check(refused.size() == 1 && refused[0] == nullptr, "connect failure");
+
+    auto stats = Pool::stats();
+    std::cout << "acquires " << stats.acquires << ", hits " << stats.hits << ", hit rate " << stats.hit_rate()
+              << ", waits " << stats.waits << ", wait timeouts " << stats.wait_timeouts
+              << ", connects " << stats.connects << ", failures " << stats.connect_failures
+              << ", avg connect " << (stats.connects ? stats.connect_time.count() / stats.connects : 0) << "us"
+              << ", evictions " << stats.evictions << std::endl;
+    check(stats.hits == 2 && stats.waits == 3 && stats.wait_timeouts == 1 && stats.connect_failures == 1, "stats");
+
+    return finish();
+}
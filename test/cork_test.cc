@@ -0,0 +1,107 @@
+#include "../net/connection.hpp"
+#include <iostream>
+#include "check.hpp"
+
+// 测试合并发送
+// 1.本机TCP连接，loop端关闭Nagle，通过TCP_INFO的tcpi_data_segs_out统计发出的数据报文段数
+// 2.响应头 + sendfile在cork时报文段更少，第一块文件数据之后自动uncork
+// 3.cork期间的多次小数据发送合并成一个报文段
+using namespace cortono;
+using namespace cortono::net;
+
+// glibc的struct tcp_info没有tcpi_data_segs_out，按照linux/tcp.h中的偏移读取(内核只在末尾追加字段)
+std::uint32_t data_segs_out(int fd) {
+    constexpr std::size_t DATA_SEGS_OUT_OFFSET = 156;
+    unsigned char info[256] = { 0 };
+    socklen_t len = sizeof(info);
+    if(::getsockopt(fd, IPPROTO_TCP, TCP_INFO, info, &len) == -1 || len < DATA_SEGS_OUT_OFFSET + 4) {
+        return 0;
+    }
+    std::uint32_t segs;
+    std::memcpy(&segs, info + DATA_SEGS_OUT_OFFSET, sizeof(segs));
+    return segs;
+}
+
+std::pair<int, int> tcp_pair() {
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    auto addr = ip::address::to_sockaddr("127.0.0.1", 0);
+    ::bind(listen_fd, &addr, sizeof(addr));
+    ::listen(listen_fd, 1);
+    socklen_t len = sizeof(addr);
+    ::getsockname(listen_fd, &addr, &len);
+    int outer = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ::connect(outer, &addr, sizeof(addr));
+    int inner = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    ::close(listen_fd);
+    return { outer, inner };
+}
+
+void read_exactly(int fd, std::size_t bytes) {
+    char buffer[65536];
+    while(bytes > 0) {
+        auto n = ::read(fd, buffer, std::min(bytes, sizeof(buffer)));
+        if(n <= 0) {
+            return;
+        }
+        bytes -= n;
+    }
+}
+
+int main()
+{
+    util::logger::close_logger();
+    char path[] = "/tmp/cork_test.XXXXXX";
+    int file_fd = ::mkstemp(path);
+    std::string content(100 * 1024, 'f');
+    ::write(file_fd, content.data(), content.size());
+    ::close(file_fd);
+
+    EventLoop loop;
+    auto [client, fd] = tcp_pair();
+    auto conn = std::make_shared<TcpConnection>(&loop, fd);
+    conn->set_conn_state(TcpConnection::ConnState::Connected);
+    ip::tcp::sockets::no_delay(fd);
+    std::string header(200, 'h');
+
+    // 响应头和文件分开发送
+    auto before = data_segs_out(fd);
+    conn->send(header);
+    conn->sendfile(path);
+    auto plain = data_segs_out(fd) - before;
+    read_exactly(client, header.size() + content.size());
+
+    // 响应头和文件的第一块合并
+    before = data_segs_out(fd);
+    conn->cork();
+    check(conn->is_corked(), "cork");
+    conn->send(header);
+    conn->sendfile(path);
+    auto corked = data_segs_out(fd) - before;
+    read_exactly(client, header.size() + content.size());
+    std::cout << "header + file: " << plain << " segments, corked " << corked << " segments" << std::endl;
+    check(corked < plain, "header shares a segment with the file");
+    check(!conn->is_corked(), "uncork after first file chunk");
+
+    // 多次小数据发送
+    before = data_segs_out(fd);
+    for(int i = 0; i < 10; ++i) {
+        conn->send("part\r\n");
+    }
+    plain = data_segs_out(fd) - before;
+    read_exactly(client, 60);
+    before = data_segs_out(fd);
+    conn->cork();
+    for(int i = 0; i < 10; ++i) {
+        conn->send("part\r\n");
+    }
+    conn->uncork();
+    corked = data_segs_out(fd) - before;
+    read_exactly(client, 60);
+    std::cout << "10 small sends: " << plain << " segments, corked " << corked << " segments" << std::endl;
+    check(plain == 10 && corked == 1, "coalesce small sends");
+
+    conn->force_close();
+    ::close(client);
+    ::unlink(path);
+    return finish();
+}
@@ -0,0 +1,147 @@
+#include "../net/poller.hpp"
+#include <iostream>
+#include <iomanip>
+
+// 对比原先PollerCB中std::function + std::bind的分发方式和EventPoller::Handler的虚函数分发
+// 1.synthetic：重复分发一组预先填好的epoll_event，只测分发本身的开销
+// 2.epoll：N个socketpair一直处于可读可写状态(水平触发)，每轮epoll_wait后分发全部事件
+using namespace cortono::net;
+using bench_clock = std::chrono::steady_clock;
+
+// 原先的分发方式：else-if链，同时可读可写时只执行读回调
+struct LegacyCB
+{
+    std::function<void()> read_cb, write_cb, close_cb;
+
+    static void dispatch(LegacyCB* cbs, std::uint32_t events) {
+        if(events & EPOLLIN) {
+            cbs->read_cb();
+        }
+        else if(events & EPOLLOUT) {
+            cbs->write_cb();
+        }
+        else {
+            cbs->close_cb();
+        }
+    }
+};
+
+struct FakeConnection
+{
+    std::size_t reads{ 0 }, writes{ 0 };
+
+    void handle_read() { ++reads; }
+    void handle_write() { ++writes; }
+    void handle_close() {  }
+};
+
+struct LegacyConnection : FakeConnection
+{
+    LegacyCB cbs;
+
+    LegacyConnection() {
+        cbs.read_cb = std::bind(&LegacyConnection::handle_read, this);
+        cbs.write_cb = std::bind(&LegacyConnection::handle_write, this);
+        cbs.close_cb = std::bind(&LegacyConnection::handle_close, this);
+    }
+    void* ptr() { return &cbs; }
+    static void dispatch(void* ptr, std::uint32_t events) {
+        LegacyCB::dispatch(static_cast<LegacyCB*>(ptr), events);
+    }
+};
+
+struct HandlerConnection : FakeConnection, EventPoller::Handler
+{
+    void handle_events(std::uint32_t events) override {
+        if(events & EPOLLIN) {
+            handle_read();
+        }
+        if(events & EPOLLOUT) {
+            handle_write();
+        }
+        if(!(events & (EPOLLIN | EPOLLOUT))) {
+            handle_close();
+        }
+    }
+    void* ptr() { return static_cast<EventPoller::Handler*>(this); }
+    static void dispatch(void* ptr, std::uint32_t events) {
+        static_cast<EventPoller::Handler*>(ptr)->handle_events(events);
+    }
+};
+
+template <typename Conn>
+void bench(const char* name, std::size_t n, std::size_t rounds) {
+    std::vector<std::unique_ptr<Conn>> conns;
+    std::vector<struct epoll_event> ready(n);
+    for(std::size_t i = 0; i < n; ++i) {
+        conns.emplace_back(std::make_unique<Conn>());
+        ready[i].events = EPOLLIN | EPOLLOUT;
+        ready[i].data.ptr = conns.back()->ptr();
+    }
+
+    auto start = bench_clock::now();
+    for(std::size_t r = 0; r < rounds; ++r) {
+        for(auto& ev : ready) {
+            Conn::dispatch(ev.data.ptr, ev.events);
+        }
+    }
+    double synthetic = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    int epfd = ::epoll_create1(EPOLL_CLOEXEC);
+    std::vector<int> fds;
+    for(std::size_t i = 0; i < n; ++i) {
+        int sv[2];
+        if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == -1) {
+            std::cerr << "socketpair: " << std::strerror(errno) << ", raise ulimit -n" << std::endl;
+            break;
+        }
+        ::write(sv[1], "x", 1);
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.ptr = conns[i]->ptr();
+        ::epoll_ctl(epfd, EPOLL_CTL_ADD, sv[0], &ev);
+        fds.push_back(sv[0]);
+        fds.push_back(sv[1]);
+    }
+    std::size_t events = 0;
+    std::size_t epoll_rounds = rounds / 10;
+    start = bench_clock::now();
+    for(std::size_t r = 0; r < epoll_rounds; ++r) {
+        int m = ::epoll_wait(epfd, ready.data(), ready.size(), 0);
+        for(int i = 0; i < m; ++i) {
+            Conn::dispatch(ready[i].data.ptr, ready[i].events);
+        }
+        events += m;
+    }
+    double epoll = std::chrono::duration<double>(bench_clock::now() - start).count();
+    for(auto fd : fds) {
+        ::close(fd);
+    }
+    ::close(epfd);
+
+    std::size_t writes = 0;
+    for(auto& c : conns) {
+        writes += c->writes;
+    }
+    std::cout << std::left << std::setw(10) << name
+              << std::right << std::setw(8) << n
+              << std::fixed << std::setprecision(1)
+              << std::setw(16) << n * rounds / synthetic / 1e6
+              << std::setw(16) << events / epoll / 1e6
+              << std::setw(14) << writes << std::endl;
+}
+
+int main()
+{
+    std::cout << std::left << std::setw(10) << "impl"
+              << std::right << std::setw(8) << "fds"
+              << std::setw(16) << "synthetic(M/s)"
+              << std::setw(16) << "epoll(M/s)"
+              << std::setw(14) << "write calls" << std::endl;
+    for(std::size_t n : { 64, 1024, 8192 }) {
+        std::size_t rounds = 20'000'000 / n;
+        bench<LegacyConnection>("function", n, rounds);
+        bench<HandlerConnection>("handler", n, rounds);
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "../util/file_cache.hpp"
+#include <iostream>
+#include "check.hpp"
+
+// 测试打开文件缓存
+// 1.ttl内命中不访问文件系统，超过ttl后stat确认，文件改变后重新打开
+// 2.删除的文件返回nullptr，淘汰后仍被持有的fd可以继续读取
+using namespace cortono;
+
+void write_file(const std::string& path, const std::string& content) {
+    std::ofstream fout{ path, std::ios_base::out | std::ios_base::trunc };
+    fout << content;
+}
+
+std::string read_fd(int fd, std::size_t size) {
+    std::string content(size, '\0');
+    auto n = ::pread(fd, content.data(), size, 0);
+    content.resize(n > 0 ? n : 0);
+    return content;
+}
+
+int main()
+{
+    char dir_template[] = "/tmp/file_cache_test.XXXXXX";
+    std::string dir = ::mkdtemp(dir_template);
+    auto path = dir + "/a.txt";
+    write_file(path, "hello");
+
+    auto& cache = util::file_cache::instance();
+    cache.set_ttl(std::chrono::milliseconds(100));
+
+    auto first = cache.open(path);
+    check(first && first->fd != -1 && first->size == 5 && !first->etag.empty(), "open file");
+    auto second = cache.open(path);
+    check(second == first && cache.stats().hits == 1, "hit within ttl");
+
+    // 超过ttl，文件没有改变
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    auto third = cache.open(path);
+    check(third == first && cache.stats().revalidations == 1, "revalidate after ttl");
+
+    // 文件改变后重新打开，旧的fd仍然有效
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    write_file(path, "hello world");
+    auto changed = cache.open(path);
+    check(changed && changed != first && changed->size == 11 && changed->etag != first->etag, "reopen changed file");
+    check(read_fd(first->fd, 11) == "hello world" && cache.stats().misses == 2, "old handle still readable");
+
+    // 目录缓存但没有fd
+    auto directory = cache.open(dir);
+    check(directory && directory->directory && directory->fd == -1, "directory entry");
+
+    // 淘汰后仍然持有的fd不会被关闭
+    cache.set_capacity(1);
+    std::vector<util::file_cache::handle> handles;
+    for(int i = 0; i < 40; ++i) {
+        auto other = dir + "/" + std::to_string(i);
+        write_file(other, std::to_string(i));
+        handles.push_back(cache.open(other));
+    }
+    check(read_fd(handles[0]->fd, 1) == "0", "evicted handle keeps fd open");
+
+    // 删除的文件
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    ::unlink(path.data());
+    check(cache.open(path) == nullptr, "removed file");
+    check(cache.open(dir + "/missing") == nullptr, "missing file");
+
+    for(int i = 0; i < 40; ++i) {
+        ::unlink((dir + "/" + std::to_string(i)).data());
+    }
+    ::rmdir(dir.data());
+    return finish();
+}
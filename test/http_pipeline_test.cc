@@ -0,0 +1,101 @@
+#include "../http/app.hpp"
+#include <iostream>
+#include <sys/wait.h>
+#include "check.hpp"
+
+// 测试流水线请求中的静态文件
+// 1.子进程运行SimpleApp，/file返回一个8MB的文件，/s返回一个短字符串
+// 2.一次写入两个请求之后暂停读取，文件发送到一半时后一个响应已经生成，必须排在文件后面
+// 3.两个响应体逐字节比较
+using namespace cortono;
+
+constexpr unsigned short PORT = 9961;
+constexpr std::size_t FILE_SIZE = 8 * 1000 * 1000;
+
+int connect_server() {
+    auto addr = ip::address::to_sockaddr("127.0.0.1", PORT);
+    for(int i = 0; i < 100; ++i) {
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(::connect(fd, &addr, sizeof(addr)) == 0) {
+            // 响应错乱时长度对不上，不能一直阻塞在read中
+            struct timeval timeout{ 5, 0 };
+            ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return fd;
+        }
+        ::close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return -1;
+}
+
+// 读取一个响应，返回响应体，出错时返回std::nullopt
+std::optional<std::string> read_response(int fd, std::string& buffer) {
+    char chunk[65536];
+    std::size_t header_end;
+    while((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        auto n = ::read(fd, chunk, sizeof(chunk));
+        if(n <= 0) {
+            return std::nullopt;
+        }
+        buffer.append(chunk, n);
+    }
+    auto header = buffer.substr(0, header_end);
+    auto pos = header.find("Content-Length: ");
+    if(header.compare(0, 12, "HTTP/1.1 200") != 0 || pos == std::string::npos) {
+        return std::nullopt;
+    }
+    auto length = std::stoul(header.substr(pos + 16));
+    buffer.erase(0, header_end + 4);
+    while(buffer.size() < length) {
+        auto n = ::read(fd, chunk, sizeof(chunk));
+        if(n <= 0) {
+            return std::nullopt;
+        }
+        buffer.append(chunk, n);
+    }
+    auto body = buffer.substr(0, length);
+    buffer.erase(0, length);
+    return body;
+}
+
+int main()
+{
+    util::logger::close_logger();
+    char path[] = "/tmp/http_pipeline_test.XXXXXX";
+    int file_fd = ::mkstemp(path);
+    std::string content(FILE_SIZE, '\0');
+    for(std::size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>('a' + (i * 7 + i / 4096) % 26);
+    }
+    ::write(file_fd, content.data(), content.size());
+    ::close(file_fd);
+
+    auto pid = ::fork();
+    if(pid == 0) {
+        http::SimpleApp app;
+        app.register_rule("/file")([&path](const http::Request&, http::Response& res) { res.send_file(path); });
+        app.register_rule("/s")([] { return std::string("small response"); });
+        app.bindaddr("127.0.0.1").port(PORT).run();
+        std::_Exit(0);
+    }
+
+    int fd = connect_server();
+    check(fd != -1, "connect");
+    std::string requests = "GET /file HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                           "GET /s HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    ::write(fd, requests.data(), requests.size());
+    // 等服务端把套接字写满，文件停在中间
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::string buffer;
+    auto file_body = read_response(fd, buffer);
+    auto small_body = read_response(fd, buffer);
+    check(file_body && *file_body == content, "file body intact");
+    check(small_body && *small_body == "small response", "second response after the file");
+    check(buffer.empty(), "nothing else on the wire");
+
+    ::close(fd);
+    ::kill(pid, SIGKILL);
+    ::waitpid(pid, nullptr, 0);
+    ::unlink(path);
+    return finish();
+}
@@ -0,0 +1,191 @@
+// 编译期丢弃trace和debug
+#define CORTONO_LOG_LEVEL 2
+#include "../util/util.hpp"
+#include <iostream>
+#include "check.hpp"
+
+// 测试日志
+// 1.低于CORTONO_LOG_LEVEL的日志参数不会求值，set_level在运行时过滤
+// 2.多个线程通过log_writer写到文件，条数完整，每行不交错
+// 3.超过rotate_bytes时切分文件，缓冲区满时丢弃并计数，fatal日志不丢弃
+using namespace cortono;
+
+int evaluated = 0;
+
+std::string touch() {
+    ++evaluated;
+    return "touched";
+}
+
+std::vector<std::string> read_lines(const std::string& path) {
+    std::vector<std::string> lines;
+    std::ifstream fin(path);
+    std::string line;
+    while(std::getline(fin, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+std::string temp_path(const std::string& name) {
+    auto path = "/tmp/logger_test." + std::to_string(::getpid()) + "." + name;
+    ::unlink(path.data());
+    for(int i = 1; i <= 8; ++i) {
+        ::unlink((path + "." + std::to_string(i)).data());
+    }
+    return path;
+}
+
+int main()
+{
+    auto& writer = util::log_writer::instance();
+
+    // 编译期和运行时过滤
+    auto path = temp_path("level");
+    check(writer.start({ path }), "start writer");
+    log_trace(touch());
+    log_debug(touch());
+    check(evaluated == 0, "compile time filter skips arguments");
+    log_info(touch());
+    check(evaluated == 1, "info evaluated");
+    util::logger::set_level(util::logger::error);
+    log_info(touch());
+    check(evaluated == 1, "runtime filter skips arguments");
+    log_error("error ", 42, ' ', true);
+    util::logger::set_level(util::logger::trace);
+    // 参数求值时写日志
+    log_info("outer ", [] { log_info("inner"); return 1; }());
+    writer.stop();
+    auto lines = read_lines(path);
+    check(lines.size() == 4, "four lines written");
+    check(lines.size() == 4
+          && lines[0].find("[Info]") != std::string::npos && lines[0].find("touched") != std::string::npos
+          && lines[1].find("[Error]") != std::string::npos && lines[1].find("error 42 1") != std::string::npos
+          && lines[2].find("inner") != std::string::npos && lines[3].find("outer 1") != std::string::npos,
+          "line content");
+    ::unlink(path.data());
+
+    // 多线程写，缓冲区能放下所有日志，不依赖后台线程的调度
+    path = temp_path("threads");
+    util::log_writer::options opts;
+    opts.path = path;
+    opts.ring_bytes = 4 * 1024 * 1024;
+    check(writer.start(opts), "restart writer");
+    constexpr int THREADS = 4, PER_THREAD = 20000;
+    auto before = writer.stats();
+    std::vector<std::thread> threads;
+    for(int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([t] {
+            for(int i = 0; i < PER_THREAD; ++i) {
+                log_info("thread ", t, " message ", i);
+                if(i % 1000 == 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    writer.stop();
+    auto after = writer.stats();
+    lines = read_lines(path);
+    std::vector<int> next(THREADS, 0);
+    bool ordered = true;
+    for(auto& line : lines) {
+        int t, i;
+        auto pos = line.find("thread ");
+        if(pos == std::string::npos || std::sscanf(line.data() + pos, "thread %d message %d", &t, &i) != 2
+           || t < 0 || t >= THREADS || next[t] != i) {
+            ordered = false;
+            break;
+        }
+        ++next[t];
+    }
+    std::cout << "written " << after.written - before.written << ", dropped " << after.dropped - before.dropped
+              << ", batches " << after.batches - before.batches << std::endl;
+    check(after.dropped == before.dropped, "nothing dropped");
+    check(lines.size() == THREADS * PER_THREAD, "all lines written");
+    check(ordered, "per thread order and whole lines");
+    ::unlink(path.data());
+
+    // 切分文件
+    path = temp_path("rotate");
+    opts = {};
+    opts.path = path;
+    opts.rotate_bytes = 16 * 1024;
+    opts.keep_files = 8;
+    before = writer.stats();
+    check(writer.start(opts), "start writer with rotation");
+    for(int i = 0; i < 1000; ++i) {
+        log_info("rotate message ", i);
+        if(i % 50 == 0) {
+            writer.flush();
+        }
+    }
+    writer.stop();
+    after = writer.stats();
+    std::size_t total = 0, files = 0;
+    for(int i = 0; i <= 8; ++i) {
+        auto file = i == 0 ? path : path + "." + std::to_string(i);
+        struct stat st;
+        if(::stat(file.data(), &st) == 0) {
+            ++files;
+            total += read_lines(file).size();
+            check(i == 0 || static_cast<std::size_t>(st.st_size) >= opts.rotate_bytes, "rotated file " + std::to_string(i) + " size");
+        }
+        ::unlink(file.data());
+    }
+    std::cout << "rotations " << after.rotations - before.rotations << ", files " << files << ", lines " << total << std::endl;
+    check(after.rotations > before.rotations && files > 1, "rotate");
+    check(total == 1000, "rotated lines kept");
+
+    // 缓冲区满时丢弃
+    path = temp_path("drop");
+    opts = {};
+    opts.path = path;
+    opts.ring_bytes = 4096;
+    opts.flush_interval = std::chrono::milliseconds(1000);
+    before = writer.stats();
+    check(writer.start(opts), "start writer with small ring");
+    std::string payload(100, 'x');
+    for(int i = 0; i < 1000; ++i) {
+        log_info(payload);
+    }
+    writer.stop();
+    after = writer.stats();
+    auto written = after.written - before.written, dropped = after.dropped - before.dropped;
+    std::cout << "written " << written << ", dropped " << dropped << std::endl;
+    check(dropped > 0 && written + dropped == 1000, "drop when ring is full");
+    lines = read_lines(path);
+    std::size_t notices = 0, noticed = 0;
+    for(auto& line : lines) {
+        std::size_t n;
+        if(std::sscanf(line.data(), "[log_writer] %zu log messages dropped", &n) == 1) {
+            ++notices;
+            noticed += n;
+        }
+    }
+    check(lines.size() == written + notices && noticed == dropped, "dropped notice");
+    ::unlink(path.data());
+
+    // 缓冲区满时fatal日志仍然写出，在子进程中abort
+    path = temp_path("fatal");
+    opts.path = path;
+    auto pid = ::fork();
+    if(pid == 0) {
+        writer.start(opts);
+        for(int i = 0; i < 1000; ++i) {
+            log_info(payload);
+        }
+        log_fatal("last words");
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    lines = read_lines(path);
+    check(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT, "fatal aborts");
+    check(!lines.empty() && lines.back().find("last words") != std::string::npos, "fatal written when ring is full");
+    ::unlink(path.data());
+
+    return finish();
+}
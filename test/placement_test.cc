@@ -0,0 +1,189 @@
+#include "../net/eventloop.hpp"
+#include "../net/placement.hpp"
+#include <iostream>
+#include <iomanip>
+
+// 模拟不均衡负载下各个分配策略的效果
+// 1.每轮到达一批长连接，每个连接每轮产生weight个事件，平均存活LIFETIME轮
+// 2.每4个连接中有1个重连接(p2p会话、代理隧道)，其余连接的权重服从Pareto分布
+//   重连接的到达周期和loop数相同，轮询时全部落在同一个loop上
+// 3.和真实的loop一样，连接数和队列深度在每轮结束时才更新，同一批到达的连接看到的是同一份快照
+//   和Adaptor一样每批到达的连接使用一个LoopSelector::Batch
+// 输出每个loop队列深度的p99，以及最大p99和最小p99之比
+// 4.真实的EventLoop，按queue_depth()分配一批连接，不能全部分到同一个loop
+using namespace cortono::net;
+
+constexpr std::size_t LOOPS = 4;
+constexpr std::size_t ROUNDS = 6000;
+constexpr std::size_t WARMUP = 2000;
+constexpr std::size_t ARRIVALS = 8;
+constexpr std::size_t LIFETIME = 500;
+constexpr std::size_t HEAVY_WEIGHT = 16;
+
+struct Conn
+{
+    std::size_t loop;
+    std::size_t weight;
+};
+
+double simulate(Placement policy) {
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    LoopSelector selector(policy);
+    std::vector<Conn> conns;
+    std::array<LoopLoad, LOOPS> published{};
+    std::array<std::vector<std::size_t>, LOOPS> depths;
+    std::size_t next_id = 0;
+    LoopSelector::Batch batch;
+
+    for(std::size_t round = 0; round < ROUNDS; ++round) {
+        batch.clear();
+        for(std::size_t k = 0; k < ARRIVALS; ++k) {
+            auto id = next_id++;
+            std::size_t weight = id % LOOPS == 0
+                ? HEAVY_WEIGHT
+                : static_cast<std::size_t>(1.0 / std::pow(1.0 - uniform(rng), 1.0 / 1.5));
+            auto loop = selector.select(LOOPS, [&](std::size_t i) { return published[i]; }, batch);
+            conns.push_back({ loop, std::min<std::size_t>(weight, HEAVY_WEIGHT) });
+        }
+        conns.erase(std::remove_if(conns.begin(), conns.end(), [&](auto&) {
+            return uniform(rng) < 1.0 / LIFETIME;
+        }), conns.end());
+
+        std::array<LoopLoad, LOOPS> load{};
+        for(auto& c : conns) {
+            ++load[c.loop].connections;
+            load[c.loop].depth += c.weight;
+        }
+        published = load;
+        if(round >= WARMUP) {
+            for(std::size_t i = 0; i < LOOPS; ++i) {
+                depths[i].push_back(load[i].depth);
+            }
+        }
+    }
+
+    std::size_t lo = SIZE_MAX, hi = 0;
+    std::cout << std::left << std::setw(20) << [policy] {
+        switch(policy) {
+            case Placement::RoundRobin:        return "round-robin";
+            case Placement::LeastConnections:  return "least-connections";
+            case Placement::LeastQueueDepth:   return "least-queue-depth";
+            case Placement::PowerOfTwoChoices: return "power-of-two";
+        }
+        return "";
+    }() << std::right;
+    for(auto& d : depths) {
+        std::sort(d.begin(), d.end());
+        auto p99 = d[d.size() * 99 / 100];
+        lo = std::min(lo, p99);
+        hi = std::max(hi, p99);
+        std::cout << std::setw(10) << p99;
+    }
+    double spread = static_cast<double>(hi) / lo;
+    std::cout << std::fixed << std::setprecision(2) << std::setw(10) << spread << std::endl;
+    return spread;
+}
+
+// 每个loop在自己的线程中运行，busy为true时周期性地投递任务，queue_depth()保持在BUSY_TASKS左右
+struct LoopThread
+{
+    static constexpr std::size_t BUSY_TASKS = 3;
+
+    explicit LoopThread(bool busy) {
+        std::promise<EventLoop*> started;
+        thread = std::thread([this, busy, &started] {
+            EventLoop loop;
+            if(busy) {
+                loop.run_every(Timer::microseconds(500), [&loop] {
+                    for(std::size_t i = 0; i < BUSY_TASKS; ++i) {
+                        loop.queue_call([] {});
+                    }
+                });
+            }
+            started.set_value(&loop);
+            loop.loop();
+        });
+        loop = started.get_future().get();
+    }
+    ~LoopThread() {
+        loop->safe_call([loop = loop] { loop->quit(); });
+        thread.join();
+    }
+
+    EventLoop* loop;
+    std::thread thread;
+};
+
+// 一批8个连接，只有第2个loop空闲，返回分到每个loop的连接数
+std::array<std::size_t, LOOPS> place_batch(Placement policy, bool use_batch) {
+    std::array<std::unique_ptr<LoopThread>, LOOPS> loops;
+    for(std::size_t i = 0; i < LOOPS; ++i) {
+        loops[i] = std::make_unique<LoopThread>(i != 2);
+    }
+    // 等待繁忙loop的深度更新
+    auto busy_ready = [&loops] {
+        for(std::size_t i = 0; i < LOOPS; ++i) {
+            if(i != 2 && loops[i]->loop->queue_depth() == 0) {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(!busy_ready() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    LoopSelector selector(policy);
+    LoopSelector::Batch batch;
+    std::array<std::size_t, LOOPS> assigned{};
+    auto load_of = [&loops](std::size_t i) {
+        // 繁忙loop上已经有连接
+        return LoopLoad{ i == 2 ? 0 : LoopThread::BUSY_TASKS, loops[i]->loop->queue_depth() };
+    };
+    for(std::size_t k = 0; k < ARRIVALS; ++k) {
+        auto i = use_batch ? selector.select(LOOPS, load_of, batch) : selector.select(LOOPS, load_of);
+        ++assigned[i];
+    }
+    return assigned;
+}
+
+int main()
+{
+    cortono::util::logger::close_logger();
+
+    std::cout << std::left << std::setw(20) << "policy" << std::right;
+    for(std::size_t i = 0; i < LOOPS; ++i) {
+        std::cout << std::setw(10) << ("p99#" + std::to_string(i));
+    }
+    std::cout << std::setw(10) << "max/min" << std::endl;
+
+    auto rr = simulate(Placement::RoundRobin);
+    simulate(Placement::LeastConnections);
+    auto lqd = simulate(Placement::LeastQueueDepth);
+    auto p2c = simulate(Placement::PowerOfTwoChoices);
+
+    // 负载感知的策略应当让各个loop的p99深度收敛
+    if(lqd >= rr || p2c >= rr || lqd > 1.25 || p2c > 1.25) {
+        std::cout << "FAIL: queue depth did not converge" << std::endl;
+        return 1;
+    }
+
+    // 没有Batch时同一批连接读到的是同一份快照，全部分到空闲的loop
+    for(auto policy : { Placement::LeastQueueDepth, Placement::LeastConnections }) {
+        auto herd = place_batch(policy, false);
+        auto spread = place_batch(policy, true);
+        auto name = policy == Placement::LeastQueueDepth ? "least-queue-depth" : "least-connections";
+        std::cout << name << " batch of " << ARRIVALS << " without/with Batch:";
+        for(std::size_t i = 0; i < LOOPS; ++i) {
+            std::cout << ' ' << herd[i] << '/' << spread[i];
+        }
+        std::cout << std::endl;
+        if(herd[2] != ARRIVALS || spread[2] == 0 || spread[2] == ARRIVALS) {
+            std::cout << "FAIL: batch placement herded on one loop" << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "../net/connection.hpp"
+#include <iostream>
+#include "check.hpp"
+
+// 测试和数据一起到达的FIN
+// 1.客户端写入数据后立即shutdown(SHUT_WR)，loop端在一次可读通知中同时看到数据和FIN
+// 2.边缘触发下不会再有通知，连接必须读到返回0，回显数据之后关闭并调用on_close
+using namespace cortono;
+using namespace cortono::net;
+
+// 返回{阻塞的外部端, 非阻塞的loop端}
+std::pair<int, int> tcp_pair() {
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    auto addr = ip::address::to_sockaddr("127.0.0.1", 0);
+    ::bind(listen_fd, &addr, sizeof(addr));
+    ::listen(listen_fd, 1);
+    socklen_t len = sizeof(addr);
+    ::getsockname(listen_fd, &addr, &len);
+    int outer = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ::connect(outer, &addr, sizeof(addr));
+    int inner = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    ::close(listen_fd);
+    return { outer, inner };
+}
+
+std::string read_all(int fd) {
+    std::string data;
+    char buffer[65536];
+    ssize_t n;
+    while((n = ::read(fd, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, n);
+    }
+    return data;
+}
+
+int main()
+{
+    util::logger::close_logger();
+    EventLoop loop;
+    loop.run_every(Timer::milliseconds(10), [] {});
+    auto wait_until = [&loop](auto pred) {
+        auto deadline = Timer::now() + Timer::milliseconds(3000);
+        while(!pred() && Timer::now() < deadline) {
+            loop.loop_once();
+        }
+    };
+
+    for(std::size_t size : { std::size_t(5), std::size_t(100 * 1024) }) {
+        auto [client, fd] = tcp_pair();
+        std::string payload(size, 'e');
+        check(::write(client, payload.data(), payload.size()) == static_cast<ssize_t>(payload.size()), "write payload");
+        ::shutdown(client, SHUT_WR);
+        // 数据和FIN都已经到达之后才注册到loop
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        auto conn = std::make_shared<TcpConnection>(&loop, fd);
+        conn->set_conn_state(TcpConnection::ConnState::Connected);
+        std::size_t received = 0;
+        bool closed = false;
+        conn->on_read([&received](auto c) {
+            auto data = c->recv_all();
+            received += data.size();
+            c->send(data);
+        });
+        conn->on_close([&closed](auto) { closed = true; });
+        wait_until([&] { return closed; });
+        auto size_name = std::to_string(size) + " bytes";
+        check(received == size, "read data before FIN, " + size_name);
+        check(closed, "close on FIN read with data, " + size_name);
+        if(!closed) {
+            conn->force_close();
+        }
+        // 释放连接之后套接字才关闭，客户端才能读到EOF
+        conn.reset();
+        loop.handle_pending_func();
+        check(read_all(client) == payload, "echo before close, " + size_name);
+        ::close(client);
+    }
+    return finish();
+}
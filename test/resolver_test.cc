@@ -0,0 +1,192 @@
+#include "../net/resolver.hpp"
+#include <iostream>
+#include "check.hpp"
+
+// 在本机启动一个DNS桩服务器，测试Resolver
+// 1.a.test返回10.0.0.1，TTL为1秒，应答中的名字使用压缩指针
+// 2.b.test返回两条A记录，nx.test返回NXDOMAIN(SOA的minimum为1秒)
+// 3.fail.test返回SERVFAIL，slow.test不应答
+// 桩服务器记录每个名字收到的查询次数，用于检查合并和缓存
+using namespace cortono;
+using namespace cortono::net;
+
+class StubServer
+{
+    public:
+        StubServer() {
+            fd_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            auto addr = ip::address::to_sockaddr("127.0.0.1", 0);
+            ::bind(fd_, &addr, sizeof(addr));
+            struct timeval tv{ 0, 100 * 1000 };
+            ::setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            socklen_t len = sizeof(addr_);
+            ::getsockname(fd_, reinterpret_cast<struct sockaddr*>(&addr_), &len);
+            thread_ = std::thread([this] { run(); });
+        }
+        ~StubServer() {
+            quit_ = true;
+            thread_.join();
+            ::close(fd_);
+        }
+        struct sockaddr_in address() const {
+            return addr_;
+        }
+        int queries(const std::string& name) {
+            std::unique_lock lock{ mutex_ };
+            return counts_[name];
+        }
+
+    private:
+        void run() {
+            unsigned char buffer[512];
+            while(!quit_) {
+                struct sockaddr_in from;
+                socklen_t len = sizeof(from);
+                auto n = ::recvfrom(fd_, buffer, sizeof(buffer), 0, reinterpret_cast<struct sockaddr*>(&from), &len);
+                if(n < 12) {
+                    continue;
+                }
+                std::string name;
+                std::size_t pos = 12;
+                while(pos < static_cast<std::size_t>(n) && buffer[pos] != 0) {
+                    if(!name.empty()) {
+                        name.push_back('.');
+                    }
+                    name.append(reinterpret_cast<char*>(buffer + pos + 1), buffer[pos]);
+                    pos += buffer[pos] + 1;
+                }
+                pos += 5;
+                {
+                    std::unique_lock lock{ mutex_ };
+                    ++counts_[name];
+                }
+                if(name == "slow.test") {
+                    continue;
+                }
+                std::string reply(reinterpret_cast<char*>(buffer), pos);
+                reply[2] = static_cast<char>(0x81);
+                reply[3] = static_cast<char>(0x80);
+                if(name == "a.test") {
+                    reply[7] = 1;
+                    add_a(reply, 1, "\x0a\x00\x00\x01");
+                }
+                else if(name == "b.test") {
+                    reply[7] = 2;
+                    add_a(reply, 60, "\x0a\x00\x00\x02");
+                    add_a(reply, 60, "\x0a\x00\x00\x03");
+                }
+                else if(name == "nx.test") {
+                    reply[3] |= 3;
+                    reply[9] = 1;
+                    // SOA: mname、rname均为压缩指针，serial/refresh/retry/expire/minimum
+                    reply.append("\xc0\x0c\x00\x06\x00\x01\x00\x00\x00\x3c\x00\x18", 12);
+                    reply.append("\xc0\x0c\xc0\x0c", 4);
+                    reply.append("\x00\x00\x00\x01\x00\x00\x00\x01\x00\x00\x00\x01\x00\x00\x00\x01\x00\x00\x00\x01", 20);
+                }
+                else {
+                    reply[3] |= 2;
+                }
+                ::sendto(fd_, reply.data(), reply.size(), 0, reinterpret_cast<struct sockaddr*>(&from), len);
+            }
+        }
+        static void add_a(std::string& reply, std::uint8_t ttl, const char* ip) {
+            reply.append("\xc0\x0c\x00\x01\x00\x01\x00\x00\x00", 9);
+            reply.push_back(static_cast<char>(ttl));
+            reply.append("\x00\x04", 2);
+            reply.append(ip, 4);
+        }
+
+        int fd_;
+        struct sockaddr_in addr_;
+        std::thread thread_;
+        std::atomic<bool> quit_{ false };
+        std::mutex mutex_;
+        std::unordered_map<std::string, int> counts_;
+};
+
+int main()
+{
+    StubServer server;
+    Resolver::Options options;
+    options.nameservers = { server.address() };
+    options.timeout = Timer::milliseconds(200);
+    options.attempts = 2;
+    options.negative_ttl = std::chrono::seconds(30);
+    Resolver::set_options(options);
+
+    EventLoop loop;
+    // 保证loop_once不会无限阻塞
+    loop.run_every(Timer::milliseconds(10), [] {});
+    auto& resolver = Resolver::of(&loop);
+    auto wait_until = [&loop](auto pred) {
+        auto deadline = Timer::now() + Timer::milliseconds(3000);
+        while(!pred() && Timer::now() < deadline) {
+            loop.loop_once();
+        }
+    };
+
+    // 同时发起的三个请求只产生一次查询
+    std::vector<Resolver::Addresses> results;
+    for(int i = 0; i < 3; ++i) {
+        resolver.resolve("A.Test.", [&results](auto& addresses) { results.push_back(addresses); });
+    }
+    wait_until([&] { return results.size() == 3; });
+    check(results.size() == 3 && results[2] == Resolver::Addresses{ "10.0.0.1" }, "resolve a.test");
+    check(server.queries("a.test") == 1, "coalesce concurrent lookups");
+
+    // 命中缓存时直接回调
+    bool hit = false;
+    resolver.resolve("a.test", [&hit](auto& addresses) { hit = addresses.size() == 1; });
+    check(hit && server.queries("a.test") == 1, "positive cache hit");
+
+    // TTL过期后重新查询
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    loop.loop_once();
+    bool done = false;
+    resolver.resolve("a.test", [&done](auto&) { done = true; });
+    wait_until([&] { return done; });
+    check(done && server.queries("a.test") == 2, "re-query after ttl expires");
+
+    Resolver::Addresses b;
+    done = false;
+    resolver.resolve("b.test", [&](auto& addresses) { b = addresses; done = true; });
+    wait_until([&] { return done; });
+    check(b.size() == 2, "multiple A records");
+
+    // 否定缓存，TTL取SOA的minimum
+    done = false;
+    bool empty = false;
+    resolver.resolve("nx.test", [&](auto& addresses) { empty = addresses.empty(); done = true; });
+    wait_until([&] { return done; });
+    done = false;
+    resolver.resolve("nx.test", [&](auto&) { done = true; });
+    check(empty && done && server.queries("nx.test") == 1, "negative cache hit");
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    loop.loop_once();
+    done = false;
+    resolver.resolve("nx.test", [&done](auto&) { done = true; });
+    wait_until([&] { return done; });
+    check(server.queries("nx.test") == 2, "negative entry expires with soa minimum");
+
+    // 失败时重试attempts次，回调空列表，不写入缓存
+    for(auto name : { "fail.test", "slow.test" }) {
+        done = false;
+        empty = false;
+        resolver.resolve(name, [&](auto& addresses) { empty = addresses.empty(); done = true; });
+        wait_until([&] { return done; });
+        check(done && empty && server.queries(name) == 2, std::string(name) + " fails after retries");
+        done = false;
+        resolver.resolve(name, [&](auto&) { done = true; });
+        check(!done, std::string(name) + " is not cached");
+        wait_until([&] { return done; });
+    }
+
+    // IP地址和/etc/hosts不经过DNS
+    Resolver::Addresses literal, local;
+    resolver.resolve("192.168.1.1", [&](auto& addresses) { literal = addresses; });
+    resolver.resolve("localhost", [&](auto& addresses) { local = addresses; });
+    check(literal == Resolver::Addresses{ "192.168.1.1" }, "ip literal");
+    check(!local.empty() && server.queries("localhost") == 0, "hosts file");
+
+    return finish();
+}
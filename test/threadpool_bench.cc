@@ -0,0 +1,282 @@
+#include "../util/threadpool.hpp"
+#include <iostream>
+#include <iomanip>
+
+// 对比原先的线程池(一个加锁的std::queue<std::function>)和工作窃取线程池，两边使用同样的接口
+// 1.external：在外部线程中提交N个小任务，分别用post和async
+// 2.spawn：在一个池内任务中提交N个小任务，工作窃取线程池放入本线程的队列
+// 3.parallel_for：对N个元素求和，原先的线程池按同样的粒度切分后逐块async
+// 同时统计每个任务的内存分配次数(parallel_for为每块)，捕获std::string和shared_ptr的闭包(rich)在工作窃取线程池中也不分配内存
+using namespace cortono;
+using bench_clock = std::chrono::steady_clock;
+
+std::atomic<std::size_t> allocations{ 0 };
+
+// 通过函数指针调用，否则编译器内联后会把malloc和operator delete当作不匹配的分配函数
+void* (*volatile raw_malloc)(std::size_t) = std::malloc;
+void (*volatile raw_free)(void*) = std::free;
+
+void* operator new(std::size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(auto p = raw_malloc(n); p) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept {
+    raw_free(p);
+}
+void operator delete(void* p, std::size_t) noexcept {
+    raw_free(p);
+}
+
+constexpr std::size_t TASK_NUMS = 1'000'000;
+
+// 原先的util::threadpool
+class legacy_threadpool
+{
+    public:
+        ~legacy_threadpool() {
+            quit();
+        }
+        void start(int thread_nums) {
+            for(int i = 0; i < thread_nums; ++i) {
+                threads_.emplace_back([this] {
+                    while(!quit_) {
+                        std::function<void()> task;
+                        {
+                            std::unique_lock lock { mutex_ };
+                            cond_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
+                            if(quit_)   return;
+                            task = tasks_.front();
+                            tasks_.pop();
+                        }
+                        task();
+                    }
+                });
+            }
+        }
+        void quit() {
+            quit_ = true;
+            cond_.notify_all();
+            for(auto& th : threads_)
+                th.join();
+            threads_.clear();
+        }
+        template <typename F>
+        void post(F&& f) {
+            std::unique_lock lock { mutex_ };
+            tasks_.emplace(std::forward<F>(f));
+            cond_.notify_one();
+        }
+        template <class F, class... Args>
+        auto async(F&& f, Args... args)
+            -> std::future<typename std::result_of<F(Args...)>::type>
+        {
+            using return_type = typename std::result_of<F(Args...)>::type;
+            auto task = std::make_shared<std::packaged_task<return_type()>>(
+                        std::bind(std::forward<F>(f), std::forward<Args>(args)...)
+                    );
+            std::future result { task->get_future() };
+            {
+                std::unique_lock lock { mutex_ };
+                tasks_.emplace( [task] { return (*task)(); });
+                cond_.notify_one();
+            }
+            return result;
+        }
+    private:
+        std::atomic<bool> quit_{ false };
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        std::vector<std::thread> threads_;
+        std::queue<std::function<void()>> tasks_;
+};
+
+void wait_for(std::atomic<std::size_t>& done, std::size_t n) {
+    while(done.load(std::memory_order_acquire) < n) {
+        std::this_thread::yield();
+    }
+}
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+struct result
+{
+    double seconds;
+    double allocs;
+};
+
+// 从提交第一个任务到done达到TASK_NUMS，统计耗时和每个任务的分配次数
+template <typename F>
+result measure(std::atomic<std::size_t>& done, F&& submit_all) {
+    done = 0;
+    auto before = allocations.load();
+    auto start = bench_clock::now();
+    submit_all();
+    wait_for(done, TASK_NUMS);
+    return { seconds_since(start), static_cast<double>(allocations.load() - before) / TASK_NUMS };
+}
+
+void report(const char* name, result legacy, result stealing) {
+    std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(14) << TASK_NUMS / legacy.seconds / 1e6
+              << std::setw(14) << TASK_NUMS / stealing.seconds / 1e6
+              << std::setw(10) << legacy.seconds / stealing.seconds << "x"
+              << std::setprecision(2) << std::setw(10) << legacy.allocs << std::setw(10) << stealing.allocs << std::endl;
+}
+
+int main()
+{
+    int thread_nums = std::max(2u, std::thread::hardware_concurrency());
+    std::cout << "threads: " << thread_nums << ", tasks: " << TASK_NUMS << std::endl;
+    std::cout << std::left << std::setw(16) << "case" << std::right
+              << std::setw(14) << "legacy(M/s)"
+              << std::setw(14) << "stealing(M/s)"
+              << std::setw(11) << "speedup"
+              << std::setw(10) << "alloc/L"
+              << std::setw(10) << "alloc/S" << std::endl;
+
+    std::atomic<std::size_t> done{ 0 };
+    auto tiny = [&done] { done.fetch_add(1, std::memory_order_relaxed); };
+    // 不可平凡复制的小闭包
+    auto token = std::make_shared<int>(0);
+    auto rich = [&done, token, name = std::string("small string")] {
+        if(!name.empty() && token) {
+            done.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+    result legacy, stealing;
+
+    auto external = [&](const char* name, auto task, bool use_async) {
+        {
+            legacy_threadpool pool;
+            pool.start(thread_nums);
+            legacy = measure(done, [&] {
+                for(std::size_t i = 0; i < TASK_NUMS; ++i) {
+                    if(use_async) {
+                        pool.async(task);
+                    }
+                    else {
+                        pool.post(task);
+                    }
+                }
+            });
+        }
+        {
+            util::threadpool pool(thread_nums);
+            stealing = measure(done, [&] {
+                for(std::size_t i = 0; i < TASK_NUMS; ++i) {
+                    if(use_async) {
+                        pool.async(task);
+                    }
+                    else {
+                        pool.post(task);
+                    }
+                }
+            });
+        }
+        report(name, legacy, stealing);
+    };
+    external("external post", tiny, false);
+    external("external rich", rich, false);
+    external("external async", tiny, true);
+
+    auto spawn = [&](const char* name, bool use_async) {
+        {
+            legacy_threadpool pool;
+            pool.start(thread_nums);
+            legacy = measure(done, [&] {
+                pool.post([&pool, &tiny, use_async] {
+                    for(std::size_t i = 0; i < TASK_NUMS; ++i) {
+                        if(use_async) {
+                            pool.async(tiny);
+                        }
+                        else {
+                            pool.post(tiny);
+                        }
+                    }
+                });
+            });
+        }
+        {
+            util::threadpool pool(thread_nums);
+            stealing = measure(done, [&] {
+                pool.post([&pool, &tiny, use_async] {
+                    for(std::size_t i = 0; i < TASK_NUMS; ++i) {
+                        if(use_async) {
+                            pool.async(tiny);
+                        }
+                        else {
+                            pool.post(tiny);
+                        }
+                    }
+                });
+            });
+        }
+        report(name, legacy, stealing);
+    };
+    spawn("spawn post", false);
+    spawn("spawn async", true);
+    // 任务执行完成后闭包都已经析构，只剩rich自己持有的引用
+    bool ok = token.use_count() == 2;
+
+    // 两边都按1024个元素一块，每块一个任务
+    std::vector<std::uint64_t> values(TASK_NUMS);
+    std::iota(values.begin(), values.end(), 0);
+    std::uint64_t expected = std::accumulate(values.begin(), values.end(), std::uint64_t(0));
+    constexpr std::size_t GRAIN = 1024;
+    constexpr std::size_t CHUNKS = TASK_NUMS / GRAIN + 1;
+    std::atomic<std::uint64_t> sum{ 0 };
+    {
+        legacy_threadpool pool;
+        pool.start(thread_nums);
+        auto before = allocations.load();
+        auto start = bench_clock::now();
+        std::vector<std::future<void>> futures;
+        for(std::size_t begin = 0; begin < TASK_NUMS; begin += GRAIN) {
+            futures.emplace_back(pool.async([&, begin] {
+                std::uint64_t local = 0;
+                for(auto i = begin; i < std::min(TASK_NUMS, begin + GRAIN); ++i) {
+                    local += values[i];
+                }
+                sum.fetch_add(local, std::memory_order_relaxed);
+            }));
+        }
+        for(auto& f : futures) {
+            f.get();
+        }
+        legacy = { seconds_since(start), static_cast<double>(allocations.load() - before) / CHUNKS };
+    }
+    ok = ok && sum == expected;
+    sum = 0;
+    {
+        util::threadpool pool(thread_nums);
+        auto before = allocations.load();
+        auto start = bench_clock::now();
+        pool.parallel_for(std::size_t(0), CHUNKS, [&](std::size_t c) {
+            std::uint64_t local = 0;
+            for(auto i = c * GRAIN; i < std::min(TASK_NUMS, (c + 1) * GRAIN); ++i) {
+                local += values[i];
+            }
+            sum.fetch_add(local, std::memory_order_relaxed);
+        }, std::size_t(1));
+        stealing = { seconds_since(start), static_cast<double>(allocations.load() - before) / CHUNKS };
+    }
+    ok = ok && sum == expected;
+    report("parallel_for", legacy, stealing);
+
+    // async的返回值和异常
+    util::threadpool pool(thread_nums);
+    ok = ok && pool.async([](int a, int b) { return a + b; }, 1, 2).get() == 3;
+    try {
+        pool.parallel_for(0, 100, [](int i) { if(i == 42) throw std::runtime_error("42"); });
+        ok = false;
+    }
+    catch(const std::runtime_error&) {
+    }
+    std::cout << (ok ? "ok" : "FAIL") << std::endl;
+    return ok ? 0 : 1;
+}
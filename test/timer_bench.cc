@@ -0,0 +1,111 @@
+#include "../net/timer.hpp"
+#include "../net/timer_wheel.hpp"
+#include <iostream>
+#include <iomanip>
+
+// 对比EventLoop原先的std::set<Timer> + std::unordered_map和分层时间轮
+// 分别测试插入N个定时器、取消一半、执行剩余全部定时器的耗时
+using namespace cortono::net;
+using bench_clock = std::chrono::steady_clock;
+
+template <typename F>
+double elapsed_ms(F&& f) {
+    auto start = bench_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+struct SetTimers
+{
+    std::set<Timer> timers;
+    std::unordered_map<Timer::timer_id, Timer> id_to_timers;
+
+    Timer::timer_id add(Timer::time_point point, std::function<void()> cb) {
+        Timer timer(point, std::move(cb));
+        auto id = timer.id();
+        timers.emplace(timer);
+        id_to_timers.emplace(id, timer);
+        return id;
+    }
+    void cancel(Timer::timer_id id) {
+        if(id_to_timers.count(id)) {
+            timers.erase(id_to_timers[id]);
+            id_to_timers.erase(id);
+        }
+    }
+    void expire_all() {
+        while(!timers.empty()) {
+            auto t = *timers.begin();
+            timers.erase(timers.begin());
+            t.run();
+            id_to_timers.erase(t.id());
+        }
+    }
+};
+
+struct WheelTimers
+{
+    TimerWheel timers;
+
+    Timer::timer_id add(Timer::time_point point, std::function<void()> cb) {
+        return timers.add(point, Timer::milliseconds(0), std::move(cb));
+    }
+    void cancel(Timer::timer_id id) {
+        timers.cancel(id);
+    }
+    void expire_all() {
+        timers.expire(Timer::now() + std::chrono::seconds(120));
+    }
+};
+
+template <typename Timers>
+void bench(const char* name, std::size_t n) {
+    std::mt19937 rng{ 42 };
+    std::uniform_int_distribution<std::int64_t> dist(1'000'000, 60'000'000);
+    auto now = Timer::now();
+    std::vector<Timer::time_point> points(n);
+    for(auto& point : points) {
+        point = now + std::chrono::microseconds(dist(rng));
+    }
+    std::vector<std::size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+
+    auto timers = std::make_unique<Timers>();
+    std::vector<Timer::timer_id> ids(n);
+    std::size_t fired = 0;
+    double insert_ms = elapsed_ms([&] {
+        for(std::size_t i = 0; i < n; ++i) {
+            ids[i] = timers->add(points[i], [&fired] { ++fired; });
+        }
+    });
+    double cancel_ms = elapsed_ms([&] {
+        for(std::size_t i = 0; i < n / 2; ++i) {
+            timers->cancel(ids[order[i]]);
+        }
+    });
+    double expire_ms = elapsed_ms([&] { timers->expire_all(); });
+
+    std::cout << std::left << std::setw(8) << name
+              << std::right << std::setw(10) << n
+              << std::fixed << std::setprecision(2)
+              << std::setw(12) << insert_ms
+              << std::setw(12) << cancel_ms
+              << std::setw(12) << expire_ms
+              << std::setw(10) << fired << std::endl;
+}
+
+int main()
+{
+    std::cout << std::left << std::setw(8) << "impl"
+              << std::right << std::setw(10) << "timers"
+              << std::setw(12) << "insert(ms)"
+              << std::setw(12) << "cancel(ms)"
+              << std::setw(12) << "expire(ms)"
+              << std::setw(10) << "fired" << std::endl;
+    for(std::size_t n : { 1'000, 100'000, 1'000'000 }) {
+        bench<SetTimers>("set", n);
+        bench<WheelTimers>("wheel", n);
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "../net/eventloop.hpp"
+#include <iostream>
+#include <sys/resource.h>
+#include "check.hpp"
+
+// 测试定时器精度
+// 1.时间轮按精确的到期时间执行，不需要等到1ms的tick边界
+// 2.EventLoop通过timerfd唤醒，亚毫秒的定时器按时执行，等待期间不空转
+// 3.延迟分布通过timer_lateness读取
+// 4.其它线程创建的定时器可以在插入loop之前取消
+using namespace cortono;
+using namespace cortono::net;
+
+std::chrono::microseconds cpu_time() {
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+         + std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+int main()
+{
+    util::logger::close_logger();
+
+    // 时间轮，使用虚拟的当前时间
+    {
+        TimerWheel wheel;
+        auto t0 = Timer::now() + Timer::milliseconds(5);
+        std::vector<int> fired;
+        wheel.add(t0 + Timer::microseconds(300), Timer::duration(0), [&fired] { fired.push_back(1); });
+        wheel.add(t0 + Timer::microseconds(700), Timer::duration(0), [&fired] { fired.push_back(2); });
+        wheel.add(t0 + Timer::microseconds(1500), Timer::duration(0), [&fired] { fired.push_back(3); });
+        wheel.expire(t0 + Timer::microseconds(299));
+        check(fired.empty(), "not fired before deadline");
+        check(wheel.next_deadline() == t0 + Timer::microseconds(300), "next deadline is exact");
+        wheel.expire(t0 + Timer::microseconds(300));
+        check(fired == std::vector<int>{ 1 }, "fired at exact deadline");
+        wheel.expire(t0 + Timer::microseconds(800));
+        check(fired == std::vector<int>{ 1, 2 }, "fired within the same tick");
+        wheel.expire(t0 + Timer::microseconds(1600));
+        check(fired == std::vector<int>{ 1, 2, 3 }, "fired in the next tick");
+
+        // 亚毫秒的周期定时器
+        int count = 0;
+        auto id = wheel.add(t0 + Timer::microseconds(2000), Timer::microseconds(200), [&count] { ++count; });
+        for(int us = 2000; us < 3000; us += 100) {
+            wheel.expire(t0 + Timer::microseconds(us));
+        }
+        check(count == 5, "sub-millisecond periodic timer");
+        check(wheel.cancel(id) && wheel.empty(), "cancel periodic timer");
+        check(wheel.lateness().fired == 8, "lateness counts fired timers");
+    }
+
+    EventLoop loop;
+    // 依次执行200个250us的定时器，记录实际等待时间
+    {
+        constexpr int N = 200;
+        std::vector<std::chrono::microseconds> waits;
+        Timer::time_point start;
+        std::function<void()> next = [&] {
+            start = Timer::now();
+            loop.run_after(Timer::microseconds(250), [&] {
+                waits.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Timer::now() - start));
+                if(waits.size() < N) {
+                    next();
+                }
+            });
+        };
+        next();
+        auto deadline = Timer::now() + std::chrono::seconds(5);
+        while(waits.size() < N && Timer::now() < deadline) {
+            loop.loop_once();
+        }
+        std::sort(waits.begin(), waits.end());
+        check(waits.size() == N, "all timers fired");
+        check(waits.front() >= Timer::microseconds(250), "never early");
+        auto median = waits[waits.size() / 2];
+        std::cout << "250us timer: min " << waits.front().count() << "us, median " << median.count()
+                  << "us, max " << waits.back().count() << "us" << std::endl;
+        check(median < Timer::microseconds(750), "sub-millisecond precision");
+
+        auto lateness = loop.timer_lateness();
+        std::cout << "lateness: fired " << lateness.fired << ", p50 < " << lateness.percentile(0.5).count()
+                  << "us, p99 < " << lateness.percentile(0.99).count() << "us, max " << lateness.max.count() << "us" << std::endl;
+        check(lateness.fired == N, "lateness histogram per loop");
+        std::size_t total = 0;
+        for(auto n : lateness.buckets) {
+            total += n;
+        }
+        check(total == N, "histogram buckets");
+    }
+
+    // 等待期间阻塞在epoll_wait中
+    {
+        bool fired = false;
+        loop.run_after(Timer::milliseconds(200), [&fired] { fired = true; });
+        auto cpu_before = cpu_time();
+        auto start = Timer::now();
+        int iterations = 0;
+        while(!fired) {
+            loop.loop_once();
+            ++iterations;
+        }
+        auto elapsed = Timer::now() - start;
+        auto cpu = cpu_time() - cpu_before;
+        std::cout << "200ms timer: " << iterations << " iterations, cpu " << cpu.count() << "us" << std::endl;
+        check(elapsed >= Timer::milliseconds(200) && iterations <= 3, "no busy spin");
+        check(cpu < Timer::milliseconds(20), "idle cpu");
+    }
+
+    // 其它线程创建和取消定时器
+    {
+        bool fired = false, cancelled_fired = false;
+        std::thread([&] {
+            loop.run_after(Timer::microseconds(500), [&fired] { fired = true; });
+            auto id = loop.run_after(Timer::microseconds(800), [&cancelled_fired] { cancelled_fired = true; });
+            loop.cancel_timer(id);
+        }).join();
+        auto deadline = Timer::now() + Timer::milliseconds(20);
+        while(!fired && Timer::now() < deadline) {
+            loop.loop_once();
+        }
+        check(fired && !cancelled_fired, "remote timers");
+    }
+
+    // loop线程在插入任务执行之前取消其它线程创建的定时器
+    {
+        bool fired = false, cancelled_fired = false;
+        Timer::timer_id id = 0;
+        std::thread([&] {
+            id = loop.run_after(Timer::microseconds(300), [&cancelled_fired] { cancelled_fired = true; });
+        }).join();
+        loop.cancel_timer(id);
+        loop.run_after(Timer::microseconds(800), [&fired] { fired = true; });
+        auto deadline = Timer::now() + Timer::milliseconds(20);
+        while(!fired && Timer::now() < deadline) {
+            loop.loop_once();
+        }
+        check(fired && !cancelled_fired, "cancel before remote insertion");
+    }
+
+    return finish();
+}
@@ -0,0 +1,121 @@
+#include "../net/tunnel.hpp"
+#include <iostream>
+#include "check.hpp"
+
+// 测试splice隧道
+// 1.client <-> a 和 b <-> server两对本机TCP连接，a和b在loop中通过Tunnel连接
+// 2.检查join之前收到的数据、双向转发的内容、背压、半关闭和关闭
+using namespace cortono;
+using namespace cortono::net;
+
+using TcpTunnel = Tunnel<TcpConnection, TcpConnection>;
+
+// 返回{阻塞的外部端, 非阻塞的loop端}
+std::pair<int, int> tcp_pair() {
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    auto addr = ip::address::to_sockaddr("127.0.0.1", 0);
+    ::bind(listen_fd, &addr, sizeof(addr));
+    ::listen(listen_fd, 1);
+    socklen_t len = sizeof(addr);
+    ::getsockname(listen_fd, &addr, &len);
+    int outer = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ::connect(outer, &addr, sizeof(addr));
+    int inner = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    ::close(listen_fd);
+    return { outer, inner };
+}
+
+std::string read_all(int fd) {
+    std::string data;
+    char buffer[65536];
+    ssize_t n;
+    while((n = ::read(fd, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, n);
+    }
+    return data;
+}
+
+int main()
+{
+    EventLoop loop;
+    loop.run_every(Timer::milliseconds(10), [] {});
+    auto wait_until = [&loop](auto pred) {
+        auto deadline = Timer::now() + Timer::milliseconds(3000);
+        while(!pred() && Timer::now() < deadline) {
+            loop.loop_once();
+        }
+    };
+
+    auto [client, a_fd] = tcp_pair();
+    auto [server, b_fd] = tcp_pair();
+    auto a = std::make_shared<TcpConnection>(&loop, a_fd);
+    auto b = std::make_shared<TcpConnection>(&loop, b_fd);
+    a->set_conn_state(TcpConnection::ConnState::Connected);
+    b->set_conn_state(TcpConnection::ConnState::Connected);
+    int closed = 0;
+    a->on_close([&closed](auto) { ++closed; });
+    b->on_close([&closed](auto) { ++closed; });
+
+    // join之前已经读入接收缓冲区的数据
+    bool early = false;
+    a->on_read([&early](auto) { early = true; });
+    ::write(client, "hello", 5);
+    wait_until([&] { return early; });
+    check(TcpTunnel::join(a, b), "splice tunnel for tcp connections");
+    char hello[5];
+    check(::read(server, hello, 5) == 5 && std::string(hello, 5) == "hello", "forward data received before join");
+
+    // server不读取时，a的数据最多停留在管道和内核缓冲区中，隧道不会读空client
+    std::string payload(32 * 1024 * 1024, '\0');
+    for(std::size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<char>(i * 7 + i / 4096);
+    }
+    std::atomic<std::size_t> written{ 0 };
+    std::thread writer([&] {
+        std::size_t offset = 0;
+        while(offset < payload.size()) {
+            auto n = ::write(client, payload.data() + offset, payload.size() - offset);
+            if(n <= 0) {
+                break;
+            }
+            offset += n;
+            written = offset;
+        }
+        ::shutdown(client, SHUT_WR);
+    });
+    auto until = Timer::now() + Timer::milliseconds(300);
+    wait_until([&] { return Timer::now() >= until; });
+    check(written < payload.size(), "backpressure when destination does not read");
+
+    // 读取server端，内容完整，client半关闭后server读到EOF
+    std::string received;
+    std::atomic<bool> eof{ false };
+    std::thread reader([&] { received = read_all(server); eof = true; });
+    wait_until([&] { return eof.load(); });
+    writer.join();
+    reader.join();
+    check(received == payload, "forward client to server");
+    check(closed == 0 && !a->is_closed(), "half close keeps tunnel open");
+
+    // 反方向转发，server关闭后两个连接都关闭
+    std::string reply(1024 * 1024, 'r');
+    std::thread replier([&] {
+        ::write(server, reply.data(), reply.size());
+        ::shutdown(server, SHUT_WR);
+    });
+    std::string back;
+    std::thread back_reader([&] { back = read_all(client); });
+    wait_until([&] { return closed == 2; });
+    replier.join();
+    back_reader.join();
+    check(back == reply, "forward server to client");
+    check(closed == 2 && a->is_closed() && b->is_closed(), "close both after both directions end");
+
+    auto stats = TcpTunnel::stats();
+    std::cout << "spliced " << stats.spliced << ", copied " << stats.copied << ", bytes " << stats.bytes << std::endl;
+    check(stats.spliced == 1 && stats.copied == 0, "stats");
+
+    ::close(client);
+    ::close(server);
+    return finish();
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "../std.hpp"
+#include "util.hpp"
+
+namespace cortono::util
+{
+    /*
+     * 工作线程的CPU绑定方式
+     * none:          不绑定，由系统调度
+     * cpu_list:      按照给定的CPU编号依次绑定，每个线程一个CPU
+     * physical_core: 每个物理核心取第一个超线程，每个线程一个核心
+     * numa_node:     线程依次分到各个NUMA节点，绑定到节点内的全部CPU
+     * 线程数多于CPU集合数时循环使用
+     */
+    enum class affinity_mode
+    {
+        none,
+        cpu_list,
+        physical_core,
+        numa_node
+    };
+
+    /*
+     * 从/sys/devices/system读取CPU拓扑，绑定当前线程
+     * 1.绑定后把当前线程的内存策略设为MPOL_LOCAL，之后分配的内存(EventLoop的内存池、Buffer)都在本节点上
+     *   内存页在第一次写入时分配，所以EventLoop需要在绑定之后、在工作线程中构造
+     * 2.读取失败时退化为单个节点，不影响运行
+     */
+    class cpu_affinity
+    {
+        public:
+            // 解析"0-3,8-11"格式的CPU列表
+            static std::vector<int> parse_cpu_list(std::string_view list) {
+                std::vector<int> cpus;
+                for(auto range : split(list, ',')) {
+                    while(!range.empty() && std::isspace(static_cast<unsigned char>(range.back()))) {
+                        range.remove_suffix(1);
+                    }
+                    if(range.empty()) {
+                        continue;
+                    }
+                    auto dash = range.find('-');
+                    int first = std::atoi(std::string(range.substr(0, dash)).data());
+                    int last = dash == std::string_view::npos ? first : std::atoi(std::string(range.substr(dash + 1)).data());
+                    for(int cpu = first; cpu <= last; ++cpu) {
+                        cpus.push_back(cpu);
+                    }
+                }
+                return cpus;
+            }
+
+            static std::vector<int> online_cpus() {
+                auto cpus = parse_cpu_list(read_line("/sys/devices/system/cpu/online"));
+                if(cpus.empty()) {
+                    for(unsigned cpu = 0; cpu < std::thread::hardware_concurrency(); ++cpu) {
+                        cpus.push_back(cpu);
+                    }
+                }
+                return cpus;
+            }
+
+            // 每个物理核心的第一个超线程
+            static std::vector<int> physical_cores() {
+                std::vector<int> cpus;
+                std::set<std::pair<int, int>> seen;
+                for(auto cpu : online_cpus()) {
+                    auto topology = util::format("/sys/devices/system/cpu/cpu%d/topology/", cpu);
+                    auto package = std::atoi(read_line(topology + "physical_package_id").data());
+                    auto core = std::atoi(read_line(topology + "core_id").data());
+                    if(seen.emplace(package, core).second) {
+                        cpus.push_back(cpu);
+                    }
+                }
+                return cpus;
+            }
+
+            // 每个NUMA节点的CPU列表，没有NUMA信息时返回一个包含全部CPU的节点
+            static std::vector<std::vector<int>> numa_nodes() {
+                std::vector<std::vector<int>> nodes;
+                for(auto node : parse_cpu_list(read_line("/sys/devices/system/node/online"))) {
+                    auto cpus = parse_cpu_list(read_line(util::format("/sys/devices/system/node/node%d/cpulist", node)));
+                    if(!cpus.empty()) {
+                        nodes.emplace_back(std::move(cpus));
+                    }
+                }
+                if(nodes.empty()) {
+                    nodes.emplace_back(online_cpus());
+                }
+                return nodes;
+            }
+
+            // 第i个线程应该绑定的CPU集合，为空表示不绑定
+            static std::vector<std::vector<int>> plan(affinity_mode mode, const std::vector<int>& cpus = {}) {
+                std::vector<std::vector<int>> sets;
+                switch(mode) {
+                    case affinity_mode::none:
+                        break;
+                    case affinity_mode::cpu_list:
+                        for(auto cpu : cpus) {
+                            sets.push_back({ cpu });
+                        }
+                        break;
+                    case affinity_mode::physical_core:
+                        for(auto cpu : physical_cores()) {
+                            sets.push_back({ cpu });
+                        }
+                        break;
+                    case affinity_mode::numa_node:
+                        sets = numa_nodes();
+                        break;
+                }
+                return sets;
+            }
+
+            static bool pin_current_thread(const std::vector<int>& cpus) {
+                if(cpus.empty()) {
+                    return true;
+                }
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                for(auto cpu : cpus) {
+                    CPU_SET(cpu, &set);
+                }
+                if(int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set); err != 0) {
+                    log_error("fail to set thread affinity:", std::strerror(err));
+                    return false;
+                }
+                // 非NUMA机器上没有影响
+                if(::syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0) != 0) {
+                    log_error("fail to set local memory policy:", std::strerror(errno));
+                }
+                return true;
+            }
+
+        private:
+            static std::string read_line(const std::string& filename) {
+                std::ifstream fin{ filename };
+                std::string line;
+                std::getline(fin, line);
+                return line;
+            }
+    };
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "../std.hpp"
+#include "noncopyable.hpp"
+
+namespace cortono::util
+{
+    // 打开的文件，最后一个持有者释放时关闭fd
+    struct open_file : private util::noncopyable
+    {
+        int fd{ -1 };                   // 目录为-1
+        bool directory{ false };
+        std::size_t size{ 0 };
+        std::time_t mtime{ 0 };
+        long mtime_nsec{ 0 };
+        dev_t dev{ 0 };
+        ino_t ino{ 0 };
+        std::string etag;
+
+        ~open_file() {
+            if(fd != -1) {
+                ::close(fd);
+            }
+        }
+    };
+
+    /*
+     * 按路径缓存打开的文件，用于sendfile
+     * 1.按路径哈希分片，每个分片一把锁和一个LRU链表，loop线程和线程池都可以使用
+     * 2.条目在ttl内直接返回，超过ttl后stat一次路径，设备、inode、大小和修改时间都没有变化时继续使用，否则重新打开
+     * 3.淘汰或者失效的文件仍在发送时，fd保留到发送完成
+     * 4.目录也会缓存(fd为-1)，不存在的路径不缓存
+     */
+    class file_cache : private util::noncopyable
+    {
+        public:
+            using handle = std::shared_ptr<const open_file>;
+            static constexpr std::size_t SHARD_NUMS = 16;
+
+            struct stats_t
+            {
+                std::size_t hits;
+                std::size_t misses;             // 打开了新的fd(第一次访问或者文件已经改变)
+                std::size_t revalidations;      // 超过ttl后stat确认文件没有改变
+            };
+
+            static file_cache& instance() {
+                static file_cache inst;
+                return inst;
+            }
+
+            // 文件不存在或者打开失败时返回nullptr
+            handle open(const std::string& path) {
+                auto now = std::chrono::steady_clock::now();
+                auto ttl = std::chrono::milliseconds(ttl_ms_.load(std::memory_order_relaxed));
+                auto& shard = shard_of(path);
+                {
+                    std::unique_lock lock{ shard.mutex };
+                    if(auto it = shard.entries.find(path); it != shard.entries.end()) {
+                        auto& entry = *it->second;
+                        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                        if(now - entry.checked < ttl) {
+                            add(hits_);
+                            return entry.file;
+                        }
+                    }
+                }
+                // 超过ttl或者没有缓存，在锁外访问文件系统
+                struct stat st;
+                if(::stat(path.data(), &st) == -1) {
+                    invalidate(path);
+                    return nullptr;
+                }
+                {
+                    std::unique_lock lock{ shard.mutex };
+                    if(auto it = shard.entries.find(path); it != shard.entries.end()) {
+                        auto& entry = *it->second;
+                        if(same_file(*entry.file, st)) {
+                            add(revalidations_);
+                            entry.checked = now;
+                            return entry.file;
+                        }
+                    }
+                }
+                auto file = open_path(path, st);
+                if(!file) {
+                    return nullptr;
+                }
+                add(misses_);
+                std::unique_lock lock{ shard.mutex };
+                if(auto it = shard.entries.find(path); it != shard.entries.end()) {
+                    it->second->file = file;
+                    it->second->checked = now;
+                    return file;
+                }
+                shard.lru.push_front({ path, file, now });
+                shard.entries[path] = shard.lru.begin();
+                if(shard.lru.size() > capacity_.load(std::memory_order_relaxed)) {
+                    shard.entries.erase(shard.lru.back().path);
+                    shard.lru.pop_back();
+                }
+                return file;
+            }
+
+            void invalidate(const std::string& path) {
+                auto& shard = shard_of(path);
+                std::unique_lock lock{ shard.mutex };
+                if(auto it = shard.entries.find(path); it != shard.entries.end()) {
+                    shard.lru.erase(it->second);
+                    shard.entries.erase(it);
+                }
+            }
+            void clear() {
+                for(auto& shard : shards_) {
+                    std::unique_lock lock{ shard.mutex };
+                    shard.entries.clear();
+                    shard.lru.clear();
+                }
+            }
+            // 0表示每次都stat确认
+            void set_ttl(std::chrono::milliseconds ttl) {
+                ttl_ms_.store(ttl.count(), std::memory_order_relaxed);
+            }
+            // 每个分片最多缓存的文件数
+            void set_capacity(std::size_t entries) {
+                capacity_.store(std::max<std::size_t>(entries, 1), std::memory_order_relaxed);
+            }
+            stats_t stats() const {
+                return {
+                    hits_.load(std::memory_order_relaxed),
+                    misses_.load(std::memory_order_relaxed),
+                    revalidations_.load(std::memory_order_relaxed)
+                };
+            }
+
+        private:
+            struct entry
+            {
+                std::string path;
+                handle file;
+                std::chrono::steady_clock::time_point checked;
+            };
+            struct shard
+            {
+                std::mutex mutex;
+                std::list<entry> lru;
+                std::unordered_map<std::string, std::list<entry>::iterator> entries;
+            };
+
+            static bool same_file(const open_file& file, const struct stat& st) {
+                return file.dev == st.st_dev && file.ino == st.st_ino
+                    && file.size == static_cast<std::size_t>(st.st_size)
+                    && file.mtime == st.st_mtim.tv_sec && file.mtime_nsec == st.st_mtim.tv_nsec;
+            }
+            static handle open_path(const std::string& path, const struct stat& st) {
+                auto file = std::make_shared<open_file>();
+                file->directory = S_ISDIR(st.st_mode);
+                if(!file->directory) {
+                    file->fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+                    if(file->fd == -1) {
+                        return nullptr;
+                    }
+                    // 以打开的fd为准，stat和open之间文件可能被替换
+                    struct stat fst;
+                    if(::fstat(file->fd, &fst) == -1) {
+                        return nullptr;
+                    }
+                    file->size = static_cast<std::size_t>(fst.st_size);
+                    file->mtime = fst.st_mtim.tv_sec;
+                    file->mtime_nsec = fst.st_mtim.tv_nsec;
+                    file->dev = fst.st_dev;
+                    file->ino = fst.st_ino;
+                }
+                else {
+                    file->size = static_cast<std::size_t>(st.st_size);
+                    file->mtime = st.st_mtim.tv_sec;
+                    file->mtime_nsec = st.st_mtim.tv_nsec;
+                    file->dev = st.st_dev;
+                    file->ino = st.st_ino;
+                }
+                char etag[64];
+                std::snprintf(etag, sizeof(etag), "\"%lx.%lx-%zx\"", static_cast<unsigned long>(file->mtime),
+                              static_cast<unsigned long>(file->mtime_nsec), file->size);
+                file->etag = etag;
+                return file;
+            }
+            shard& shard_of(const std::string& path) {
+                return shards_[std::hash<std::string>{}(path) % SHARD_NUMS];
+            }
+            static void add(std::atomic<std::size_t>& counter) {
+                counter.fetch_add(1, std::memory_order_relaxed);
+            }
+
+        private:
+            std::array<shard, SHARD_NUMS> shards_;
+            std::atomic<std::int64_t> ttl_ms_{ 1000 };
+            std::atomic<std::size_t> capacity_{ 1024 };
+            std::atomic<std::size_t> hits_{ 0 };
+            std::atomic<std::size_t> misses_{ 0 };
+            std::atomic<std::size_t> revalidations_{ 0 };
+    };
+}
@@ -0,0 +1,346 @@
+#pragma once
+
+#include "../std.hpp"
+#include "noncopyable.hpp"
+
+namespace cortono::util
+{
+    /*
+     * 日志的异步写线程，启动之后logger不再在调用线程中写标准输出
+     * 1.每个写日志的线程有自己的环形缓冲区(单生产者单消费者，无锁)，写一条日志只是一次内存拷贝
+     * 2.后台线程依次取出各个缓冲区中的日志，合并成一次write，没有日志时最多等待flush_interval，缓冲区超过一半时提前唤醒
+     * 3.缓冲区满时丢弃日志并计数，由后台线程写入一条提示，写日志的线程不会被阻塞
+     *   fatal日志例外，在调用线程中同步写出(write_fatal)，保证abort之前已经写出
+     * 4.文件超过rotate_bytes时改名为path.1(原有的path.1改为path.2，以此类推，最多保留keep_files个)，然后重新打开
+     * 5.不同线程的日志按缓冲区分批写出，相互之间不保证时间顺序
+     */
+    class log_writer : private util::noncopyable
+    {
+        public:
+            struct options
+            {
+                std::string path;                                   // 为空时写到标准输出
+                std::size_t rotate_bytes{ 64 * 1024 * 1024 };       // 0表示不切分
+                std::size_t keep_files{ 4 };
+                std::size_t ring_bytes{ 1024 * 1024 };              // 每个线程的缓冲区大小，向上取整为2的幂
+                std::chrono::milliseconds flush_interval{ 10 };
+            };
+            struct stats_t
+            {
+                std::size_t written;        // 写出的日志条数
+                std::size_t dropped;        // 缓冲区满丢弃的条数
+                std::size_t batches;        // write次数
+                std::size_t rotations;
+            };
+
+            static log_writer& instance() {
+                static log_writer inst;
+                return inst;
+            }
+            // 写日志的热路径只检查这个标志
+            static bool active() {
+                return active_.load(std::memory_order_acquire);
+            }
+
+            bool start(options opts) {
+                std::unique_lock lock{ control_mutex_ };
+                if(thread_.joinable()) {
+                    return false;
+                }
+                opts_ = std::move(opts);
+                opts_.ring_bytes = round_up(std::max<std::size_t>(opts_.ring_bytes, 4096));
+                if(!open_file()) {
+                    return false;
+                }
+                stop_ = false;
+                thread_ = std::thread([this] { run(); });
+                active_.store(true, std::memory_order_release);
+                return true;
+            }
+            // 写出所有缓冲区中的日志之后退出后台线程
+            void stop() {
+                std::unique_lock lock{ control_mutex_ };
+                if(!thread_.joinable()) {
+                    return;
+                }
+                active_.store(false, std::memory_order_release);
+                {
+                    std::unique_lock wait_lock{ wait_mutex_ };
+                    stop_ = true;
+                }
+                wait_cond_.notify_one();
+                thread_.join();
+                drain();
+                close_file();
+            }
+            ~log_writer() {
+                stop();
+            }
+
+            // 缓冲区满时返回false
+            bool push(const char* data, std::size_t len) {
+                auto& r = local_ring();
+                if(!r || r->capacity() != opts_.ring_bytes) {
+                    // 重新启动时改变了缓冲区大小
+                    if(r) {
+                        r->orphan.store(true, std::memory_order_release);
+                    }
+                    r = std::make_shared<ring>(opts_.ring_bytes);
+                    std::unique_lock lock{ rings_mutex_ };
+                    rings_.push_back(r);
+                }
+                auto used = r->push(data, len);
+                if(used == 0) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    wait_cond_.notify_one();
+                    return false;
+                }
+                // 刚超过一半时唤醒后台线程，不等flush_interval
+                if(used > r->capacity() / 2 && used - sizeof(std::uint32_t) - len <= r->capacity() / 2) {
+                    wait_cond_.notify_one();
+                }
+                return true;
+            }
+            // 在调用线程中写出所有缓冲区
+            void flush() {
+                drain();
+            }
+            // fatal日志不经过缓冲区，写出已有的日志之后在调用线程中直接写出，缓冲区满时也不会丢失
+            void write_fatal(const char* data, std::size_t len) {
+                std::unique_lock lock{ drain_mutex_ };
+                drain_locked();
+                write_out(std::string(data, len));
+                written_.fetch_add(1, std::memory_order_relaxed);
+            }
+            stats_t stats() const {
+                return {
+                    written_.load(std::memory_order_relaxed),
+                    total_dropped_.load(std::memory_order_relaxed),
+                    batches_.load(std::memory_order_relaxed),
+                    rotations_.load(std::memory_order_relaxed)
+                };
+            }
+
+        private:
+            /*
+             * 单生产者单消费者的字节环，每条日志为4字节长度 + 内容
+             * head_只由消费者修改，tail_只由生产者修改
+             */
+            class ring : private util::noncopyable
+            {
+                public:
+                    explicit ring(std::size_t capacity)
+                        : buffer_(capacity),
+                          mask_(capacity - 1)
+                    {  }
+                    std::size_t capacity() const {
+                        return buffer_.size();
+                    }
+                    // 返回写入之后已使用的字节数，空间不足时返回0
+                    std::size_t push(const char* data, std::size_t len) {
+                        std::uint32_t n = static_cast<std::uint32_t>(len);
+                        auto tail = tail_.load(std::memory_order_relaxed);
+                        auto head = head_.load(std::memory_order_acquire);
+                        if(len > capacity() / 2 || capacity() - (tail - head) < sizeof(n) + len) {
+                            return 0;
+                        }
+                        copy_in(tail, reinterpret_cast<const char*>(&n), sizeof(n));
+                        copy_in(tail + sizeof(n), data, len);
+                        tail_.store(tail + sizeof(n) + len, std::memory_order_release);
+                        return tail + sizeof(n) + len - head;
+                    }
+                    // 取出所有日志追加到out，返回条数
+                    std::size_t pop_all(std::string& out) {
+                        auto head = head_.load(std::memory_order_relaxed);
+                        auto tail = tail_.load(std::memory_order_acquire);
+                        std::size_t count = 0;
+                        while(head != tail) {
+                            std::uint32_t n;
+                            copy_out(head, reinterpret_cast<char*>(&n), sizeof(n));
+                            auto offset = out.size();
+                            out.resize(offset + n);
+                            copy_out(head + sizeof(n), out.data() + offset, n);
+                            head += sizeof(n) + n;
+                            ++count;
+                        }
+                        head_.store(head, std::memory_order_release);
+                        return count;
+                    }
+                    bool empty() const {
+                        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+                    }
+
+                    // 所属线程已经退出，取空之后可以移除
+                    std::atomic<bool> orphan{ false };
+
+                private:
+                    void copy_in(std::size_t pos, const char* data, std::size_t len) {
+                        auto start = pos & mask_;
+                        auto first = std::min(len, capacity() - start);
+                        std::memcpy(buffer_.data() + start, data, first);
+                        std::memcpy(buffer_.data(), data + first, len - first);
+                    }
+                    void copy_out(std::size_t pos, char* data, std::size_t len) const {
+                        auto start = pos & mask_;
+                        auto first = std::min(len, capacity() - start);
+                        std::memcpy(data, buffer_.data() + start, first);
+                        std::memcpy(data + first, buffer_.data(), len - first);
+                    }
+
+                    std::vector<char> buffer_;
+                    std::size_t mask_;
+                    alignas(64) std::atomic<std::size_t> head_{ 0 };
+                    alignas(64) std::atomic<std::size_t> tail_{ 0 };
+            };
+
+            // 线程退出时标记缓冲区，由后台线程在取空之后移除
+            struct ring_holder
+            {
+                std::shared_ptr<ring> r;
+                ~ring_holder() {
+                    if(r) {
+                        r->orphan.store(true, std::memory_order_release);
+                    }
+                }
+            };
+            static std::shared_ptr<ring>& local_ring() {
+                thread_local ring_holder holder;
+                return holder.r;
+            }
+            static std::size_t round_up(std::size_t n) {
+                std::size_t size = 1;
+                while(size < n) {
+                    size <<= 1;
+                }
+                return size;
+            }
+
+            void run() {
+                while(true) {
+                    if(drain() > 0) {
+                        continue;
+                    }
+                    std::unique_lock lock{ wait_mutex_ };
+                    if(stop_) {
+                        break;
+                    }
+                    wait_cond_.wait_for(lock, opts_.flush_interval);
+                }
+            }
+            // 后台线程和flush都可能调用，drain_mutex_保证每个缓冲区只有一个消费者
+            std::size_t drain() {
+                std::unique_lock lock{ drain_mutex_ };
+                return drain_locked();
+            }
+            std::size_t drain_locked() {
+                {
+                    std::unique_lock rings_lock{ rings_mutex_ };
+                    snapshot_ = rings_;
+                }
+                batch_.clear();
+                std::size_t count = 0;
+                for(auto& r : snapshot_) {
+                    count += r->pop_all(batch_);
+                }
+                if(auto dropped = dropped_.exchange(0, std::memory_order_relaxed); dropped > 0) {
+                    total_dropped_.fetch_add(dropped, std::memory_order_relaxed);
+                    batch_.append("[log_writer] ").append(std::to_string(dropped)).append(" log messages dropped\n");
+                }
+                if(!batch_.empty()) {
+                    write_out(batch_);
+                    written_.fetch_add(count, std::memory_order_relaxed);
+                }
+                remove_orphans();
+                snapshot_.clear();
+                return count;
+            }
+            void remove_orphans() {
+                std::unique_lock rings_lock{ rings_mutex_ };
+                rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const auto& r) {
+                    return r->orphan.load(std::memory_order_acquire) && r->empty();
+                }), rings_.end());
+            }
+            void write_out(const std::string& data) {
+                if(fd_ == -1) {
+                    return;
+                }
+                std::size_t offset = 0;
+                while(offset < data.size()) {
+                    auto n = ::write(fd_, data.data() + offset, data.size() - offset);
+                    if(n == -1 && errno == EINTR) {
+                        continue;
+                    }
+                    if(n <= 0) {
+                        break;
+                    }
+                    offset += static_cast<std::size_t>(n);
+                }
+                batches_.fetch_add(1, std::memory_order_relaxed);
+                file_bytes_ += offset;
+                if(!opts_.path.empty() && opts_.rotate_bytes > 0 && file_bytes_ >= opts_.rotate_bytes) {
+                    rotate();
+                }
+            }
+            void rotate() {
+                close_file();
+                if(opts_.keep_files == 0) {
+                    ::unlink(opts_.path.data());
+                }
+                else {
+                    for(auto i = opts_.keep_files - 1; i > 0; --i) {
+                        auto from = opts_.path + "." + std::to_string(i);
+                        auto to = opts_.path + "." + std::to_string(i + 1);
+                        ::rename(from.data(), to.data());
+                    }
+                    ::rename(opts_.path.data(), (opts_.path + ".1").data());
+                }
+                rotations_.fetch_add(1, std::memory_order_relaxed);
+                open_file();
+            }
+            bool open_file() {
+                file_bytes_ = 0;
+                if(opts_.path.empty()) {
+                    fd_ = STDOUT_FILENO;
+                    return true;
+                }
+                fd_ = ::open(opts_.path.data(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+                if(fd_ == -1) {
+                    std::fprintf(stderr, "open log file %s failed: %s\n", opts_.path.data(), std::strerror(errno));
+                    return false;
+                }
+                struct stat st;
+                if(::fstat(fd_, &st) == 0) {
+                    file_bytes_ = static_cast<std::size_t>(st.st_size);
+                }
+                return true;
+            }
+            void close_file() {
+                if(fd_ != -1 && fd_ != STDOUT_FILENO) {
+                    ::close(fd_);
+                }
+                fd_ = -1;
+            }
+
+        private:
+            options opts_;
+            int fd_{ -1 };
+            std::size_t file_bytes_{ 0 };
+            std::thread thread_;
+            bool stop_{ false };
+            std::mutex control_mutex_;
+            std::mutex wait_mutex_;
+            std::condition_variable wait_cond_;
+            std::mutex drain_mutex_;
+            std::mutex rings_mutex_;
+            std::vector<std::shared_ptr<ring>> rings_;
+            std::vector<std::shared_ptr<ring>> snapshot_;
+            std::string batch_;
+            std::atomic<std::size_t> dropped_{ 0 };
+            std::atomic<std::size_t> total_dropped_{ 0 };
+            std::atomic<std::size_t> written_{ 0 };
+            std::atomic<std::size_t> batches_{ 0 };
+            std::atomic<std::size_t> rotations_{ 0 };
+
+            inline static std::atomic<bool> active_{ false };
+    };
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "../std.hpp"
+#include "noncopyable.hpp"
+#include "object_pool.hpp"
+
+namespace cortono::util
+{
+    /*
+     * 无锁多生产者单消费者队列(Vyukov MPSC)
+     * 1.push可以在任意线程调用，只需要一次exchange，不需要加锁
+     * 2.pop只能在消费者线程调用
+     * 3.队列中始终保留一个哨兵节点，push和pop不会相互竞争同一个指针
+     * 4.节点通过pool_allocator从当前线程的内存池中分配，pop后放回消费者线程的内存池
+     *   loop线程之间(包括loop投递给自己)的任务节点可以循环使用，没有内存池的线程退化为new/delete
+     *
+     * 生产者在exchange之后、链接next之前被挂起时，消费者会暂时看到一个"断开"的队列
+     * 此时pop返回false，但empty()返回false，消费者不应该进入睡眠
+     */
+    template <typename T>
+    class mpsc_queue : private util::noncopyable
+    {
+        private:
+            struct node
+            {
+                node() = default;
+                explicit node(T&& v) : value(std::move(v)) {}
+
+                std::atomic<node*> next{ nullptr };
+                T value;
+            };
+        public:
+            mpsc_queue()
+                : head_(&stub_),
+                  tail_(&stub_)
+            {  }
+
+            ~mpsc_queue() {
+                T value;
+                while(pop(value)) { }
+            }
+
+            void push(T value) {
+                auto n = ::new (static_cast<void*>(allocator{}.allocate(1))) node(std::move(value));
+                auto prev = head_.exchange(n, std::memory_order_seq_cst);
+                prev->next.store(n, std::memory_order_release);
+            }
+
+            bool pop(T& value) {
+                node* tail = tail_;
+                node* next = tail->next.load(std::memory_order_acquire);
+                if(tail == &stub_) {
+                    if(next == nullptr) {
+                        return false;
+                    }
+                    tail_ = next;
+                    tail = next;
+                    next = next->next.load(std::memory_order_acquire);
+                }
+                if(next != nullptr) {
+                    tail_ = next;
+                    value = std::move(tail->value);
+                    release(tail);
+                    return true;
+                }
+                // tail是最后一个节点，需要重新放入哨兵节点才能取出tail
+                if(tail != head_.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                stub_.next.store(nullptr, std::memory_order_relaxed);
+                auto prev = head_.exchange(&stub_, std::memory_order_acq_rel);
+                prev->next.store(&stub_, std::memory_order_release);
+                next = tail->next.load(std::memory_order_acquire);
+                if(next != nullptr) {
+                    tail_ = next;
+                    value = std::move(tail->value);
+                    release(tail);
+                    return true;
+                }
+                return false;
+            }
+
+            // 只能在消费者线程调用，与生产者的exchange构成全序，消费者据此判断能否进入睡眠
+            bool empty() const {
+                return tail_ == &stub_ && head_.load(std::memory_order_seq_cst) == &stub_;
+            }
+
+        private:
+            using allocator = pool_allocator<node>;
+
+            static void release(node* n) {
+                n->~node();
+                allocator{}.deallocate(n, 1);
+            }
+
+        private:
+            std::atomic<node*> head_;
+            node* tail_;
+            node stub_;
+    };
+}
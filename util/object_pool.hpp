@@ -0,0 +1,177 @@
+#pragma once
+
+#include "../std.hpp"
+#include "noncopyable.hpp"
+
+namespace cortono::util
+{
+    /*
+     * 每个EventLoop一个的内存池，用于回收连接相关的小对象(Connection、Buffer、PollerCB)
+     * 1.按2的幂划分大小类，每个大小类一个空闲链表，超过MAX_BLOCK的内存直接交给operator new/delete
+     * 2.所有经过pool_allocator分配的内存块都按大小类向上取整，块之间可以互换
+     *   所以在哪个线程释放都可以：有内存池的线程放回自己的空闲链表，否则直接delete
+     * 3.EventLoop构造时将自己的内存池设为当前线程的内存池，析构时取消
+     *
+     * 内存池本身不是线程安全的，只能在所属线程中分配和回收，统计数据可以在任意线程读取
+     */
+    class object_pool : private util::noncopyable
+    {
+        public:
+            static constexpr std::size_t MIN_BLOCK = 16;
+            static constexpr std::size_t MAX_BLOCK = 64 * 1024;
+            // 空闲链表中最多缓存的字节数，超过后直接释放
+            static constexpr std::size_t DEFAULT_CAPACITY = 32 * 1024 * 1024;
+
+            struct stats_t
+            {
+                std::size_t hits;
+                std::size_t misses;
+                std::size_t resident_bytes;
+            };
+
+            object_pool() = default;
+            ~object_pool() {
+                if(current_ == this) {
+                    current_ = nullptr;
+                }
+                for(auto& list : free_lists_) {
+                    while(list) {
+                        auto next = list->next;
+                        ::operator delete(list);
+                        list = next;
+                    }
+                }
+            }
+
+            // 当前线程的内存池，没有时返回nullptr
+            static object_pool* current() {
+                return current_;
+            }
+            void make_current() {
+                current_ = this;
+            }
+            void set_capacity(std::size_t bytes) {
+                capacity_ = bytes;
+            }
+
+            // 大小类的实际字节数，超过MAX_BLOCK时原样返回
+            static std::size_t block_size(std::size_t bytes) {
+                if(bytes > MAX_BLOCK) {
+                    return bytes;
+                }
+                std::size_t size = MIN_BLOCK;
+                while(size < bytes) {
+                    size <<= 1;
+                }
+                return size;
+            }
+
+            void* allocate(std::size_t bytes) {
+                auto size = block_size(bytes);
+                if(size <= MAX_BLOCK) {
+                    auto& list = free_lists_[class_index(size)];
+                    if(list) {
+                        auto block = list;
+                        list = block->next;
+                        add(hits_, 1);
+                        sub(resident_bytes_, size);
+                        return block;
+                    }
+                }
+                add(misses_, 1);
+                return ::operator new(size);
+            }
+            void deallocate(void* p, std::size_t bytes) {
+                auto size = block_size(bytes);
+                if(size > MAX_BLOCK || resident_bytes_.load(std::memory_order_relaxed) + size > capacity_) {
+                    ::operator delete(p);
+                    return;
+                }
+                auto block = static_cast<free_block*>(p);
+                auto& list = free_lists_[class_index(size)];
+                block->next = list;
+                list = block;
+                add(resident_bytes_, size);
+            }
+
+            stats_t stats() const {
+                return {
+                    hits_.load(std::memory_order_relaxed),
+                    misses_.load(std::memory_order_relaxed),
+                    resident_bytes_.load(std::memory_order_relaxed)
+                };
+            }
+
+        private:
+            struct free_block
+            {
+                free_block* next;
+            };
+
+            static std::size_t class_index(std::size_t size) {
+                return __builtin_ctzll(size) - __builtin_ctzll(MIN_BLOCK);
+            }
+            // 只有所属线程写入，不需要原子的读改写
+            static void add(std::atomic<std::size_t>& counter, std::size_t n) {
+                counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+            static void sub(std::atomic<std::size_t>& counter, std::size_t n) {
+                counter.store(counter.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+            }
+
+            static constexpr std::size_t CLASS_NUMS = 13;    // 16B ~ 64KiB
+            static_assert((MIN_BLOCK << (CLASS_NUMS - 1)) == MAX_BLOCK);
+
+            inline static thread_local object_pool* current_{ nullptr };
+
+            std::array<free_block*, CLASS_NUMS> free_lists_{};
+            std::size_t capacity_{ DEFAULT_CAPACITY };
+            std::atomic<std::size_t> hits_{ 0 };
+            std::atomic<std::size_t> misses_{ 0 };
+            std::atomic<std::size_t> resident_bytes_{ 0 };
+    };
+
+    // 无状态的分配器，从当前线程的内存池中分配，可以用于allocate_shared和容器
+    template <typename T>
+    class pool_allocator
+    {
+        public:
+            using value_type = T;
+            using is_always_equal = std::true_type;
+
+            pool_allocator() = default;
+            template <typename U>
+            pool_allocator(const pool_allocator<U>&) noexcept {  }
+
+            T* allocate(std::size_t n) {
+                auto bytes = n * sizeof(T);
+                if(auto pool = object_pool::current(); pool) {
+                    return static_cast<T*>(pool->allocate(bytes));
+                }
+                return static_cast<T*>(::operator new(object_pool::block_size(bytes)));
+            }
+            void deallocate(T* p, std::size_t n) noexcept {
+                if(auto pool = object_pool::current(); pool) {
+                    pool->deallocate(p, n * sizeof(T));
+                }
+                else {
+                    ::operator delete(p);
+                }
+            }
+
+            template <typename U>
+            bool operator==(const pool_allocator<U>&) const noexcept {
+                return true;
+            }
+            template <typename U>
+            bool operator!=(const pool_allocator<U>&) const noexcept {
+                return false;
+            }
+    };
+
+    // 对象和shared_ptr的控制块一起从当前线程的内存池中分配
+    template <typename T, typename... Args>
+    std::shared_ptr<T> make_pooled(Args&&... args) {
+        return std::allocate_shared<T>(pool_allocator<T>{}, std::forward<Args>(args)...);
+    }
+}
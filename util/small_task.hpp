@@ -0,0 +1,165 @@
+#pragma once
+
+#include "../std.hpp"
+#include "object_pool.hpp"
+
+namespace cortono::util
+{
+    /*
+     * 只能移动的void()任务，用于线程池
+     * 1.不超过INLINE_SIZE并且可以不抛异常地移动的闭包直接保存在对象内部，不分配内存
+     *   每种闭包类型一张操作表(调用、搬移、析构)，捕获std::string、shared_ptr、packaged_task的闭包也可以内部保存
+     *   其它闭包通过pool_allocator分配在堆上，对象内部只保存指针，在有内存池的线程中可以循环使用
+     * 2.ws_deque按字节读写任务，release()交出字节表示和所有权，adopt()从字节表示中重新取得所有权
+     *   可平凡复制的闭包和堆上的闭包可以按字节搬移，其它内部保存的闭包在release()时先移到堆上
+     */
+    class small_task
+    {
+        public:
+            static constexpr std::size_t INLINE_SIZE = 56;
+
+            // small_task的字节表示
+            struct raw
+            {
+                std::uint64_t words[8];
+            };
+
+            small_task() = default;
+
+            template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, small_task>>>
+            small_task(F&& f) {
+                using T = std::decay_t<F>;
+                if constexpr (sizeof(T) <= INLINE_SIZE && alignof(T) <= alignof(std::uint64_t)
+                        && std::is_nothrow_move_constructible_v<T>) {
+                    ::new (static_cast<void*>(storage_)) T(std::forward<F>(f));
+                    ops_ = &inline_ops<T>::table;
+                }
+                else {
+                    auto p = ::new (static_cast<void*>(pool_allocator<T>{}.allocate(1))) T(std::forward<F>(f));
+                    std::memcpy(storage_, &p, sizeof(p));
+                    ops_ = &boxed_ops<T>::table;
+                }
+            }
+
+            small_task(small_task&& other) noexcept {
+                take(other);
+            }
+            small_task& operator=(small_task&& other) noexcept {
+                if(this != &other) {
+                    reset();
+                    take(other);
+                }
+                return *this;
+            }
+            small_task(const small_task&) = delete;
+            small_task& operator=(const small_task&) = delete;
+
+            ~small_task() {
+                reset();
+            }
+
+            void operator()() {
+                ops_->invoke(storage_);
+            }
+            explicit operator bool() const {
+                return ops_ != nullptr;
+            }
+
+            raw release() && {
+                if(ops_ && !ops_->bitwise) {
+                    ops_ = ops_->box(storage_);
+                }
+                raw r;
+                std::memcpy(&r, static_cast<void*>(this), sizeof(raw));
+                ops_ = nullptr;
+                return r;
+            }
+            static small_task adopt(const raw& r) {
+                small_task task;
+                std::memcpy(static_cast<void*>(&task), &r, sizeof(raw));
+                return task;
+            }
+
+        private:
+            struct ops
+            {
+                void (*invoke)(void*);
+                // 在dst上移动构造并析构src
+                void (*relocate)(void* dst, void* src);
+                void (*destroy)(void*);
+                // 把内部保存的闭包移到堆上，返回堆上闭包的操作表
+                const ops* (*box)(void*);
+                // 可以按字节搬移
+                bool bitwise;
+            };
+
+            template <typename T>
+            struct boxed_ops
+            {
+                static T* get(void* storage) {
+                    T* p;
+                    std::memcpy(&p, storage, sizeof(p));
+                    return p;
+                }
+                static void invoke(void* storage) {
+                    (*get(storage))();
+                }
+                static void destroy(void* storage) {
+                    auto p = get(storage);
+                    p->~T();
+                    pool_allocator<T>{}.deallocate(p, 1);
+                }
+                static constexpr ops table{ invoke, nullptr, destroy, nullptr, true };
+            };
+
+            template <typename T>
+            struct inline_ops
+            {
+                static void invoke(void* storage) {
+                    (*static_cast<T*>(storage))();
+                }
+                static void relocate(void* dst, void* src) {
+                    ::new (dst) T(std::move(*static_cast<T*>(src)));
+                    static_cast<T*>(src)->~T();
+                }
+                static void destroy(void* storage) {
+                    static_cast<T*>(storage)->~T();
+                }
+                static const ops* box(void* storage) {
+                    auto p = ::new (static_cast<void*>(pool_allocator<T>{}.allocate(1))) T(std::move(*static_cast<T*>(storage)));
+                    static_cast<T*>(storage)->~T();
+                    std::memcpy(storage, &p, sizeof(p));
+                    return &boxed_ops<T>::table;
+                }
+                static constexpr ops table{
+                    invoke,
+                    relocate,
+                    std::is_trivially_destructible_v<T> ? nullptr : destroy,
+                    box,
+                    std::is_trivially_copyable_v<T>
+                };
+            };
+
+            void take(small_task& other) noexcept {
+                ops_ = other.ops_;
+                if(ops_ && !ops_->bitwise) {
+                    ops_->relocate(storage_, other.storage_);
+                }
+                else {
+                    std::memcpy(storage_, other.storage_, INLINE_SIZE);
+                }
+                other.ops_ = nullptr;
+            }
+            void reset() {
+                if(ops_ && ops_->destroy) {
+                    ops_->destroy(storage_);
+                }
+                ops_ = nullptr;
+            }
+
+        private:
+            const ops* ops_{ nullptr };
+            alignas(std::uint64_t) unsigned char storage_[INLINE_SIZE];
+    };
+    static_assert(sizeof(small_task) == sizeof(small_task::raw));
+}
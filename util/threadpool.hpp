@@ -3,74 +3,242 @@
 #include "../std.hpp"
 #include "util.hpp"
 #include "noncopyable.hpp"
+#include "small_task.hpp"
+#include "object_pool.hpp"
+#include "ws_deque.hpp"
 
 namespace cortono::util
 {
+    /*
+     * 工作窃取线程池
+     * 1.每个工作线程一个Chase-Lev队列，工作线程中提交的任务放入自己的队列，不需要加锁
+     *   其它线程提交的任务放入共享的注入队列
+     * 2.工作线程依次从自己的队列、注入队列、其它线程的队列中取任务，都没有时进入睡眠
+     * 3.任务类型为small_task，小闭包不分配内存，每个工作线程一个内存池，堆上的闭包在工作线程之间循环使用
+     * 4.quit时执行完已经提交的任务再退出
+     *
+     * 每个线程池是一个独立的对象，EventLoop不运行在线程池中
+     */
     class threadpool : private util::noncopyable
     {
         public:
-            threadpool()
-            {  }
-
-            ~threadpool()
-            {
-                if(!quit_) {
-                    quit();
+            explicit threadpool(std::size_t thread_nums = std::thread::hardware_concurrency()) {
+                thread_nums = std::max<std::size_t>(thread_nums, 1);
+                for(std::size_t i = 0; i < thread_nums; ++i) {
+                    workers_.emplace_back(std::make_unique<worker>());
+                }
+                for(std::size_t i = 0; i < thread_nums; ++i) {
+                    workers_[i]->thread = std::thread([this, i] { run(i); });
                 }
             }
 
-            void start(int thread_nums = std::thread::hardware_concurrency()) {
-                for(int i = 0; i < thread_nums; ++i) {
-                    threads_.emplace_back([this] {
-                        while(!quit_) {
-                            std::function<void()> task;
-                            {
-                                std::unique_lock lock { mutex_ };
-                                cond_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
-                                if(quit_)   return;
-                                task = tasks_.front();
-                                tasks_.pop();
-                            }
-                            task();
-                        }
-                    });
-                }
+            ~threadpool() {
+                quit();
             }
+
             void quit() {
-                quit_ = true;
+                {
+                    std::unique_lock lock{ mutex_ };
+                    if(quit_) {
+                        return;
+                    }
+                    quit_ = true;
+                }
                 cond_.notify_all();
-                for(auto& th : threads_)
-                    th.join();
+                for(auto& w : workers_) {
+                    if(w->thread.joinable()) {
+                        w->thread.join();
+                    }
+                }
+            }
+
+            std::size_t size() const {
+                return workers_.size();
+            }
+
+            // 提交任务，不关心返回值
+            template <typename F>
+            void post(F&& f) {
+                submit(small_task(std::forward<F>(f)));
             }
 
             template <class F, class... Args>
             auto async(F&& f, Args... args)
-                -> std::future<typename std::result_of<F(Args...)>::type>
+                -> std::future<std::invoke_result_t<F, Args...>>
             {
-                using return_type = typename std::result_of<F(Args...)>::type;
-                auto task = std::make_shared<std::packaged_task<return_type()>>(
-                            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-                        );
-                std::future result { task->get_future() };
-                {
-                    std::unique_lock lock { mutex_ };
-                    tasks_.emplace( [task] { return (*task)(); });
+                using return_type = std::invoke_result_t<F, Args...>;
+                std::packaged_task<return_type()> task(
+                    [f = std::forward<F>(f), args = std::make_tuple(std::move(args)...)]() mutable {
+                        return std::apply(f, std::move(args));
+                    });
+                auto result = task.get_future();
+                submit(small_task(std::move(task)));
+                return result;
+            }
+
+            /*
+             * 对[first, last)中的每个下标调用f(i)，返回时全部执行完成
+             * 1.区间按grain切分成多个任务，grain为0时每个线程大约分到4个任务
+             * 2.调用者在等待期间也执行任务，在工作线程中调用不会死锁
+             * 3.f抛出异常时，等待全部任务结束后重新抛出第一个异常
+             */
+            template <typename Index, typename F>
+            void parallel_for(Index first, Index last, F&& f, Index grain = 0) {
+                if(first >= last) {
+                    return;
+                }
+                auto n = static_cast<std::size_t>(last - first);
+                auto chunk = grain > 0 ? static_cast<std::size_t>(grain) : std::max<std::size_t>(1, n / (workers_.size() * 4));
+                auto chunks = (n + chunk - 1) / chunk;
+                std::atomic<std::size_t> remaining{ chunks };
+                std::exception_ptr error;
+                std::mutex error_mutex;
+                for(std::size_t c = 0; c < chunks; ++c) {
+                    auto begin = first + static_cast<Index>(c * chunk);
+                    auto end = first + static_cast<Index>(std::min(n, (c + 1) * chunk));
+                    auto body = [&f, &remaining, &error, &error_mutex, begin, end] {
+                        try {
+                            for(auto i = begin; i < end; ++i) {
+                                f(i);
+                            }
+                        }
+                        catch(...) {
+                            std::unique_lock lock{ error_mutex };
+                            if(!error) {
+                                error = std::current_exception();
+                            }
+                        }
+                        remaining.fetch_sub(1, std::memory_order_acq_rel);
+                    };
+                    submit(small_task(body));
+                }
+                while(remaining.load(std::memory_order_acquire) != 0) {
+                    if(!run_one()) {
+                        std::this_thread::yield();
+                    }
+                }
+                if(error) {
+                    std::rethrow_exception(error);
+                }
+            }
+
+        private:
+            struct worker
+            {
+                ws_deque<small_task::raw> deque;
+                std::thread thread;
+            };
+
+            void submit(small_task task) {
+                if(current_pool_ == this) {
+                    workers_[current_index_]->deque.push(std::move(task).release());
+                }
+                else {
+                    std::unique_lock lock{ inject_mutex_ };
+                    injected_.push_back(std::move(task));
+                    has_injected_.store(true, std::memory_order_relaxed);
+                }
+                // 和工作线程睡眠前的检查构成Dekker式的同步，保证不会漏掉唤醒
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if(sleeping_.load(std::memory_order_relaxed) > 0) {
+                    std::unique_lock lock{ mutex_ };
                     cond_.notify_one();
                 }
-                return result;
             }
+
+            bool take(small_task& task) {
+                small_task::raw r;
+                if(current_pool_ == this && workers_[current_index_]->deque.pop(r)) {
+                    task = small_task::adopt(r);
+                    return true;
+                }
+                if(has_injected_.load(std::memory_order_relaxed)) {
+                    std::unique_lock lock{ inject_mutex_ };
+                    if(!injected_.empty()) {
+                        task = std::move(injected_.front());
+                        injected_.pop_front();
+                        has_injected_.store(!injected_.empty(), std::memory_order_relaxed);
+                        return true;
+                    }
+                }
+                // 从下一个线程开始依次窃取，避免所有线程都从第0个开始
+                auto start = current_pool_ == this ? current_index_ + 1 : 0;
+                for(std::size_t k = 0; k < workers_.size(); ++k) {
+                    auto& victim = workers_[(start + k) % workers_.size()];
+                    if(victim->deque.steal(r)) {
+                        task = small_task::adopt(r);
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            bool run_one() {
+                small_task task;
+                if(!take(task)) {
+                    return false;
+                }
+                task();
+                return true;
+            }
+
+            bool has_work() {
+                if(has_injected_.load(std::memory_order_relaxed)) {
+                    return true;
+                }
+                for(auto& w : workers_) {
+                    if(!w->deque.empty()) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void run(std::size_t index) {
+                object_pool pool;
+                pool.make_current();
+                current_pool_ = this;
+                current_index_ = index;
+                constexpr int SPIN_NUMS = 16;
+                int spins = 0;
+                while(true) {
+                    if(run_one()) {
+                        spins = 0;
+                        continue;
+                    }
+                    if(++spins < SPIN_NUMS) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    spins = 0;
+                    std::unique_lock lock{ mutex_ };
+                    sleeping_.fetch_add(1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if(!has_work()) {
+                        if(quit_) {
+                            sleeping_.fetch_sub(1, std::memory_order_relaxed);
+                            break;
+                        }
+                        cond_.wait(lock);
+                    }
+                    sleeping_.fetch_sub(1, std::memory_order_relaxed);
+                }
+                current_pool_ = nullptr;
+            }
+
         private:
-            std::atomic<bool> quit_;
+            inline static thread_local threadpool* current_pool_{ nullptr };
+            inline static thread_local std::size_t current_index_{ 0 };
+
+            std::vector<std::unique_ptr<worker>> workers_;
+
+            std::mutex inject_mutex_;
+            std::deque<small_task> injected_;
+            std::atomic<bool> has_injected_{ false };
+
             std::mutex mutex_;
             std::condition_variable cond_;
-            std::vector<std::thread> threads_;
-            std::queue<std::function<void()>> tasks_;
-
-        public:
-            static threadpool& instance()
-            {
-                static threadpool inst;
-                return inst;
-            }
+            std::atomic<std::size_t> sleeping_{ 0 };
+            bool quit_{ false };
     };
 }
@@ -2,16 +2,28 @@
 
 #include "../std.hpp"
 #include "noncopyable.hpp"
+#include "log_writer.hpp"
 #include <experimental/filesystem>
 
 namespace cortono
 {
 
-#define log_trace   cortono::util::logger(cortono::util::logger::trace, __FILE__, __func__, __LINE__)
-#define log_debug   cortono::util::logger(cortono::util::logger::debug, __FILE__, __func__, __LINE__)
-#define log_info    cortono::util::logger(cortono::util::logger::info,  __FILE__, __func__, __LINE__)
-#define log_error   cortono::util::logger(cortono::util::logger::error, __FILE__, __func__, __LINE__)
-#define log_fatal   cortono::util::logger(cortono::util::logger::fatal, __FILE__, __func__, __LINE__)
+// 编译期最低日志级别，0~4依次为trace、debug、info、error、fatal
+// 低于该级别的log_xxx整条语句被丢弃，参数也不会求值，如-DCORTONO_LOG_LEVEL=2只保留info及以上
+#ifndef CORTONO_LOG_LEVEL
+#define CORTONO_LOG_LEVEL 0
+#endif
+
+#define CORTONO_LOG(l) \
+    if constexpr(cortono::util::logger::l < CORTONO_LOG_LEVEL) {} \
+    else if(!cortono::util::logger::enabled(cortono::util::logger::l)) {} \
+    else cortono::util::logger(cortono::util::logger::l, __FILE__, __func__, __LINE__)
+
+#define log_trace   CORTONO_LOG(trace)
+#define log_debug   CORTONO_LOG(debug)
+#define log_info    CORTONO_LOG(info)
+#define log_error   CORTONO_LOG(error)
+#define log_fatal   CORTONO_LOG(fatal)
 
     namespace util
     {
@@ -64,6 +76,13 @@ namespace cortono
                 }
         };
 
+        /*
+         * 日志，每条日志由log_xxx宏构造一个临时对象，析构时输出
+         * 1.格式化到线程局部的缓冲区，线程号只格式化一次，时间只在秒数变化时重新格式化
+         * 2.loop线程每轮调用tick缓存当前时间，本轮之后的日志不再读取时钟
+         * 3.log_writer启动后写入本线程的环形缓冲区由后台线程写出，否则在调用线程中写标准输出
+         * 4.除了编译期的CORTONO_LOG_LEVEL，还可以通过set_level在运行时提高级别
+         */
         class logger : private util::noncopyable
         {
             public:
@@ -76,35 +95,51 @@ namespace cortono
                     fatal
                 };
             public:
-                logger(level l, const std::string& file, const std::string& func, int line)
+                logger(level l, const char* file, const char* func, int line)
                     : l_(l)
                 {
-                    if(is_open) {
-                        buffer_ << util::current_time()
-                                << " [" << util::current_thread() << "]"
-                                << " [" << format_level() << "]"
-                                << " [" << file << ":" << func << ":" << line << "] ";
+                    // 参数求值时可能再次写日志，嵌套的日志使用自己的缓冲区
+                    auto& state = local();
+                    if(!state.in_use) {
+                        state.in_use = true;
+                        buffer_ = &state.buffer;
+                        buffer_->clear();
+                    }
+                    else {
+                        buffer_ = &own_;
                     }
+                    append_time(state);
+                    buffer_->append(" [").append(state.thread_id).append("] [");
+                    buffer_->append(format_level()).append("] [");
+                    buffer_->append(file).append(":").append(func).append(":");
+                    append(line);
+                    buffer_->append("] ");
                 }
 
                 ~logger() {
-                    if(!is_open) {
-                        return;
+                    buffer_->push_back('\n');
+                    if(log_writer::active()) {
+                        if(l_ == level::fatal) {
+                            log_writer::instance().write_fatal(buffer_->data(), buffer_->size());
+                        }
+                        else {
+                            log_writer::instance().push(buffer_->data(), buffer_->size());
+                        }
+                    }
+                    else {
+                        std::fwrite(buffer_->data(), 1, buffer_->size(), ::stdout);
+                        std::fflush(::stdout);
+                    }
+                    if(buffer_ != &own_) {
+                        local().in_use = false;
                     }
-                    buffer_ << std::endl;
-                    auto msg(buffer_.str());
-                    std::fwrite(msg.c_str(), 1, msg.size(), ::stdout);
-                    std::fflush(::stdout);
                     if(l_ == level::fatal)
                         ::abort();
                 }
 
                 template <typename T, typename... Args>
-                logger& operator()(T msg, Args... args) {
-                    if(!is_open) {
-                        return *this;
-                    }
-                    buffer_ << msg;
+                logger& operator()(const T& msg, const Args&... args) {
+                    append(msg);
                     if constexpr(sizeof...(Args) == 0) {
                         return *this;
                     }
@@ -121,9 +156,69 @@ namespace cortono
                 static void close_logger() {
                     is_open = false;
                 }
+                static void set_level(level l) {
+                    min_level_.store(l, std::memory_order_relaxed);
+                }
+                static bool enabled(level l) {
+                    return is_open && l >= min_level_.load(std::memory_order_relaxed);
+                }
+                // loop线程每轮调用一次
+                static void tick() {
+                    auto& state = local();
+                    state.ticking = true;
+                    state.now = std::time(nullptr);
+                }
 
            private:
-                std::string format_level()
+                struct thread_state
+                {
+                    std::string buffer;
+                    bool in_use{ false };
+                    std::string thread_id{ current_thread() };
+                    bool ticking{ false };
+                    std::time_t now{ 0 };
+                    std::time_t formatted{ -1 };
+                    char time_text[32]{ 0 };
+                };
+                static thread_state& local() {
+                    thread_local thread_state state;
+                    return state;
+                }
+
+                void append_time(thread_state& state) {
+                    auto now = state.ticking ? state.now : std::time(nullptr);
+                    if(now != state.formatted) {
+                        state.formatted = now;
+                        ::ctime_r(&now, state.time_text);
+                        state.time_text[std::strlen(state.time_text) - 1] = '\0';
+                    }
+                    buffer_->append(state.time_text);
+                }
+                // 常用类型直接追加，其它类型经过ostringstream
+                template <typename T>
+                void append(const T& value) {
+                    if constexpr(std::is_same_v<T, bool>) {
+                        buffer_->push_back(value ? '1' : '0');
+                    }
+                    else if constexpr(std::is_same_v<T, char> || std::is_same_v<T, signed char> || std::is_same_v<T, unsigned char>) {
+                        buffer_->push_back(static_cast<char>(value));
+                    }
+                    else if constexpr(std::is_integral_v<T>) {
+                        char text[24];
+                        auto result = std::to_chars(text, text + sizeof(text), value);
+                        buffer_->append(text, result.ptr - text);
+                    }
+                    else if constexpr(std::is_convertible_v<const T&, std::string_view>) {
+                        std::string_view view = value;
+                        buffer_->append(view.data(), view.size());
+                    }
+                    else {
+                        std::ostringstream oss;
+                        oss << value;
+                        buffer_->append(oss.str());
+                    }
+                }
+                const char* format_level()
                 {
                     switch(l_) {
                         case level::trace:
@@ -144,9 +239,11 @@ namespace cortono
 
             private:
                 level l_;
-                std::stringstream buffer_;
+                std::string* buffer_;
+                std::string own_;
 
                 static bool is_open;
+                inline static std::atomic<int> min_level_{ trace };
         };
         inline bool logger::is_open = true;
 
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "../std.hpp"
+#include "noncopyable.hpp"
+
+namespace cortono::util
+{
+    /*
+     * Chase-Lev工作窃取双端队列(按照Lê等人给出的C11内存序实现)
+     * 1.push/pop只能在所属线程调用，在bottom一端后进先出
+     * 2.steal可以在任意线程调用，在top一端先进先出，和pop之间通过top上的CAS竞争最后一个元素
+     * 3.队列满时扩容为两倍，旧数组可能仍在被窃取者读取，保留到队列析构时再释放
+     *
+     * 窃取者读取元素后CAS失败时读到的内容作废，但读取和所属线程的写入仍可能同时发生
+     * 所以元素按64位字保存在原子变量中，T必须可平凡复制并且大小是8的倍数
+     */
+    template <typename T>
+    class ws_deque : private util::noncopyable
+    {
+        static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % sizeof(std::uint64_t) == 0);
+
+        private:
+            static constexpr std::size_t WORDS = sizeof(T) / sizeof(std::uint64_t);
+
+            struct array
+            {
+                explicit array(std::int64_t cap)
+                    : capacity(cap),
+                      slots(new std::atomic<std::uint64_t>[cap * WORDS])
+                {  }
+
+                void put(std::int64_t i, const T& value) {
+                    std::uint64_t words[WORDS];
+                    std::memcpy(words, &value, sizeof(T));
+                    auto slot = &slots[(i & (capacity - 1)) * WORDS];
+                    for(std::size_t w = 0; w < WORDS; ++w) {
+                        slot[w].store(words[w], std::memory_order_relaxed);
+                    }
+                }
+                T get(std::int64_t i) const {
+                    std::uint64_t words[WORDS];
+                    auto slot = &slots[(i & (capacity - 1)) * WORDS];
+                    for(std::size_t w = 0; w < WORDS; ++w) {
+                        words[w] = slot[w].load(std::memory_order_relaxed);
+                    }
+                    T value;
+                    std::memcpy(&value, words, sizeof(T));
+                    return value;
+                }
+
+                std::int64_t capacity;
+                std::unique_ptr<std::atomic<std::uint64_t>[]> slots;
+            };
+
+        public:
+            explicit ws_deque(std::int64_t capacity = 256) {
+                retired_.emplace_back(std::make_unique<array>(capacity));
+                array_.store(retired_.back().get(), std::memory_order_relaxed);
+            }
+
+            void push(const T& value) {
+                auto b = bottom_.load(std::memory_order_relaxed);
+                auto t = top_.load(std::memory_order_acquire);
+                auto a = array_.load(std::memory_order_relaxed);
+                if(b - t > a->capacity - 1) {
+                    a = grow(a, t, b);
+                }
+                a->put(b, value);
+                std::atomic_thread_fence(std::memory_order_release);
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+
+            bool pop(T& value) {
+                auto b = bottom_.load(std::memory_order_relaxed) - 1;
+                auto a = array_.load(std::memory_order_relaxed);
+                bottom_.store(b, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                auto t = top_.load(std::memory_order_relaxed);
+                if(t > b) {
+                    bottom_.store(b + 1, std::memory_order_relaxed);
+                    return false;
+                }
+                value = a->get(b);
+                if(t == b) {
+                    // 最后一个元素，和窃取者竞争
+                    bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                    bottom_.store(b + 1, std::memory_order_relaxed);
+                    return won;
+                }
+                return true;
+            }
+
+            bool steal(T& value) {
+                auto t = top_.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                auto b = bottom_.load(std::memory_order_acquire);
+                if(t >= b) {
+                    return false;
+                }
+                auto a = array_.load(std::memory_order_acquire);
+                auto v = a->get(t);
+                if(!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    return false;
+                }
+                value = v;
+                return true;
+            }
+
+            // 近似值，只用于判断是否有任务可以窃取
+            bool empty() const {
+                return bottom_.load(std::memory_order_acquire) <= top_.load(std::memory_order_acquire);
+            }
+
+        private:
+            array* grow(array* old, std::int64_t t, std::int64_t b) {
+                retired_.emplace_back(std::make_unique<array>(old->capacity * 2));
+                auto a = retired_.back().get();
+                for(auto i = t; i < b; ++i) {
+                    a->put(i, old->get(i));
+                }
+                array_.store(a, std::memory_order_release);
+                return a;
+            }
+
+        private:
+            alignas(64) std::atomic<std::int64_t> top_{ 0 };
+            alignas(64) std::atomic<std::int64_t> bottom_{ 0 };
+            std::atomic<array*> array_{ nullptr };
+            // 只有所属线程访问
+            std::vector<std::unique_ptr<array>> retired_;
+    };
+}